@@ -11,6 +11,7 @@
 #include <linux/cpu.h>
 #include <linux/blk-iopoll.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
 
 #include "blk.h"
 
@@ -189,6 +190,123 @@ void blk_iopoll_init(struct blk_iopoll *iop, int weight, blk_iopoll_fn *poll_fn)
 }
 EXPORT_SYMBOL(blk_iopoll_init);
 
+/**
+ * blk_iopoll_run - Run the iopoll handler from the calling task
+ * @iop:      The parent iopoll structure
+ *
+ * Description:
+ *     For use in a driver's poll_queue_fn, see blk_queue_poll(). If @iop is
+ *     idle, take it over and invoke its handler right away instead of
+ *     waiting for an interrupt to schedule it. The handler may thus run
+ *     while the device interrupt is still enabled, and must cope with
+ *     that. If it uses up its weight, @iop is passed on to the softirq as
+ *     if an interrupt had scheduled it. Returns the number of completions
+ *     the handler processed, 0 if @iop was busy or disabled.
+ **/
+int blk_iopoll_run(struct blk_iopoll *iop)
+{
+	LIST_HEAD(list);
+	int work;
+
+	if (blk_iopoll_sched_prep(iop))
+		return 0;
+
+	/*
+	 * The handler expects to run from the softirq, and completing the
+	 * iop takes it off whatever list it is on.
+	 */
+	local_bh_disable();
+	local_irq_disable();
+	list_add(&iop->list, &list);
+	local_irq_enable();
+
+	work = iop->poll(iop, iop->weight);
+
+	if (work >= iop->weight) {
+		local_irq_disable();
+		if (blk_iopoll_disable_pending(iop)) {
+			__blk_iopoll_complete(iop);
+		} else {
+			list_move_tail(&iop->list,
+				       &__get_cpu_var(blk_cpu_iopoll));
+			__raise_softirq_irqoff(BLOCK_IOPOLL_SOFTIRQ);
+		}
+		local_irq_enable();
+	}
+	local_bh_enable();
+
+	return work;
+}
+EXPORT_SYMBOL(blk_iopoll_run);
+
+/*
+ * The completion time of polled I/O is kept per queue as a moving
+ * average, each sample weighted 1/8. It is updated without locking, as
+ * it is only a hint for how long spinning may pay off.
+ */
+static void blk_poll_account(struct request_queue *q, unsigned long nsecs)
+{
+	unsigned long mean = q->poll_nsecs;
+
+	q->poll_nsecs = mean - (mean >> 3) + (nsecs >> 3);
+}
+
+/**
+ * blk_poll - Spin on a queue's completions while waiting for sync I/O
+ * @q:        The queue the I/O was issued to
+ * @done:     Returns non-zero once the caller's I/O has completed
+ * @data:     Argument for @done
+ *
+ * Description:
+ *     For devices completing I/O in a few microseconds, the interrupt and
+ *     the wakeup of the waiting task cost about as much as the I/O
+ *     itself. A task about to sleep on synchronous I/O calls this to reap
+ *     completions through the queue's poll function instead. It spins
+ *     for at most twice the queue's estimated completion time, and never
+ *     longer than the queue's io_poll_usecs. Once completions take longer
+ *     than that, tasks go straight to sleep and the estimate decays, so
+ *     that polling is retried after a while.
+ *
+ *     Must be called with the I/O already unplugged. Returns 1 if @done
+ *     became true while polling, 0 if the caller has to sleep.
+ **/
+int blk_poll(struct request_queue *q, int (*done)(void *), void *data)
+{
+	unsigned long limit, mean, spun;
+	ktime_t start;
+
+	if (!q->poll_fn || !q->poll_usecs)
+		return 0;
+
+	limit = q->poll_usecs * NSEC_PER_USEC;
+	mean = q->poll_nsecs;
+	if (mean > limit) {
+		q->poll_nsecs = mean - (mean >> 3);
+		return 0;
+	}
+	if (mean)
+		limit = min(limit, 2 * mean);
+
+	start = ktime_get();
+	for (;;) {
+		q->poll_fn(q);
+		spun = ktime_to_ns(ktime_sub(ktime_get(), start));
+		if (done(data)) {
+			blk_poll_account(q, spun);
+			return 1;
+		}
+		if (spun >= limit) {
+			/* push the estimate beyond what we were willing to spin */
+			blk_poll_account(q, 2 * limit);
+			return 0;
+		}
+		if (need_resched())
+			return 0;
+		cpu_relax();
+	}
+}
+EXPORT_SYMBOL_GPL(blk_poll);
+
 static int __cpuinit blk_iopoll_cpu_notify(struct notifier_block *self,
 					  unsigned long action, void *hcpu)
 {
@@ -0,0 +1,163 @@
+/*
+ * Tag allocation for blk-mq hardware queues.
+ *
+ * Tags are plain bits in a bitmap: the first nr_reserved_tags are only
+ * handed out to callers asking for a reserved tag, the rest are for
+ * normal I/O.  Each cpu remembers where its last search ended, so that
+ * cpus sharing a hardware queue mostly work on different words of the
+ * bitmap.  Waiters for the two pools sleep on separate wait queues.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/bitops.h>
+
+#include "blk-mq-tag.h"
+
+struct blk_mq_tags {
+	unsigned int nr_tags;
+	unsigned int nr_reserved_tags;
+
+	unsigned int *hint;		/* per-cpu search start */
+	wait_queue_head_t wait[2];	/* normal, reserved */
+
+	unsigned long map[0];
+};
+
+static int __blk_mq_find_tag(unsigned long *map, unsigned int start,
+			     unsigned int end, unsigned int hint)
+{
+	unsigned int tag;
+	bool wrapped = false;
+
+	if (hint < start || hint >= end)
+		hint = start;
+
+	tag = hint;
+	for (;;) {
+		tag = find_next_zero_bit(map, end, tag);
+		if (tag >= end) {
+			if (wrapped || hint == start)
+				return -1;
+			wrapped = true;
+			tag = start;
+			continue;
+		}
+		if (wrapped && tag >= hint)
+			return -1;
+		if (!test_and_set_bit_lock(tag, map))
+			return tag;
+		tag++;
+	}
+}
+
+static int __blk_mq_get_tag(struct blk_mq_tags *tags, bool reserved)
+{
+	unsigned int *hint = per_cpu_ptr(tags->hint, raw_smp_processor_id());
+	unsigned int start, end;
+	int tag;
+
+	if (reserved) {
+		start = 0;
+		end = tags->nr_reserved_tags;
+	} else {
+		start = tags->nr_reserved_tags;
+		end = tags->nr_tags;
+	}
+
+	tag = __blk_mq_find_tag(tags->map, start, end, *hint);
+	if (tag >= 0)
+		*hint = tag + 1;
+	return tag;
+}
+
+/**
+ * blk_mq_get_tag - allocate a tag
+ * @tags:	tag set of the hardware queue
+ * @gfp:	allocation mask, __GFP_WAIT allows sleeping until a tag is freed
+ * @reserved:	allocate from the reserved pool
+ *
+ * Returns the tag, or -1 if none was available and we could not wait.
+ */
+int blk_mq_get_tag(struct blk_mq_tags *tags, gfp_t gfp, bool reserved)
+{
+	wait_queue_head_t *wq = &tags->wait[reserved];
+	DEFINE_WAIT(wait);
+	int tag;
+
+	if (reserved && WARN_ON_ONCE(!tags->nr_reserved_tags))
+		return -1;
+
+	tag = __blk_mq_get_tag(tags, reserved);
+	if (tag >= 0 || !(gfp & __GFP_WAIT))
+		return tag;
+
+	for (;;) {
+		prepare_to_wait_exclusive(wq, &wait, TASK_UNINTERRUPTIBLE);
+		tag = __blk_mq_get_tag(tags, reserved);
+		if (tag >= 0)
+			break;
+		io_schedule();
+	}
+	finish_wait(wq, &wait);
+
+	return tag;
+}
+
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+{
+	wait_queue_head_t *wq = &tags->wait[tag < tags->nr_reserved_tags];
+
+	BUG_ON(tag >= tags->nr_tags);
+
+	clear_bit_unlock(tag, tags->map);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(wq))
+		wake_up(wq);
+}
+
+/*
+ * Call @fn for every tag that is currently allocated.  Nothing stops tags
+ * from being freed or allocated while we walk, @fn has to cope with that.
+ */
+void blk_mq_tag_busy_iter(struct blk_mq_tags *tags,
+			  void (*fn)(void *data, unsigned int tag), void *data)
+{
+	unsigned int tag;
+
+	for_each_bit(tag, tags->map, tags->nr_tags)
+		fn(data, tag);
+}
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags,
+				     unsigned int reserved_tags, int node)
+{
+	struct blk_mq_tags *tags;
+	size_t size;
+
+	size = sizeof(*tags) + BITS_TO_LONGS(nr_tags) * sizeof(unsigned long);
+	tags = kzalloc_node(size, GFP_KERNEL, node);
+	if (!tags)
+		return NULL;
+
+	tags->hint = alloc_percpu(unsigned int);
+	if (!tags->hint) {
+		kfree(tags);
+		return NULL;
+	}
+
+	tags->nr_tags = nr_tags;
+	tags->nr_reserved_tags = reserved_tags;
+	init_waitqueue_head(&tags->wait[0]);
+	init_waitqueue_head(&tags->wait[1]);
+	return tags;
+}
+
+void blk_mq_free_tags(struct blk_mq_tags *tags)
+{
+	free_percpu(tags->hint);
+	kfree(tags);
+}
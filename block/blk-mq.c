@@ -0,0 +1,1097 @@
+/*
+ * Block multiqueue core code
+ *
+ * Every cpu stages requests on its own software queue (struct blk_mq_ctx),
+ * which is mapped onto one of the hardware dispatch queues the driver
+ * registered (struct blk_mq_hw_ctx).  Requests are preallocated per
+ * hardware queue and identified by their tag, so the submission path takes
+ * no queue wide lock.  Completions are run on the cpu that submitted the
+ * request.
+ *
+ * There is no elevator: bios are only merged with the last few requests
+ * still sitting on the submitting cpu's software queue.  Barriers are
+ * implemented by draining the whole queue.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/smp.h>
+#include <linux/cpu.h>
+#include <linux/percpu.h>
+#include <linux/completion.h>
+
+#include <trace/events/block.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+#include "blk-mq-tag.h"
+
+/* usage counter batch, the counter is only summed when draining */
+#define BLK_MQ_USAGE_BATCH	1000000
+
+/* requests on the software queue looked at for a merge */
+#define BLK_MQ_MERGE_DEPTH	8
+
+static DEFINE_MUTEX(all_q_mutex);
+static LIST_HEAD(all_q_list);
+
+static struct blk_mq_ctx *__blk_mq_get_ctx(struct request_queue *q,
+					   unsigned int cpu)
+{
+	return per_cpu_ptr(q->queue_ctx, cpu);
+}
+
+/*
+ * The ctx is only a staging area protected by its own lock, it does not
+ * matter if we get migrated right after picking it.
+ */
+static struct blk_mq_ctx *blk_mq_get_ctx(struct request_queue *q)
+{
+	return __blk_mq_get_ctx(q, raw_smp_processor_id());
+}
+
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
+{
+	return q->queue_hw_ctx[q->mq_map[cpu]];
+}
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+static struct blk_mq_hw_ctx *blk_mq_rq_hctx(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	return q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+}
+
+/*
+ * Check if any of the ctx's have pending work in this hardware queue
+ */
+static bool blk_mq_hctx_has_pending(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < BITS_TO_LONGS(hctx->nr_ctx); i++)
+		if (hctx->ctx_map[i])
+			return true;
+
+	return !list_empty_careful(&hctx->dispatch);
+}
+
+/*
+ * Mark this ctx as having pending work in this hardware queue
+ */
+static void blk_mq_hctx_mark_pending(struct blk_mq_hw_ctx *hctx,
+				     struct blk_mq_ctx *ctx)
+{
+	if (!test_bit(ctx->index_hw, hctx->ctx_map))
+		set_bit(ctx->index_hw, hctx->ctx_map);
+}
+
+/*
+ * Every allocated request holds a usage count on the queue.  Barriers set
+ * QUEUE_FLAG_BYPASS and wait for the count to drop to zero, new requests
+ * wait for the flag to clear again.
+ */
+static int blk_mq_queue_enter(struct request_queue *q, gfp_t gfp)
+{
+	for (;;) {
+		__percpu_counter_add(&q->mq_usage_counter, 1,
+				     BLK_MQ_USAGE_BATCH);
+		smp_mb();
+		if (!test_bit(QUEUE_FLAG_BYPASS, &q->queue_flags))
+			return 0;
+		__percpu_counter_add(&q->mq_usage_counter, -1,
+				     BLK_MQ_USAGE_BATCH);
+		smp_mb();
+		wake_up_all(&q->mq_freeze_wq);
+
+		if (!(gfp & __GFP_WAIT))
+			return -EBUSY;
+
+		wait_event(q->mq_freeze_wq,
+			   !test_bit(QUEUE_FLAG_BYPASS, &q->queue_flags));
+	}
+}
+
+static void blk_mq_queue_exit(struct request_queue *q)
+{
+	__percpu_counter_add(&q->mq_usage_counter, -1, BLK_MQ_USAGE_BATCH);
+	smp_mb();
+	if (unlikely(test_bit(QUEUE_FLAG_BYPASS, &q->queue_flags)))
+		wake_up_all(&q->mq_freeze_wq);
+}
+
+static void blk_mq_freeze_queue(struct request_queue *q)
+{
+	spin_lock_irq(q->queue_lock);
+	q->bypass_depth++;
+	queue_flag_set(QUEUE_FLAG_BYPASS, q);
+	spin_unlock_irq(q->queue_lock);
+	smp_mb();
+
+	/* whatever is still staged has to be pushed out to complete */
+	blk_mq_run_queues(q, false);
+	wait_event(q->mq_freeze_wq,
+		   percpu_counter_sum(&q->mq_usage_counter) == 0);
+}
+
+static void blk_mq_unfreeze_queue(struct request_queue *q)
+{
+	bool wake = false;
+
+	spin_lock_irq(q->queue_lock);
+	if (!--q->bypass_depth) {
+		queue_flag_clear(QUEUE_FLAG_BYPASS, q);
+		wake = true;
+	}
+	WARN_ON_ONCE(q->bypass_depth < 0);
+	spin_unlock_irq(q->queue_lock);
+
+	if (wake)
+		wake_up_all(&q->mq_freeze_wq);
+}
+
+static struct request *__blk_mq_alloc_request(struct request_queue *q,
+					      unsigned int rw_flags, gfp_t gfp,
+					      bool reserved)
+{
+	struct blk_mq_ctx *ctx = blk_mq_get_ctx(q);
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, ctx->cpu);
+	struct request *rq;
+	int tag;
+
+	tag = blk_mq_get_tag(hctx->tags, gfp & ~__GFP_WAIT, reserved);
+	if (tag < 0 && (gfp & __GFP_WAIT)) {
+		/* make sure what is staged gets going before we sleep */
+		blk_mq_run_hw_queue(hctx, false);
+		tag = blk_mq_get_tag(hctx->tags, gfp, reserved);
+	}
+	if (tag < 0)
+		return NULL;
+
+	rq = hctx->rqs[tag];
+	blk_rq_init(q, rq);
+	rq->tag = tag;
+	rq->mq_ctx = ctx;
+	rq->cmd_flags = rw_flags;
+	if (blk_queue_io_stat(q))
+		rq->cmd_flags |= REQ_IO_STAT;
+
+	return rq;
+}
+
+/**
+ * blk_mq_alloc_request - allocate a request on a multiqueue queue
+ * @q:		the queue
+ * @rw:		READ or WRITE, plus request flags
+ * @gfp:	allocation mask, with __GFP_WAIT this cannot fail
+ * @reserved:	allocate from the tags the driver reserved for itself
+ */
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp, bool reserved)
+{
+	struct request *rq;
+
+	if (blk_mq_queue_enter(q, gfp))
+		return NULL;
+
+	rq = __blk_mq_alloc_request(q, rw, gfp, reserved);
+	if (!rq)
+		blk_mq_queue_exit(q);
+	return rq;
+}
+EXPORT_SYMBOL(blk_mq_alloc_request);
+
+void blk_mq_free_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx = blk_mq_rq_hctx(rq);
+	const int tag = rq->tag;
+
+	rq->cmd_flags = 0;
+	blk_mq_put_tag(hctx->tags, tag);
+	blk_mq_queue_exit(q);
+}
+EXPORT_SYMBOL(blk_mq_free_request);
+
+static void blk_mq_account_io_done(struct request *rq)
+{
+	if (blk_do_io_stat(rq)) {
+		unsigned long duration = jiffies - rq->start_time;
+		const int rw = rq_data_dir(rq);
+		struct hd_struct *part;
+		int cpu;
+
+		cpu = part_stat_lock();
+		part = disk_map_sector_rcu(rq->rq_disk, blk_rq_pos(rq));
+		part_stat_inc(cpu, part, ios[rw]);
+		part_stat_add(cpu, part, ticks[rw], duration);
+		part_stat_unlock();
+	}
+}
+
+static void __blk_mq_end_io(struct request *rq, int error)
+{
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	blk_mq_account_io_done(rq);
+
+	if (rq->end_io)
+		rq->end_io(rq, error);
+	else
+		blk_mq_free_request(rq);
+}
+
+static void blk_mq_end_io_remote(void *data)
+{
+	struct request *rq = data;
+
+	__blk_mq_end_io(rq, rq->mq_error);
+}
+
+static void __blk_mq_complete_request(struct request *rq, int error)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	int cpu;
+
+	cpu = get_cpu();
+	if (cpu == ctx->cpu || !cpu_online(ctx->cpu) ||
+	    !test_bit(QUEUE_FLAG_SAME_COMP, &rq->q->queue_flags)) {
+		__blk_mq_end_io(rq, error);
+	} else {
+		rq->mq_error = error;
+		rq->csd.func = blk_mq_end_io_remote;
+		rq->csd.info = rq;
+		rq->csd.flags = 0;
+		__smp_call_function_single(ctx->cpu, &rq->csd, 0);
+	}
+	put_cpu();
+}
+
+/**
+ * blk_mq_end_io - end I/O on a request
+ * @rq:		the request being processed
+ * @error:	%0 for success, < %0 for error
+ *
+ * Description:
+ *     Ends all I/O on @rq and releases it.  The completion is carried out
+ *     on the cpu that submitted the request.  May be called from interrupt
+ *     context.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	if (blk_mark_rq_complete(rq))
+		return;
+
+	__blk_mq_complete_request(rq, error);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+static void blk_mq_start_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	unsigned long expiry;
+
+	trace_block_rq_issue(q, rq);
+
+	if (!rq->timeout)
+		rq->timeout = q->rq_timeout;
+	rq->deadline = jiffies + rq->timeout;
+	rq->cmd_flags |= REQ_STARTED;
+
+	/*
+	 * Deadlines only ever move forward, so the timer is normally pending
+	 * already and we get away without touching it.
+	 */
+	expiry = round_jiffies_up(rq->deadline);
+	if (!timer_pending(&q->timeout) ||
+	    time_before(expiry, q->timeout.expires))
+		mod_timer(&q->timeout, expiry);
+}
+
+static void blk_mq_requeue_request(struct request *rq)
+{
+	trace_block_rq_requeue(rq->q, rq);
+	rq->cmd_flags &= ~REQ_STARTED;
+}
+
+struct blk_mq_timeout_data {
+	struct blk_mq_hw_ctx *hctx;
+	unsigned long next;
+	bool next_set;
+};
+
+static void blk_mq_rq_timed_out(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	enum blk_eh_timer_return ret = BLK_EH_RESET_TIMER;
+
+	if (q->mq_ops->timeout)
+		ret = q->mq_ops->timeout(rq);
+
+	switch (ret) {
+	case BLK_EH_HANDLED:
+		__blk_mq_complete_request(rq, rq->errors ? -EIO : 0);
+		break;
+	case BLK_EH_RESET_TIMER:
+		rq->deadline = jiffies + rq->timeout;
+		blk_clear_rq_complete(rq);
+		break;
+	case BLK_EH_NOT_HANDLED:
+		break;
+	default:
+		printk(KERN_ERR "block: bad eh return: %d\n", ret);
+		break;
+	}
+}
+
+static void blk_mq_check_expired(void *data, unsigned int tag)
+{
+	struct blk_mq_timeout_data *d = data;
+	struct request *rq = d->hctx->rqs[tag];
+
+	if (!(rq->cmd_flags & REQ_STARTED))
+		return;
+
+	if (time_after_eq(jiffies, rq->deadline)) {
+		if (blk_mark_rq_complete(rq))
+			return;
+		blk_mq_rq_timed_out(rq);
+		if (!(rq->cmd_flags & REQ_STARTED) ||
+		    test_bit(REQ_ATOM_COMPLETE, &rq->atomic_flags))
+			return;
+	}
+
+	if (!d->next_set || time_after(d->next, rq->deadline)) {
+		d->next = rq->deadline;
+		d->next_set = true;
+	}
+}
+
+static void blk_mq_rq_timer(unsigned long data)
+{
+	struct request_queue *q = (struct request_queue *) data;
+	struct blk_mq_timeout_data d = { .next_set = false };
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		d.hctx = hctx;
+		blk_mq_tag_busy_iter(hctx->tags, blk_mq_check_expired, &d);
+	}
+
+	if (d.next_set)
+		mod_timer(&q->timeout, round_jiffies_up(d.next));
+}
+
+/*
+ * Pull everything staged on the software queues of @hctx, plus whatever
+ * the driver bounced back earlier, and feed it to ->queue_rq().
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int bit, queued = 0;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	hctx->run++;
+
+	/*
+	 * Touch any software queue that has pending entries.
+	 */
+	for_each_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		clear_bit(bit, hctx->ctx_map);
+		ctx = hctx->ctxs[bit];
+
+		spin_lock(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock(&ctx->lock);
+	}
+
+	/*
+	 * If we have previous entries on our dispatch list, grab them
+	 * and stuff them at the front for more fair dispatch.
+	 */
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock(&hctx->lock);
+	}
+
+	/*
+	 * Now process all the entries, sending them to the driver.
+	 */
+	while (!list_empty(&rq_list)) {
+		int ret;
+
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		blk_mq_start_request(rq);
+
+		ret = q->mq_ops->queue_rq(hctx, rq, list_empty(&rq_list));
+		switch (ret) {
+		case BLK_MQ_RQ_QUEUE_OK:
+			queued++;
+			continue;
+		case BLK_MQ_RQ_QUEUE_BUSY:
+			/*
+			 * The driver is out of resources: put the request
+			 * back on hctx->dispatch, to be retried first on the
+			 * next queue run.  Drivers that can not take more
+			 * until a completion stop the queue before returning
+			 * BUSY, and restart it from their completion path.
+			 */
+			list_add(&rq->queuelist, &rq_list);
+			blk_mq_requeue_request(rq);
+			break;
+		default:
+			printk(KERN_ERR "blk-mq: bad return on queue: %d\n",
+			       ret);
+			/* fall through */
+		case BLK_MQ_RQ_QUEUE_ERROR:
+			blk_mq_end_io(rq, -EIO);
+			break;
+		}
+
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY)
+			break;
+	}
+
+	hctx->queued += queued;
+
+	/*
+	 * Any items that need requeuing? Stuff them into hctx->dispatch,
+	 * that is where we will continue on next queue run.
+	 */
+	if (!list_empty(&rq_list)) {
+		spin_lock(&hctx->lock);
+		list_splice(&rq_list, &hctx->dispatch);
+		spin_unlock(&hctx->lock);
+	}
+}
+
+/**
+ * blk_mq_run_hw_queue - dispatch the requests staged for a hardware queue
+ * @hctx:	the hardware queue
+ * @async:	punt the dispatch to kblockd
+ *
+ * Dispatch is always deferred to kblockd from interrupt context.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (!async && !in_interrupt())
+		__blk_mq_run_hw_queue(hctx);
+	else
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!blk_mq_hctx_has_pending(hctx))
+			continue;
+
+		blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+/**
+ * blk_mq_stop_hw_queue - stop dispatching to a hardware queue
+ * @hctx:	the hardware queue
+ *
+ * Typically called by a driver from ->queue_rq() before it returns
+ * BLK_MQ_RQ_QUEUE_BUSY.  Restart with blk_mq_start_stopped_hw_queues()
+ * once resources have been freed.
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+void blk_mq_start_stopped_hw_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+
+		clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+		blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = container_of(work, struct blk_mq_hw_ctx, run_work);
+	__blk_mq_run_hw_queue(hctx);
+}
+
+static void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx,
+				    struct request *rq)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+
+	trace_block_rq_insert(hctx->queue, rq);
+
+	spin_lock(&ctx->lock);
+	list_add_tail(&rq->queuelist, &ctx->rq_list);
+	blk_mq_hctx_mark_pending(hctx, ctx);
+	spin_unlock(&ctx->lock);
+}
+
+void blk_mq_insert_request(struct request *rq, bool run_queue, bool async)
+{
+	struct blk_mq_hw_ctx *hctx = blk_mq_rq_hctx(rq);
+
+	__blk_mq_insert_request(hctx, rq);
+
+	if (run_queue)
+		blk_mq_run_hw_queue(hctx, async);
+}
+EXPORT_SYMBOL(blk_mq_insert_request);
+
+/*
+ * Same checks as elv_rq_merge_ok(), minus the io scheduler we don't have.
+ */
+static bool blk_mq_rq_merge_ok(struct request *rq, struct bio *bio)
+{
+	if (!rq_mergeable(rq))
+		return false;
+
+	if (bio_rw_flagged(bio, BIO_RW_DISCARD) !=
+	    bio_rw_flagged(rq->bio, BIO_RW_DISCARD))
+		return false;
+
+	if (bio_data_dir(bio) != rq_data_dir(rq))
+		return false;
+
+	if (rq->rq_disk != bio->bi_bdev->bd_disk || rq->special)
+		return false;
+
+	if (bio_integrity(bio) != blk_integrity_rq(rq))
+		return false;
+
+	if ((rq->cmd_flags & REQ_FAILFAST_MASK) !=
+	    (bio->bi_rw & REQ_FAILFAST_MASK))
+		return false;
+
+	return true;
+}
+
+static bool blk_mq_attempt_merge(struct request_queue *q,
+				 struct blk_mq_ctx *ctx, struct bio *bio)
+{
+	struct request *rq;
+	int checked = BLK_MQ_MERGE_DEPTH;
+	bool merged = false;
+
+	spin_lock(&ctx->lock);
+	list_for_each_entry_reverse(rq, &ctx->rq_list, queuelist) {
+		if (!checked--)
+			break;
+
+		if (!blk_mq_rq_merge_ok(rq, bio))
+			continue;
+
+		if (blk_rq_pos(rq) + blk_rq_sectors(rq) == bio->bi_sector) {
+			if (!ll_back_merge_fn(q, rq, bio))
+				break;
+
+			trace_block_bio_backmerge(q, bio);
+			rq->biotail->bi_next = bio;
+			rq->biotail = bio;
+			rq->__data_len += bio->bi_size;
+			rq->ioprio = ioprio_best(rq->ioprio, bio_prio(bio));
+			merged = true;
+			break;
+		} else if (blk_rq_pos(rq) - bio_sectors(bio) ==
+			   bio->bi_sector) {
+			if (!ll_front_merge_fn(q, rq, bio))
+				break;
+
+			trace_block_bio_frontmerge(q, bio);
+			bio->bi_next = rq->bio;
+			rq->bio = bio;
+			rq->buffer = bio_data(bio);
+			rq->__sector = bio->bi_sector;
+			rq->__data_len += bio->bi_size;
+			rq->ioprio = ioprio_best(rq->ioprio, bio_prio(bio));
+			merged = true;
+			break;
+		}
+	}
+	spin_unlock(&ctx->lock);
+
+	return merged;
+}
+
+struct blk_mq_sync {
+	struct completion	done;
+	int			error;
+};
+
+static void blk_mq_end_sync_rq(struct request *rq, int error)
+{
+	struct blk_mq_sync *sync = rq->end_io_data;
+
+	sync->error = error;
+	complete(&sync->done);
+}
+
+static int blk_mq_execute_sync(struct request *rq)
+{
+	struct blk_mq_sync sync;
+
+	init_completion(&sync.done);
+	rq->end_io = blk_mq_end_sync_rq;
+	rq->end_io_data = &sync;
+
+	blk_mq_insert_request(rq, true, false);
+	wait_for_completion(&sync.done);
+
+	blk_mq_free_request(rq);
+	return sync.error;
+}
+
+/*
+ * The queue is frozen while a barrier runs, requests for it bypass the
+ * usage check in blk_mq_queue_enter().
+ */
+static struct request *blk_mq_alloc_ordered_request(struct request_queue *q,
+						    unsigned int rw_flags)
+{
+	__percpu_counter_add(&q->mq_usage_counter, 1, BLK_MQ_USAGE_BATCH);
+	return __blk_mq_alloc_request(q, rw_flags, GFP_NOIO, false);
+}
+
+static int blk_mq_flush(struct request_queue *q, struct gendisk *disk)
+{
+	struct request *rq;
+
+	rq = blk_mq_alloc_ordered_request(q, WRITE | REQ_RW_SYNC);
+	rq->cmd_flags |= REQ_HARDBARRIER;
+	rq->rq_disk = disk;
+	q->prepare_flush_fn(q, rq);
+
+	return blk_mq_execute_sync(rq);
+}
+
+static void blk_mq_ordered_end_io(struct bio *bio, int error)
+{
+	/* reported through the request, see blk_mq_ordered_bio() */
+}
+
+/*
+ * There is no ordering between hardware queues, so a barrier drains the
+ * whole queue and then runs the preflush / barrier write / postflush
+ * sequence the driver asked for with blk_queue_ordered(), one request at
+ * a time.  The bio is completed once the whole sequence is done.
+ */
+static int blk_mq_ordered_bio(struct request_queue *q, struct bio *bio)
+{
+	struct gendisk *disk = bio->bi_bdev->bd_disk;
+	unsigned ordered;
+	int err = 0;
+
+	mutex_lock(&q->mq_ordered_lock);
+	blk_mq_freeze_queue(q);
+
+	ordered = q->ordered = q->next_ordered;
+
+	if (ordered & QUEUE_ORDERED_DO_PREFLUSH)
+		err = blk_mq_flush(q, disk);
+
+	if (!err && bio_has_data(bio)) {
+		bio_end_io_t *end_io = bio->bi_end_io;
+		void *private = bio->bi_private;
+		struct request *rq;
+
+		rq = blk_mq_alloc_ordered_request(q,
+					bio_data_dir(bio) | REQ_RW_SYNC);
+		init_request_from_bio(rq, bio);
+		if (!(ordered & QUEUE_ORDERED_DO_BAR))
+			rq->cmd_flags &= ~REQ_HARDBARRIER;
+		if (ordered & QUEUE_ORDERED_DO_FUA)
+			rq->cmd_flags |= REQ_FUA;
+
+		bio->bi_end_io = blk_mq_ordered_end_io;
+		err = blk_mq_execute_sync(rq);
+		bio->bi_end_io = end_io;
+		bio->bi_private = private;
+	}
+
+	if (!err && (ordered & QUEUE_ORDERED_DO_POSTFLUSH))
+		err = blk_mq_flush(q, disk);
+
+	blk_mq_unfreeze_queue(q);
+	mutex_unlock(&q->mq_ordered_lock);
+
+	bio_endio(bio, err);
+	return 0;
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	const bool sync = bio_rw_flagged(bio, BIO_RW_SYNCIO);
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	unsigned int rw_flags;
+
+	if (unlikely(bio_rw_flagged(bio, BIO_RW_BARRIER))) {
+		if (q->next_ordered == QUEUE_ORDERED_NONE) {
+			bio_endio(bio, -EOPNOTSUPP);
+			return 0;
+		}
+		blk_queue_bounce(q, &bio);
+		return blk_mq_ordered_bio(q, bio);
+	}
+
+	blk_queue_bounce(q, &bio);
+
+	blk_mq_queue_enter(q, GFP_NOIO);
+
+	ctx = blk_mq_get_ctx(q);
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	if ((hctx->flags & BLK_MQ_F_SHOULD_MERGE) &&
+	    !blk_queue_nomerges(q) && blk_mq_attempt_merge(q, ctx, bio)) {
+		blk_mq_queue_exit(q);
+		return 0;
+	}
+
+	rw_flags = bio_data_dir(bio);
+	if (sync)
+		rw_flags |= REQ_RW_SYNC;
+
+	trace_block_getrq(q, bio, bio_data_dir(bio));
+	rq = __blk_mq_alloc_request(q, rw_flags, GFP_NOIO, false);
+	init_request_from_bio(rq, bio);
+
+	/*
+	 * Sync I/O is dispatched right away, async I/O is left to kblockd
+	 * so that it gets a chance to be merged and batched.
+	 */
+	blk_mq_insert_request(rq, true, !sync);
+	return 0;
+}
+
+static unsigned int *blk_mq_make_queue_map(struct blk_mq_reg *reg)
+{
+	unsigned int *map, cpu, i = 0, nr_cpus = num_possible_cpus();
+
+	map = kzalloc_node(sizeof(*map) * nr_cpu_ids, GFP_KERNEL,
+			   reg->numa_node);
+	if (!map)
+		return NULL;
+
+	/* spread the cpus evenly, neighbouring ids share a queue */
+	for_each_possible_cpu(cpu)
+		map[cpu] = (i++ * reg->nr_hw_queues) / nr_cpus;
+
+	return map;
+}
+
+static void blk_mq_free_rq_map(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int i;
+
+	if (hctx->tags)
+		blk_mq_free_tags(hctx->tags);
+
+	if (hctx->rqs) {
+		for (i = 0; i < hctx->queue_depth; i++)
+			kfree(hctx->rqs[i]);
+		kfree(hctx->rqs);
+	}
+}
+
+static int blk_mq_init_rq_map(struct blk_mq_hw_ctx *hctx,
+			      struct blk_mq_reg *reg, void *driver_data)
+{
+	size_t rq_size = ALIGN(sizeof(struct request) + reg->cmd_size,
+			       cache_line_size());
+	unsigned int i;
+
+	hctx->rqs = kzalloc_node(hctx->queue_depth * sizeof(struct request *),
+				 GFP_KERNEL, hctx->numa_node);
+	if (!hctx->rqs)
+		return -ENOMEM;
+
+	for (i = 0; i < hctx->queue_depth; i++) {
+		struct request *rq;
+
+		rq = kzalloc_node(rq_size, GFP_KERNEL, hctx->numa_node);
+		if (!rq)
+			return -ENOMEM;
+		hctx->rqs[i] = rq;
+
+		if (reg->ops->init_request &&
+		    reg->ops->init_request(driver_data, hctx, rq, i))
+			return -ENOMEM;
+	}
+
+	hctx->tags = blk_mq_init_tags(hctx->queue_depth, reg->reserved_tags,
+				      hctx->numa_node);
+	if (!hctx->tags)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int blk_mq_init_hw_queues(struct request_queue *q,
+				 struct blk_mq_reg *reg, void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		int node = hctx->numa_node;
+
+		spin_lock_init(&hctx->lock);
+		INIT_LIST_HEAD(&hctx->dispatch);
+		INIT_WORK(&hctx->run_work, blk_mq_run_work_fn);
+		hctx->queue = q;
+		hctx->queue_num = i;
+		hctx->flags = reg->flags;
+		hctx->queue_depth = reg->queue_depth;
+
+		hctx->ctxs = kzalloc_node(nr_cpu_ids * sizeof(void *),
+					  GFP_KERNEL, node);
+		if (!hctx->ctxs)
+			goto fail;
+
+		hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) *
+					     sizeof(unsigned long),
+					     GFP_KERNEL, node);
+		if (!hctx->ctx_map)
+			goto fail;
+
+		if (blk_mq_init_rq_map(hctx, reg, driver_data))
+			goto fail;
+
+		if (reg->ops->init_hctx &&
+		    reg->ops->init_hctx(hctx, driver_data, i))
+			goto fail;
+	}
+
+	return 0;
+
+fail:
+	/*
+	 * Init failed, undo the hardware queues set up so far.  The memory
+	 * itself is released by blk_mq_free_queue() with the queue.
+	 */
+	while (i--) {
+		hctx = q->queue_hw_ctx[i];
+		if (reg->ops->exit_hctx)
+			reg->ops->exit_hctx(hctx, i);
+	}
+	return -ENOMEM;
+}
+
+static void blk_mq_map_swqueue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	unsigned int i;
+
+	for_each_possible_cpu(i) {
+		ctx = __blk_mq_get_ctx(q, i);
+
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = i;
+		ctx->queue = q;
+
+		hctx = q->mq_ops->map_queue(q, i);
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+}
+
+/**
+ * blk_mq_init_queue - allocate a multiqueue request queue
+ * @reg:	hardware queue layout and driver callbacks
+ * @driver_data: passed to the ->init_hctx() and ->init_request() hooks
+ *
+ * Description:
+ *    Sets up @reg->nr_hw_queues hardware queues of @reg->queue_depth
+ *    preallocated requests each, every request followed by
+ *    @reg->cmd_size bytes for the driver.  Must be paired with
+ *    blk_cleanup_queue() like blk_init_queue().
+ *
+ *    Returns the queue, or %NULL on failure.
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct request_queue *q;
+	unsigned int i;
+
+	if (!reg->nr_hw_queues || !reg->ops->queue_rq ||
+	    !reg->ops->map_queue || !reg->queue_depth ||
+	    reg->queue_depth > BLK_MQ_MAX_DEPTH ||
+	    reg->reserved_tags >= reg->queue_depth)
+		return NULL;
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return NULL;
+
+	INIT_LIST_HEAD(&q->all_q_node);
+	init_waitqueue_head(&q->mq_freeze_wq);
+	mutex_init(&q->mq_ordered_lock);
+	setup_timer(&q->timeout, blk_mq_rq_timer, (unsigned long) q);
+
+	q->mq_ops = reg->ops;
+	q->nr_queues = nr_cpu_ids;
+	q->nr_hw_queues = reg->nr_hw_queues;
+	q->queue_flags |= QUEUE_FLAG_MQ_DEFAULT;
+
+	if (percpu_counter_init(&q->mq_usage_counter, 0))
+		goto err_queue;
+
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->mq_map = blk_mq_make_queue_map(reg);
+	q->queue_hw_ctx = kzalloc_node(reg->nr_hw_queues * sizeof(void *),
+				       GFP_KERNEL, reg->numa_node);
+	if (!q->queue_ctx || !q->mq_map || !q->queue_hw_ctx)
+		goto err_queue;
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		q->queue_hw_ctx[i] = kzalloc_node(sizeof(struct blk_mq_hw_ctx),
+						  GFP_KERNEL, reg->numa_node);
+		if (!q->queue_hw_ctx[i])
+			goto err_queue;
+		q->queue_hw_ctx[i]->numa_node = reg->numa_node;
+	}
+
+	blk_queue_make_request(q, blk_mq_make_request);
+	blk_queue_rq_timeout(q, reg->timeout ? reg->timeout : 30 * HZ);
+
+	if (blk_mq_init_hw_queues(q, reg, driver_data))
+		goto err_queue;
+
+	blk_mq_map_swqueue(q);
+
+	mutex_lock(&all_q_mutex);
+	list_add_tail(&q->all_q_node, &all_q_list);
+	mutex_unlock(&all_q_mutex);
+
+	return q;
+
+err_queue:
+	blk_put_queue(q);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called from blk_cleanup_queue(), while the driver is still around.
+ */
+void blk_mq_exit_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	mutex_lock(&all_q_mutex);
+	list_del_init(&q->all_q_node);
+	mutex_unlock(&all_q_mutex);
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		cancel_work_sync(&hctx->run_work);
+		if (q->mq_ops->exit_hctx)
+			q->mq_ops->exit_hctx(hctx, i);
+	}
+}
+
+/*
+ * Called from blk_release_queue(), when the last reference is gone.
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	unsigned int i;
+
+	if (q->queue_hw_ctx) {
+		for (i = 0; i < q->nr_hw_queues; i++) {
+			struct blk_mq_hw_ctx *hctx = q->queue_hw_ctx[i];
+
+			if (!hctx)
+				continue;
+			blk_mq_free_rq_map(hctx);
+			kfree(hctx->ctxs);
+			kfree(hctx->ctx_map);
+			kfree(hctx);
+		}
+		kfree(q->queue_hw_ctx);
+	}
+
+	if (q->queue_ctx)
+		free_percpu(q->queue_ctx);
+	kfree(q->mq_map);
+	percpu_counter_destroy(&q->mq_usage_counter);
+}
+
+/*
+ * Requests staged by a cpu that went away stay on its software queue,
+ * they still own their tag there.  Just make sure they get dispatched.
+ */
+static int __cpuinit blk_mq_cpu_notify(struct notifier_block *self,
+				       unsigned long action, void *hcpu)
+{
+	unsigned int cpu = (unsigned long) hcpu;
+	struct request_queue *q;
+
+	if (action != CPU_DEAD && action != CPU_DEAD_FROZEN)
+		return NOTIFY_OK;
+
+	mutex_lock(&all_q_mutex);
+	list_for_each_entry(q, &all_q_list, all_q_node) {
+		struct blk_mq_ctx *ctx = __blk_mq_get_ctx(q, cpu);
+
+		if (!list_empty_careful(&ctx->rq_list))
+			blk_mq_run_hw_queue(q->mq_ops->map_queue(q, cpu),
+					    true);
+	}
+	mutex_unlock(&all_q_mutex);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block __cpuinitdata blk_mq_cpu_notifier = {
+	.notifier_call	= blk_mq_cpu_notify,
+};
+
+static int __init blk_mq_init(void)
+{
+	register_hotcpu_notifier(&blk_mq_cpu_notifier);
+	return 0;
+}
+subsys_initcall(blk_mq_init);
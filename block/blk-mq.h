@@ -0,0 +1,22 @@
+#ifndef INT_BLK_MQ_H
+#define INT_BLK_MQ_H
+
+/*
+ * Per-cpu software staging queue
+ */
+struct blk_mq_ctx {
+	struct {
+		spinlock_t		lock;
+		struct list_head	rq_list;
+	}  ____cacheline_aligned_in_smp;
+
+	unsigned int		cpu;
+	unsigned int		index_hw;	/* bit in hctx->ctx_map */
+
+	struct request_queue	*queue;
+} ____cacheline_aligned_in_smp;
+
+void blk_mq_exit_queue(struct request_queue *q);
+void blk_mq_free_queue(struct request_queue *q);
+
+#endif
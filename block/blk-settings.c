@@ -97,6 +97,25 @@ void blk_queue_lld_busy(struct request_queue *q, lld_busy_fn *fn)
 }
 EXPORT_SYMBOL_GPL(blk_queue_lld_busy);
 
+/**
+ * blk_queue_poll - set the completion polling function for a queue
+ * @q:  queue
+ * @fn: function reaping completed requests from the driver
+ *
+ * Description:
+ *    @fn is called by tasks spinning in blk_poll() while they wait for
+ *    synchronous I/O, so it runs in process context, possibly on several
+ *    CPUs at once and concurrently with the driver's interrupt handler.
+ *    It completes whatever requests the hardware has finished and returns
+ *    how many it found.  Polling stays off until enabled through the
+ *    queue's io_poll_usecs sysfs attribute.
+ **/
+void blk_queue_poll(struct request_queue *q, poll_queue_fn *fn)
+{
+	q->poll_fn = fn;
+}
+EXPORT_SYMBOL_GPL(blk_queue_poll);
+
 /**
  * blk_set_default_limits - reset limits to default values
  * @lim:  the queue_limits structure to reset
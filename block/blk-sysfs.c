@@ -8,6 +8,8 @@
 #include <linux/blktrace_api.h>
 
 #include "blk.h"
+#include "blk-mq.h"
+#include "blk-wbt.h"
 
 struct queue_sysfs_entry {
 	struct attribute attr;
@@ -239,6 +241,53 @@ static ssize_t queue_iostats_store(struct request_queue *q, const char *page,
 	return ret;
 }
 
+static ssize_t queue_poll_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(q->poll_usecs, page);
+}
+
+static ssize_t queue_poll_store(struct request_queue *q, const char *page,
+				size_t count)
+{
+	unsigned long usecs;
+	ssize_t ret = queue_var_store(&usecs, page, count);
+
+	if (usecs && !q->poll_fn)
+		return -EINVAL;
+	if (usecs > USEC_PER_MSEC)
+		return -EINVAL;
+
+	q->poll_usecs = usecs;
+	q->poll_nsecs = 0;
+	return ret;
+}
+
+#ifdef CONFIG_BLK_WBT
+static ssize_t queue_wbt_lat_show(struct request_queue *q, char *page)
+{
+	if (!q->rq_wb)
+		return -EINVAL;
+	return queue_var_show(blk_wbt_lat_usec(q), page);
+}
+
+static ssize_t queue_wbt_lat_store(struct request_queue *q, const char *page,
+				   size_t count)
+{
+	unsigned long usecs;
+	ssize_t ret;
+	int err;
+
+	if (!q->rq_wb)
+		return -EINVAL;
+
+	ret = queue_var_store(&usecs, page, count);
+	err = blk_wbt_set_lat_usec(q, usecs);
+	if (err)
+		return err;
+	return ret;
+}
+#endif
+
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_requests_show,
@@ -317,6 +366,20 @@ static struct queue_sysfs_entry queue_iostats_entry = {
 	.store = queue_iostats_store,
 };
 
+static struct queue_sysfs_entry queue_poll_entry = {
+	.attr = {.name = "io_poll_usecs", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_poll_show,
+	.store = queue_poll_store,
+};
+
+#ifdef CONFIG_BLK_WBT
+static struct queue_sysfs_entry queue_wbt_lat_entry = {
+	.attr = {.name = "wbt_lat_usec", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_wbt_lat_show,
+	.store = queue_wbt_lat_store,
+};
+#endif
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
@@ -332,6 +395,10 @@ static struct attribute *default_attrs[] = {
 	&queue_nomerges_entry.attr,
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
+	&queue_poll_entry.attr,
+#ifdef CONFIG_BLK_WBT
+	&queue_wbt_lat_entry.attr,
+#endif
 	NULL,
 };
 
@@ -408,7 +475,11 @@ static void blk_release_queue(struct kobject *kobj)
 	if (q->queue_tags)
 		__blk_queue_free_tags(q);
 
+	if (q->mq_ops)
+		blk_mq_free_queue(q);
+
 	blk_trace_shutdown(q);
+	blk_wbt_exit(q);
 
 	bdi_destroy(&q->backing_dev_info);
 	kmem_cache_free(blk_requestq_cachep, q);
@@ -456,6 +527,9 @@ int blk_register_queue(struct gendisk *disk)
 		return ret;
 	}
 
+	/* the queue works fine without it, so failing is not fatal */
+	blk_wbt_init(q);
+
 	return 0;
 }
 
@@ -0,0 +1,305 @@
+/*
+ * Functions related to writeback throttling.  Buffered writeback is
+ * only allowed a limited number of requests in flight on a queue.  The
+ * limit is adjusted every window, by looking at how long the reads
+ * completed in that window spent in the device: if even the fastest
+ * one took longer than the target latency, writeback is throttled
+ * further, otherwise the limit is relaxed again.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+#include "blk.h"
+#include "blk-wbt.h"
+
+/* writeback requests in flight at scale step 0 */
+#define RWB_DEF_DEPTH		16
+
+/* length of a sampling window at scale step 0 */
+#define RWB_WINDOW_NSEC		(100 * NSEC_PER_MSEC)
+
+/* windows without any completions before returning to the default */
+#define RWB_IDLE_WINDOWS	5
+
+/* default target read latencies */
+#define RWB_ROT_LAT_NSEC	(75 * NSEC_PER_MSEC)
+#define RWB_NONROT_LAT_NSEC	(2 * NSEC_PER_MSEC)
+
+/*
+ * All fields are protected by the queue lock.
+ */
+struct rq_wb {
+	u64 min_lat_nsec;		/* target read latency, 0 disables */
+	int scale_step;			/* > 0 throttled, < 0 relaxed */
+	unsigned int limit;		/* writeback requests allowed */
+	unsigned int inflight;		/* writeback requests in flight */
+
+	u64 win_nsec;			/* current window length */
+	u64 win_start;
+	u64 read_min;			/* fastest read in this window */
+	unsigned int nr_reads;		/* reads completed in this window */
+	unsigned int nr_writes;		/* writes completed in this window */
+
+	wait_queue_head_t wait;
+};
+
+static inline u64 wbt_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+/*
+ * Only buffered writeback is throttled.  Sync and O_DIRECT writes have
+ * someone waiting for them, and barriers must never be held back.
+ */
+static inline bool wbt_should_throttle(struct bio *bio)
+{
+	return bio_data_dir(bio) == WRITE &&
+		!bio_rw_flagged(bio, BIO_RW_SYNCIO) &&
+		!bio_rw_flagged(bio, BIO_RW_META) &&
+		!bio_rw_flagged(bio, BIO_RW_BARRIER) &&
+		!bio_rw_flagged(bio, BIO_RW_DISCARD);
+}
+
+static void wbt_calc_limit(struct request_queue *q, struct rq_wb *rwb)
+{
+	unsigned int depth = min_t(unsigned long, RWB_DEF_DEPTH,
+				   q->nr_requests);
+
+	if (rwb->scale_step > 0)
+		depth = 1 + ((depth - 1) >> min(rwb->scale_step, 31));
+	else if (rwb->scale_step < 0)
+		depth = min_t(unsigned long, depth << min(-rwb->scale_step, 16),
+			      q->nr_requests);
+	rwb->limit = depth;
+
+	/*
+	 * Look more often while throttled, so that a latency problem
+	 * going away is noticed quickly.
+	 */
+	rwb->win_nsec = RWB_WINDOW_NSEC;
+	if (rwb->scale_step > 0)
+		rwb->win_nsec = div_u64(RWB_WINDOW_NSEC,
+					int_sqrt(rwb->scale_step + 1));
+}
+
+static void wbt_window_reset(struct rq_wb *rwb, u64 now)
+{
+	rwb->win_start = now;
+	rwb->read_min = ~0ULL;
+	rwb->nr_reads = 0;
+	rwb->nr_writes = 0;
+}
+
+static void wbt_scale_up(struct request_queue *q, struct rq_wb *rwb)
+{
+	if (rwb->limit >= q->nr_requests)
+		return;
+
+	rwb->scale_step--;
+	wbt_calc_limit(q, rwb);
+	wake_up_all(&rwb->wait);
+}
+
+static void wbt_scale_down(struct request_queue *q, struct rq_wb *rwb)
+{
+	if (rwb->limit == 1)
+		return;
+
+	/* reads are suffering, drop straight back from a relaxed limit */
+	if (rwb->scale_step < 0)
+		rwb->scale_step = 0;
+	else
+		rwb->scale_step++;
+	wbt_calc_limit(q, rwb);
+}
+
+static void wbt_window_end(struct request_queue *q, struct rq_wb *rwb,
+			   u64 now)
+{
+	if (rwb->nr_reads) {
+		if (rwb->read_min > rwb->min_lat_nsec)
+			wbt_scale_down(q, rwb);
+		else
+			wbt_scale_up(q, rwb);
+	} else if (rwb->nr_writes) {
+		/* nobody is reading, let writeback have the device */
+		wbt_scale_up(q, rwb);
+	} else if (now - rwb->win_start >= RWB_IDLE_WINDOWS * rwb->win_nsec) {
+		/* the device went idle, start over from the default */
+		rwb->scale_step = 0;
+		wbt_calc_limit(q, rwb);
+		wake_up_all(&rwb->wait);
+	}
+
+	wbt_window_reset(rwb, now);
+}
+
+/**
+ * blk_wbt_wait - throttle a bio against the writeback limit
+ * @q:		the queue the bio is being queued on
+ * @bio:	the bio about to be given a request
+ *
+ * Description:
+ *     Waits until the queue has room for another writeback request if
+ *     @bio is buffered writeback, and accounts it as in flight.  Returns
+ *     true if the request allocated for @bio must be marked with
+ *     REQ_WB_TRACKED, so that blk_wbt_release() is called when it is
+ *     freed.
+ *
+ *     Called with the queue lock held; it may be dropped while waiting.
+ */
+bool blk_wbt_wait(struct request_queue *q, struct bio *bio)
+{
+	struct rq_wb *rwb = q->rq_wb;
+
+	if (!rwb || !rwb->min_lat_nsec || !wbt_should_throttle(bio))
+		return false;
+
+	while (rwb->min_lat_nsec && rwb->inflight >= rwb->limit) {
+		DEFINE_WAIT(wait);
+
+		prepare_to_wait_exclusive(&rwb->wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+		__generic_unplug_device(q);
+		spin_unlock_irq(q->queue_lock);
+		io_schedule();
+		spin_lock_irq(q->queue_lock);
+		finish_wait(&rwb->wait, &wait);
+	}
+
+	rwb->inflight++;
+	return true;
+}
+
+/*
+ * The request is handed to the driver for the first time (again, if it
+ * was requeued).  Latency is measured from here, so that it includes the
+ * time spent queued behind writes in the device but not in the io
+ * scheduler.  Queue lock must be held.
+ */
+void blk_wbt_issue(struct request *rq)
+{
+	if (rq->q->rq_wb && blk_fs_request(rq) && rq_data_dir(rq) == READ)
+		rq->wbt_issue_ns = wbt_now();
+}
+
+/*
+ * A request has completed: sample read latency and end the window if
+ * it is over.  Queue lock must be held.
+ */
+void blk_wbt_done(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct rq_wb *rwb = q->rq_wb;
+	u64 now;
+
+	if (!rwb || !rwb->min_lat_nsec)
+		return;
+
+	now = wbt_now();
+	if (now - rwb->win_start >= rwb->win_nsec)
+		wbt_window_end(q, rwb, now);
+
+	if (blk_fs_request(rq) && rq_data_dir(rq) == READ &&
+	    blk_rq_started(rq)) {
+		u64 lat = now - rq->wbt_issue_ns;
+
+		if (lat < rwb->read_min)
+			rwb->read_min = lat;
+		rwb->nr_reads++;
+	}
+}
+
+/*
+ * A request marked REQ_WB_TRACKED is freed.  Queue lock must be held.
+ */
+void blk_wbt_release(struct request_queue *q, struct request *rq)
+{
+	struct rq_wb *rwb = q->rq_wb;
+
+	rwb->inflight--;
+	rwb->nr_writes++;
+
+	if (rwb->inflight < rwb->limit && waitqueue_active(&rwb->wait))
+		wake_up(&rwb->wait);
+}
+
+unsigned long blk_wbt_lat_usec(struct request_queue *q)
+{
+	if (!q->rq_wb)
+		return 0;
+	return div_u64(q->rq_wb->min_lat_nsec, NSEC_PER_USEC);
+}
+
+/**
+ * blk_wbt_set_lat_usec - set the target read latency of a queue
+ * @q:		the queue
+ * @usecs:	target latency in microseconds, 0 disables throttling
+ */
+int blk_wbt_set_lat_usec(struct request_queue *q, unsigned long usecs)
+{
+	struct rq_wb *rwb = q->rq_wb;
+
+	if (!rwb)
+		return -EINVAL;
+
+	spin_lock_irq(q->queue_lock);
+	rwb->min_lat_nsec = (u64)usecs * NSEC_PER_USEC;
+	rwb->scale_step = 0;
+	wbt_calc_limit(q, rwb);
+	wbt_window_reset(rwb, wbt_now());
+	wake_up_all(&rwb->wait);
+	spin_unlock_irq(q->queue_lock);
+
+	return 0;
+}
+
+/**
+ * blk_wbt_init - enable writeback throttling on a queue
+ * @q:		the queue
+ *
+ * Description:
+ *     Called when the queue is registered.  Throttling starts out
+ *     enabled, with a target read latency that depends on whether
+ *     the device is rotational.  Only request_fn queues are throttled:
+ *     bio based and blk-mq queues never go through __make_request(),
+ *     so they are left without rq_wb and wbt_lat_usec rejects access.
+ */
+int blk_wbt_init(struct request_queue *q)
+{
+	struct rq_wb *rwb;
+
+	if (!q->request_fn || q->mq_ops)
+		return -EINVAL;
+	if (q->rq_wb)
+		return 0;
+
+	rwb = kzalloc_node(sizeof(*rwb), GFP_KERNEL, q->node);
+	if (!rwb)
+		return -ENOMEM;
+
+	init_waitqueue_head(&rwb->wait);
+	rwb->min_lat_nsec = blk_queue_nonrot(q) ? RWB_NONROT_LAT_NSEC :
+						  RWB_ROT_LAT_NSEC;
+	wbt_calc_limit(q, rwb);
+	wbt_window_reset(rwb, wbt_now());
+
+	spin_lock_irq(q->queue_lock);
+	q->rq_wb = rwb;
+	spin_unlock_irq(q->queue_lock);
+	return 0;
+}
+
+void blk_wbt_exit(struct request_queue *q)
+{
+	kfree(q->rq_wb);
+	q->rq_wb = NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef INT_BLK_WBT_H
+#define INT_BLK_WBT_H
+
+#ifdef CONFIG_BLK_WBT
+
+int blk_wbt_init(struct request_queue *q);
+void blk_wbt_exit(struct request_queue *q);
+bool blk_wbt_wait(struct request_queue *q, struct bio *bio);
+void blk_wbt_issue(struct request *rq);
+void blk_wbt_done(struct request *rq);
+void blk_wbt_release(struct request_queue *q, struct request *rq);
+unsigned long blk_wbt_lat_usec(struct request_queue *q);
+int blk_wbt_set_lat_usec(struct request_queue *q, unsigned long usecs);
+
+#else
+
+static inline int blk_wbt_init(struct request_queue *q)
+{
+	return 0;
+}
+static inline void blk_wbt_exit(struct request_queue *q)
+{
+}
+static inline bool blk_wbt_wait(struct request_queue *q, struct bio *bio)
+{
+	return false;
+}
+static inline void blk_wbt_issue(struct request *rq)
+{
+}
+static inline void blk_wbt_done(struct request *rq)
+{
+}
+static inline void blk_wbt_release(struct request_queue *q,
+				   struct request *rq)
+{
+}
+
+#endif /* CONFIG_BLK_WBT */
+
+#endif
@@ -74,6 +74,8 @@
 #include <linux/gfp.h>
 #include <linux/kthread.h>
 #include <linux/splice.h>
+#include <linux/vmalloc.h>
+#include <linux/mempool.h>
 
 #include <asm/uaccess.h>
 
@@ -83,6 +85,32 @@ static DEFINE_MUTEX(loop_devices_mutex);
 static int max_part;
 static int part_shift;
 
+/*
+ * Direct I/O mode.  The blocks backing the file are resolved once with
+ * bmap() when the mode is switched on, and the file is pinned like an
+ * active swapfile so that its layout cannot change underneath us.  Files
+ * with holes or unwritten extents in the device's range are refused.  Bios
+ * are then remapped onto the filesystem's block device and submitted
+ * straight from make_request: no loop thread, no copy through the
+ * backing file's page cache, and as many bios in flight as the caller
+ * issues.
+ */
+struct loop_extent {
+	sector_t	file_sect;	/* first sector, relative to the file */
+	sector_t	nr_sects;
+	sector_t	disk_sect;	/* first sector on lo_backing_bdev */
+};
+
+struct loop_dio {
+	struct loop_device	*lo;
+	struct bio		*bio;		/* the bio issued to the loop device */
+	atomic_t		remaining;
+	int			error;
+};
+
+#define LOOP_DIO_POOL_SIZE	16
+static mempool_t *loop_dio_pool;
+
 /*
  * Transfer functions
  */
@@ -507,6 +535,139 @@ out:
 	return ret;
 }
 
+static struct loop_extent *loop_find_extent(struct loop_device *lo,
+					     sector_t sect)
+{
+	unsigned int low = 0, high = lo->lo_nr_extents;
+
+	while (low < high) {
+		unsigned int mid = low + (high - low) / 2;
+		struct loop_extent *ext = &lo->lo_extents[mid];
+
+		if (sect < ext->file_sect)
+			high = mid;
+		else if (sect >= ext->file_sect + ext->nr_sects)
+			low = mid + 1;
+		else
+			return ext;
+	}
+	return NULL;
+}
+
+static void loop_dio_put(struct loop_dio *dio)
+{
+	struct loop_device *lo = dio->lo;
+
+	if (!atomic_dec_and_test(&dio->remaining))
+		return;
+
+	bio_endio(dio->bio, dio->error);
+	mempool_free(dio, loop_dio_pool);
+
+	if (atomic_dec_and_test(&lo->lo_pending))
+		wake_up(&lo->lo_pending_wait);
+}
+
+static void loop_dio_end_io(struct bio *bio, int error)
+{
+	struct loop_dio *dio = bio->bi_private;
+
+	if (!error && !test_bit(BIO_UPTODATE, &bio->bi_flags))
+		error = -EIO;
+	if (error)
+		dio->error = error;
+
+	bio_put(bio);
+	loop_dio_put(dio);
+}
+
+static void loop_dio_submit(struct loop_dio *dio, struct bio *bio)
+{
+	bio->bi_bdev = dio->lo->lo_backing_bdev;
+	bio->bi_end_io = loop_dio_end_io;
+	bio->bi_private = dio;
+	atomic_inc(&dio->remaining);
+	generic_make_request(bio);
+}
+
+/*
+ * Remap @bio onto the backing file's blocks.  The pages are added to new
+ * bios with bio_add_page() against the backing device, so that they obey
+ * its queue limits and merge_bvec_fn (md, dm): a bio is split wherever
+ * the device or an extent boundary requires it.  Only bios without data
+ * are simply cloned.  The caller has accounted the bio in lo_pending.
+ */
+static void loop_direct_bio(struct loop_device *lo, struct bio *bio)
+{
+	sector_t sect = bio->bi_sector + (lo->lo_offset >> 9);
+	struct loop_extent *ext;
+	struct loop_dio *dio;
+	struct bio *clone = NULL;
+	struct bio_vec *bvec;
+	int i;
+
+	dio = mempool_alloc(loop_dio_pool, GFP_NOIO);
+	dio->lo = lo;
+	dio->bio = bio;
+	dio->error = 0;
+	atomic_set(&dio->remaining, 1);
+
+	if (!bio_sectors(bio)) {
+		ext = loop_find_extent(lo, sect);
+		clone = bio_clone(bio, GFP_NOIO);
+		if (ext)
+			clone->bi_sector = ext->disk_sect + (sect - ext->file_sect);
+		loop_dio_submit(dio, clone);
+		goto out;
+	}
+
+	bio_for_each_segment(bvec, bio, i) {
+		unsigned int off = bvec->bv_offset;
+		unsigned int len = bvec->bv_len;
+
+		while (len) {
+			unsigned int chunk;
+			sector_t disk;
+
+			ext = loop_find_extent(lo, sect);
+			if (!ext) {
+				dio->error = -EIO;
+				goto submit;
+			}
+			chunk = min_t(sector_t, len >> 9,
+				      ext->file_sect + ext->nr_sects - sect) << 9;
+			disk = ext->disk_sect + (sect - ext->file_sect);
+
+			if (clone &&
+			    clone->bi_sector + bio_sectors(clone) == disk &&
+			    bio_add_page(clone, bvec->bv_page, chunk, off) == chunk)
+				goto next;
+
+			if (clone)
+				loop_dio_submit(dio, clone);
+			clone = bio_alloc(GFP_NOIO, bio->bi_vcnt - i);
+			clone->bi_rw = bio->bi_rw;
+			clone->bi_bdev = lo->lo_backing_bdev;
+			clone->bi_sector = disk;
+			if (bio_add_page(clone, bvec->bv_page, chunk, off) != chunk) {
+				bio_put(clone);
+				clone = NULL;
+				dio->error = -EIO;
+				goto submit;
+			}
+next:
+			sect += chunk >> 9;
+			off += chunk;
+			len -= chunk;
+		}
+	}
+submit:
+	if (clone)
+		loop_dio_submit(dio, clone);
+out:
+	loop_dio_put(dio);
+}
+
 /*
  * Add bio to back of pending list
  */
@@ -538,6 +699,12 @@ static int loop_make_request(struct request_queue *q, struct bio *old_bio)
 		goto out;
 	if (unlikely(rw == WRITE && (lo->lo_flags & LO_FLAGS_READ_ONLY)))
 		goto out;
+	if ((lo->lo_flags & LO_FLAGS_DIRECT_IO) && old_bio->bi_bdev) {
+		atomic_inc(&lo->lo_pending);
+		spin_unlock_irq(&lo->lo_lock);
+		loop_direct_bio(lo, old_bio);
+		return 0;
+	}
 	loop_add_bio(lo, old_bio);
 	wake_up(&lo->lo_event);
 	spin_unlock_irq(&lo->lo_lock);
@@ -557,11 +724,15 @@ static void loop_unplug(struct request_queue *q)
 	struct loop_device *lo = q->queuedata;
 
 	queue_flag_clear_unlocked(QUEUE_FLAG_PLUGGED, q);
-	blk_run_address_space(lo->lo_backing_file->f_mapping);
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		blk_unplug(bdev_get_queue(lo->lo_backing_bdev));
+	else
+		blk_run_address_space(lo->lo_backing_file->f_mapping);
 }
 
 struct switch_request {
 	struct file *file;
+	int direct;		/* -1, or new LO_FLAGS_DIRECT_IO state */
 	struct completion wait;
 };
 
@@ -572,6 +743,10 @@ static inline void loop_handle_bio(struct loop_device *lo, struct bio *bio)
 	if (unlikely(!bio->bi_bdev)) {
 		do_loop_switch(lo, bio->bi_private);
 		bio_put(bio);
+	} else if (lo->lo_flags & LO_FLAGS_DIRECT_IO) {
+		/* queued behind the switch to direct mode */
+		atomic_inc(&lo->lo_pending);
+		loop_direct_bio(lo, bio);
 	} else {
 		int ret = do_bio_filebacked(lo, bio);
 		bio_endio(bio, ret);
@@ -621,7 +796,7 @@ static int loop_thread(void *data)
  * First it needs to flush existing IO, it does this by sending a magic
  * BIO down the pipe. The completion of this BIO does the actual switch.
  */
-static int loop_switch(struct loop_device *lo, struct file *file)
+static int __loop_switch(struct loop_device *lo, struct file *file, int direct)
 {
 	struct switch_request w;
 	struct bio *bio = bio_alloc(GFP_KERNEL, 0);
@@ -629,6 +804,7 @@ static int loop_switch(struct loop_device *lo, struct file *file)
 		return -ENOMEM;
 	init_completion(&w.wait);
 	w.file = file;
+	w.direct = direct;
 	bio->bi_private = &w;
 	bio->bi_bdev = NULL;
 	loop_make_request(lo->lo_queue, bio);
@@ -636,6 +812,11 @@ static int loop_switch(struct loop_device *lo, struct file *file)
 	return 0;
 }
 
+static int loop_switch(struct loop_device *lo, struct file *file)
+{
+	return __loop_switch(lo, file, -1);
+}
+
 /*
  * Helper to flush the IOs in loop, but keeping loop thread running
  */
@@ -648,6 +829,31 @@ static int loop_flush(struct loop_device *lo)
 	return loop_switch(lo, NULL);
 }
 
+/*
+ * Every bio queued ahead of the switch has gone through the page cache
+ * by now.  Entering direct mode, write that back and drop it so direct
+ * reads see the data; leaving it, wait for the direct bios in flight
+ * and drop whatever got cached meanwhile by other users of the file.
+ */
+static void do_loop_switch_direct(struct loop_device *lo, int direct)
+{
+	struct address_space *mapping = lo->lo_backing_file->f_mapping;
+
+	if (direct) {
+		filemap_write_and_wait(mapping);
+		invalidate_inode_pages2(mapping);
+		spin_lock_irq(&lo->lo_lock);
+		lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+		spin_unlock_irq(&lo->lo_lock);
+	} else {
+		spin_lock_irq(&lo->lo_lock);
+		lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+		spin_unlock_irq(&lo->lo_lock);
+		wait_event(lo->lo_pending_wait, !atomic_read(&lo->lo_pending));
+		invalidate_inode_pages2(mapping);
+	}
+}
+
 /*
  * Do the actual switch; called from the BIO completion routine
  */
@@ -657,6 +863,11 @@ static void do_loop_switch(struct loop_device *lo, struct switch_request *p)
 	struct file *old_file = lo->lo_backing_file;
 	struct address_space *mapping;
 
+	if (p->direct >= 0) {
+		do_loop_switch_direct(lo, p->direct);
+		goto out;
+	}
+
 	/* if no new file, only flush of queued bios requested */
 	if (!file)
 		goto out;
@@ -673,6 +884,202 @@ out:
 }
 
 
+static void loop_unmap_extents(struct loop_device *lo)
+{
+	struct inode *inode = lo->lo_backing_file->f_mapping->host;
+
+	mutex_lock(&inode->i_mutex);
+	inode->i_flags &= ~S_SWAPFILE;
+	mutex_unlock(&inode->i_mutex);
+
+	vfree(lo->lo_extents);
+	lo->lo_extents = NULL;
+	lo->lo_nr_extents = 0;
+	lo->lo_backing_bdev = NULL;
+}
+
+#define LOOP_FIEMAP_EXTENTS	32
+
+/*
+ * bmap() does not tell preallocated but unwritten extents from written
+ * ones, and reading them straight from the disk would return stale
+ * blocks.  Ask ->fiemap, where the filesystem has one, and refuse any
+ * extent in [start, end) that is unwritten, delayed or otherwise not
+ * safe to access directly.  Filesystems without ->fiemap have no
+ * unwritten extents; holes are caught by the bmap() walk.
+ */
+static int loop_check_extents(struct inode *inode, u64 start, u64 end)
+{
+	struct fiemap_extent_info fieinfo;
+	struct fiemap_extent *fe;
+	mm_segment_t old_fs;
+	unsigned int i;
+	u64 next;
+	int error = 0;
+
+	if (!inode->i_op->fiemap)
+		return 0;
+
+	fe = kmalloc(LOOP_FIEMAP_EXTENTS * sizeof(*fe), GFP_KERNEL);
+	if (!fe)
+		return -ENOMEM;
+
+	while (start < end) {
+		memset(&fieinfo, 0, sizeof(fieinfo));
+		fieinfo.fi_extents_max = LOOP_FIEMAP_EXTENTS;
+		fieinfo.fi_extents_start = fe;
+
+		old_fs = get_fs();
+		set_fs(KERNEL_DS);
+		error = inode->i_op->fiemap(inode, &fieinfo, start, end - start);
+		set_fs(old_fs);
+		if (error || !fieinfo.fi_extents_mapped)
+			break;
+
+		for (i = 0; i < fieinfo.fi_extents_mapped; i++) {
+			if (fe[i].fe_flags & (FIEMAP_EXTENT_UNWRITTEN |
+					      FIEMAP_EXTENT_DELALLOC |
+					      FIEMAP_EXTENT_UNKNOWN)) {
+				error = -EINVAL;
+				goto out;
+			}
+		}
+
+		i = fieinfo.fi_extents_mapped - 1;
+		next = fe[i].fe_logical + fe[i].fe_length;
+		if ((fe[i].fe_flags & FIEMAP_EXTENT_LAST) ||
+		    fieinfo.fi_extents_mapped < LOOP_FIEMAP_EXTENTS ||
+		    next <= start)
+			break;
+		start = next;
+
+		error = -EINTR;
+		if (fatal_signal_pending(current))
+			break;
+		error = 0;
+		cond_resched();
+	}
+out:
+	kfree(fe);
+	return error;
+}
+
+/*
+ * Resolve the blocks backing the device's range of the file.  Like
+ * swapon, this refuses files with holes.  It also refuses files with
+ * unwritten or delayed allocation extents in that range, which would
+ * otherwise read back whatever is on disk: such a file has to be
+ * written out in full before direct I/O mode can be used.
+ */
+static int loop_map_extents(struct loop_device *lo)
+{
+	struct inode *inode = lo->lo_backing_file->f_mapping->host;
+	unsigned blkbits = inode->i_blkbits;
+	sector_t sects_per_block = 1 << (blkbits - 9);
+	struct loop_extent *ext = NULL, *new;
+	unsigned int nr = 0, max = 0;
+	sector_t block, last_block, disk;
+	loff_t size;
+	int error;
+
+	size = (loff_t)get_capacity(lo->lo_disk) << 9;
+	if (!size)
+		return -EINVAL;
+	block = lo->lo_offset >> blkbits;
+	last_block = (lo->lo_offset + size - 1) >> blkbits;
+
+	error = filemap_write_and_wait(inode->i_mapping);
+	if (error)
+		return error;
+	error = loop_check_extents(inode, lo->lo_offset, lo->lo_offset + size);
+	if (error)
+		return error;
+
+	for (; block <= last_block; block++) {
+		error = -EINTR;
+		if (fatal_signal_pending(current))
+			goto out_free;
+		cond_resched();
+
+		error = -EINVAL;
+		disk = bmap(inode, block);
+		if (!disk)
+			goto out_free;
+
+		if (nr && ext[nr - 1].disk_sect + ext[nr - 1].nr_sects ==
+			  disk * sects_per_block) {
+			ext[nr - 1].nr_sects += sects_per_block;
+			continue;
+		}
+		if (nr == max) {
+			error = -ENOMEM;
+			max = max ? max * 2 : 64;
+			new = vmalloc(max * sizeof(*new));
+			if (!new)
+				goto out_free;
+			if (nr)
+				memcpy(new, ext, nr * sizeof(*new));
+			vfree(ext);
+			ext = new;
+		}
+		ext[nr].file_sect = block * sects_per_block;
+		ext[nr].nr_sects = sects_per_block;
+		ext[nr].disk_sect = disk * sects_per_block;
+		nr++;
+	}
+
+	lo->lo_extents = ext;
+	lo->lo_nr_extents = nr;
+	lo->lo_backing_bdev = inode->i_sb->s_bdev;
+	return 0;
+
+out_free:
+	vfree(ext);
+	return error;
+}
+
+static int loop_set_direct_io(struct loop_device *lo, unsigned long arg)
+{
+	struct file *file = lo->lo_backing_file;
+	struct inode *inode;
+	int error;
+
+	if (lo->lo_state != Lo_bound)
+		return -ENXIO;
+	if (!arg == !(lo->lo_flags & LO_FLAGS_DIRECT_IO))
+		return 0;
+
+	if (!arg) {
+		error = __loop_switch(lo, NULL, 0);
+		if (!error)
+			loop_unmap_extents(lo);
+		return error;
+	}
+
+	inode = file->f_mapping->host;
+	if (!S_ISREG(inode->i_mode) || !inode->i_mapping->a_ops->bmap ||
+	    !inode->i_sb->s_bdev)
+		return -EINVAL;
+	if (lo->lo_encryption || (lo->lo_offset & 511))
+		return -EINVAL;
+
+	/* pin the block map for as long as we are using it */
+	mutex_lock(&inode->i_mutex);
+	if (IS_SWAPFILE(inode)) {
+		mutex_unlock(&inode->i_mutex);
+		return -EBUSY;
+	}
+	inode->i_flags |= S_SWAPFILE;
+	mutex_unlock(&inode->i_mutex);
+
+	error = loop_map_extents(lo);
+	if (!error)
+		error = __loop_switch(lo, NULL, 1);
+	if (error)
+		loop_unmap_extents(lo);
+	return error;
+}
+
 /*
  * loop_change_fd switched the backing store of a loopback device to
  * a new file. This is useful for operating system installers to free up
@@ -692,6 +1099,10 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 	if (lo->lo_state != Lo_bound)
 		goto out;
 
+	error = -EBUSY;
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		goto out;
+
 	/* the loop device has to be read-only */
 	error = -EINVAL;
 	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY))
@@ -926,6 +1337,11 @@ static int loop_clr_fd(struct loop_device *lo, struct block_device *bdev)
 
 	kthread_stop(lo->lo_thread);
 
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO) {
+		wait_event(lo->lo_pending_wait, !atomic_read(&lo->lo_pending));
+		loop_unmap_extents(lo);
+	}
+
 	lo->lo_queue->unplug_fn = NULL;
 	lo->lo_backing_file = NULL;
 
@@ -979,6 +1395,11 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		return -ENXIO;
 	if ((unsigned int) info->lo_encrypt_key_size > LO_KEY_SIZE)
 		return -EINVAL;
+	/* the block map covers the current offset and size only */
+	if ((lo->lo_flags & LO_FLAGS_DIRECT_IO) &&
+	    (info->lo_encrypt_type || info->lo_offset != lo->lo_offset ||
+	     info->lo_sizelimit != lo->lo_sizelimit))
+		return -EBUSY;
 
 	err = loop_release_xfer(lo);
 	if (err)
@@ -1181,6 +1602,9 @@ static int loop_set_capacity(struct loop_device *lo, struct block_device *bdev)
 	err = -ENXIO;
 	if (unlikely(lo->lo_state != Lo_bound))
 		goto out;
+	err = -EBUSY;
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		goto out;
 	err = figure_loop_size(lo);
 	if (unlikely(err))
 		goto out;
@@ -1233,6 +1657,11 @@ static int lo_ioctl(struct block_device *bdev, fmode_t mode,
 		if ((mode & FMODE_WRITE) || capable(CAP_SYS_ADMIN))
 			err = loop_set_capacity(lo, bdev);
 		break;
+	case LOOP_SET_DIRECT_IO:
+		err = -EPERM;
+		if ((mode & FMODE_WRITE) || capable(CAP_SYS_ADMIN))
+			err = loop_set_direct_io(lo, arg);
+		break;
 	default:
 		err = lo->ioctl ? lo->ioctl(lo, cmd, arg) : -EINVAL;
 	}
@@ -1387,6 +1816,7 @@ static int lo_compat_ioctl(struct block_device *bdev, fmode_t mode,
 		arg = (unsigned long) compat_ptr(arg);
 	case LOOP_SET_FD:
 	case LOOP_CHANGE_FD:
+	case LOOP_SET_DIRECT_IO:
 		err = lo_ioctl(bdev, mode, cmd, arg);
 		break;
 	default:
@@ -1518,6 +1948,8 @@ static struct loop_device *loop_alloc(int i)
 	lo->lo_number		= i;
 	lo->lo_thread		= NULL;
 	init_waitqueue_head(&lo->lo_event);
+	init_waitqueue_head(&lo->lo_pending_wait);
+	atomic_set(&lo->lo_pending, 0);
 	spin_lock_init(&lo->lo_lock);
 	disk->major		= LOOP_MAJOR;
 	disk->first_minor	= i << part_shift;
@@ -1616,8 +2048,15 @@ static int __init loop_init(void)
 		range = 1UL << (MINORBITS - part_shift);
 	}
 
-	if (register_blkdev(LOOP_MAJOR, "loop"))
+	loop_dio_pool = mempool_create_kmalloc_pool(LOOP_DIO_POOL_SIZE,
+						    sizeof(struct loop_dio));
+	if (!loop_dio_pool)
+		return -ENOMEM;
+
+	if (register_blkdev(LOOP_MAJOR, "loop")) {
+		mempool_destroy(loop_dio_pool);
 		return -EIO;
+	}
 
 	for (i = 0; i < nr; i++) {
 		lo = loop_alloc(i);
@@ -1644,6 +2083,7 @@ Enomem:
 		loop_free(lo);
 
 	unregister_blkdev(LOOP_MAJOR, "loop");
+	mempool_destroy(loop_dio_pool);
 	return -ENOMEM;
 }
 
@@ -1659,6 +2099,7 @@ static void __exit loop_exit(void)
 
 	blk_unregister_region(MKDEV(LOOP_MAJOR, 0), range);
 	unregister_blkdev(LOOP_MAJOR, "loop");
+	mempool_destroy(loop_dio_pool);
 }
 
 module_init(loop_init);
@@ -1,6 +1,7 @@
 //#define DEBUG
 #include <linux/spinlock.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/hdreg.h>
 #include <linux/virtio.h>
 #include <linux/virtio_blk.h>
@@ -20,25 +21,21 @@ struct virtio_blk
 	/* The disk structure for the kernel. */
 	struct gendisk *disk;
 
-	/* Request tracking. */
-	struct list_head reqs;
-
-	mempool_t *pool;
-
 	/* What host tells us, plus 2 for header & tailer. */
 	unsigned int sg_elems;
-
-	/* Scatterlist: can be too big for stack. */
-	struct scatterlist sg[/*sg_elems*/];
 };
 
+/*
+ * Per-request driver data, allocated by blk-mq right behind each request
+ * together with a scatterlist of sg_elems entries.
+ */
 struct virtblk_req
 {
-	struct list_head list;
 	struct request *req;
 	struct virtio_blk_outhdr out_hdr;
 	struct virtio_scsi_inhdr in_hdr;
 	u8 status;
+	struct scatterlist sg[/*sg_elems*/];
 };
 
 static void blk_done(struct virtqueue *vq)
@@ -70,25 +67,25 @@ static void blk_done(struct virtqueue *vq)
 			vbr->req->errors = vbr->in_hdr.errors;
 		}
 
-		__blk_end_request_all(vbr->req, error);
-		list_del(&vbr->list);
-		mempool_free(vbr, vblk->pool);
+		blk_mq_end_io(vbr->req, error);
 	}
-	/* In case queue is stopped waiting for more buffers. */
-	blk_start_queue(vblk->disk->queue);
 	spin_unlock_irqrestore(&vblk->lock, flags);
+
+	/* In case queue is stopped waiting for more buffers. */
+	blk_mq_start_stopped_hw_queues(vblk->disk->queue, true);
 }
 
-static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
-		   struct request *req)
+static int virtblk_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *req,
+			    bool last)
 {
+	struct request_queue *q = hctx->queue;
+	struct virtio_blk *vblk = hctx->driver_data;
+	struct virtblk_req *vbr = blk_mq_rq_to_pdu(req);
 	unsigned long num, out = 0, in = 0;
-	struct virtblk_req *vbr;
+	unsigned long flags;
+	int err;
 
-	vbr = mempool_alloc(vblk->pool, GFP_ATOMIC);
-	if (!vbr)
-		/* When another request finishes we'll try again. */
-		return false;
+	BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
 
 	vbr->req = req;
 	switch (req->cmd_type) {
@@ -118,7 +115,7 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 	if (blk_barrier_rq(vbr->req))
 		vbr->out_hdr.type |= VIRTIO_BLK_T_BARRIER;
 
-	sg_set_buf(&vblk->sg[out++], &vbr->out_hdr, sizeof(vbr->out_hdr));
+	sg_set_buf(&vbr->sg[out++], &vbr->out_hdr, sizeof(vbr->out_hdr));
 
 	/*
 	 * If this is a packet command we need a couple of additional headers.
@@ -127,17 +124,17 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 	 * inhdr with additional status information before the normal inhdr.
 	 */
 	if (blk_pc_request(vbr->req))
-		sg_set_buf(&vblk->sg[out++], vbr->req->cmd, vbr->req->cmd_len);
+		sg_set_buf(&vbr->sg[out++], vbr->req->cmd, vbr->req->cmd_len);
 
-	num = blk_rq_map_sg(q, vbr->req, vblk->sg + out);
+	num = blk_rq_map_sg(q, vbr->req, vbr->sg + out);
 
 	if (blk_pc_request(vbr->req)) {
-		sg_set_buf(&vblk->sg[num + out + in++], vbr->req->sense, 96);
-		sg_set_buf(&vblk->sg[num + out + in++], &vbr->in_hdr,
+		sg_set_buf(&vbr->sg[num + out + in++], vbr->req->sense, 96);
+		sg_set_buf(&vbr->sg[num + out + in++], &vbr->in_hdr,
 			   sizeof(vbr->in_hdr));
 	}
 
-	sg_set_buf(&vblk->sg[num + out + in++], &vbr->status,
+	sg_set_buf(&vbr->sg[num + out + in++], &vbr->status,
 		   sizeof(vbr->status));
 
 	if (num) {
@@ -150,38 +147,57 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 		}
 	}
 
-	if (vblk->vq->vq_ops->add_buf(vblk->vq, vblk->sg, out, in, vbr) < 0) {
-		mempool_free(vbr, vblk->pool);
-		return false;
+	spin_lock_irqsave(&vblk->lock, flags);
+	err = vblk->vq->vq_ops->add_buf(vblk->vq, vbr->sg, out, in, vbr);
+	if (err < 0) {
+		/* The ring is full: stop the queue and wait for something to
+		   finish to restart it.  Push out what we queued so far. */
+		blk_mq_stop_hw_queue(hctx);
+		vblk->vq->vq_ops->kick(vblk->vq);
+		spin_unlock_irqrestore(&vblk->lock, flags);
+		return BLK_MQ_RQ_QUEUE_BUSY;
 	}
 
-	list_add_tail(&vbr->list, &vblk->reqs);
-	return true;
+	/* Ring the doorbell once per batch. */
+	if (last)
+		vblk->vq->vq_ops->kick(vblk->vq);
+	spin_unlock_irqrestore(&vblk->lock, flags);
+
+	return BLK_MQ_RQ_QUEUE_OK;
 }
 
-static void do_virtblk_request(struct request_queue *q)
+static int virtblk_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+			     unsigned int index)
 {
-	struct virtio_blk *vblk = q->queuedata;
-	struct request *req;
-	unsigned int issued = 0;
-
-	while ((req = blk_peek_request(q)) != NULL) {
-		BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
+	hctx->driver_data = data;
+	return 0;
+}
 
-		/* If this request fails, stop queue and wait for something to
-		   finish to restart it. */
-		if (!do_req(q, vblk, req)) {
-			blk_stop_queue(q);
-			break;
-		}
-		blk_start_request(req);
-		issued++;
-	}
+static int virtblk_init_request(void *data, struct blk_mq_hw_ctx *hctx,
+				struct request *rq, unsigned int index)
+{
+	struct virtio_blk *vblk = data;
+	struct virtblk_req *vbr = blk_mq_rq_to_pdu(rq);
 
-	if (issued)
-		vblk->vq->vq_ops->kick(vblk->vq);
+	sg_init_table(vbr->sg, vblk->sg_elems);
+	return 0;
 }
 
+static struct blk_mq_ops virtio_mq_ops = {
+	.queue_rq	= virtblk_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+	.init_hctx	= virtblk_init_hctx,
+	.init_request	= virtblk_init_request,
+};
+
+static const struct blk_mq_reg virtio_mq_reg = {
+	.ops		= &virtio_mq_ops,
+	.nr_hw_queues	= 1,
+	.queue_depth	= 64,
+	.numa_node	= NUMA_NO_NODE,
+	.flags		= BLK_MQ_F_SHOULD_MERGE,
+};
+
 static void virtblk_prepare_flush(struct request_queue *q, struct request *req)
 {
 	req->cmd_type = REQ_TYPE_LINUX_BLOCK;
@@ -243,6 +259,7 @@ static int index_to_minor(int index)
 static int __devinit virtblk_probe(struct virtio_device *vdev)
 {
 	struct virtio_blk *vblk;
+	struct blk_mq_reg reg;
 	int err;
 	u64 cap;
 	u32 v;
@@ -260,18 +277,15 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 
 	/* We need an extra sg elements at head and tail. */
 	sg_elems += 2;
-	vdev->priv = vblk = kmalloc(sizeof(*vblk) +
-				    sizeof(vblk->sg[0]) * sg_elems, GFP_KERNEL);
+	vdev->priv = vblk = kmalloc(sizeof(*vblk), GFP_KERNEL);
 	if (!vblk) {
 		err = -ENOMEM;
 		goto out;
 	}
 
-	INIT_LIST_HEAD(&vblk->reqs);
 	spin_lock_init(&vblk->lock);
 	vblk->vdev = vdev;
 	vblk->sg_elems = sg_elems;
-	sg_init_table(vblk->sg, vblk->sg_elems);
 
 	/* We expect one virtqueue, for output. */
 	vblk->vq = virtio_find_single_vq(vdev, blk_done, "requests");
@@ -280,20 +294,19 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 		goto out_free_vblk;
 	}
 
-	vblk->pool = mempool_create_kmalloc_pool(1,sizeof(struct virtblk_req));
-	if (!vblk->pool) {
-		err = -ENOMEM;
-		goto out_free_vq;
-	}
-
 	/* FIXME: How many partitions?  How long is a piece of string? */
 	vblk->disk = alloc_disk(1 << PART_BITS);
 	if (!vblk->disk) {
 		err = -ENOMEM;
-		goto out_mempool;
+		goto out_free_vq;
 	}
 
-	vblk->disk->queue = blk_init_queue(do_virtblk_request, &vblk->lock);
+	/* Every request carries its own scatterlist. */
+	reg = virtio_mq_reg;
+	reg.cmd_size = sizeof(struct virtblk_req) +
+		       sizeof(struct scatterlist) * sg_elems;
+
+	vblk->disk->queue = blk_mq_init_queue(&reg, vblk);
 	if (!vblk->disk->queue) {
 		err = -ENOMEM;
 		goto out_put_disk;
@@ -376,8 +389,6 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 
 out_put_disk:
 	put_disk(vblk->disk);
-out_mempool:
-	mempool_destroy(vblk->pool);
 out_free_vq:
 	vdev->config->del_vqs(vdev);
 out_free_vblk:
@@ -390,16 +401,12 @@ static void __devexit virtblk_remove(struct virtio_device *vdev)
 {
 	struct virtio_blk *vblk = vdev->priv;
 
-	/* Nothing should be pending. */
-	BUG_ON(!list_empty(&vblk->reqs));
-
 	/* Stop all the virtqueues. */
 	vdev->config->reset(vdev);
 
 	del_gendisk(vblk->disk);
 	blk_cleanup_queue(vblk->disk->queue);
 	put_disk(vblk->disk);
-	mempool_destroy(vblk->pool);
 	vdev->config->del_vqs(vdev);
 	kfree(vblk);
 }
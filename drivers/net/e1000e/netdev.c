@@ -559,7 +559,7 @@ static void e1000_put_txbuf(struct e1000_adapter *adapter,
 	if (buffer_info->skb) {
 		skb_dma_unmap(&adapter->pdev->dev, buffer_info->skb,
 		              DMA_TO_DEVICE);
-		dev_kfree_skb_any(buffer_info->skb);
+		dev_kfree_skb_recycle(buffer_info->skb);
 		buffer_info->skb = NULL;
 	}
 	buffer_info->time_stamp = 0;
@@ -610,6 +610,7 @@ static bool e1000_clean_tx_irq(struct e1000_adapter *adapter)
 	unsigned int i, eop;
 	unsigned int count = 0;
 	unsigned int total_tx_bytes = 0, total_tx_packets = 0;
+	unsigned int bytes_compl = 0, pkts_compl = 0;
 
 	i = tx_ring->next_to_clean;
 	eop = tx_ring->buffer_info[i].next_to_watch;
@@ -632,6 +633,8 @@ static bool e1000_clean_tx_irq(struct e1000_adapter *adapter)
 					    skb->len;
 				total_tx_packets += segs;
 				total_tx_bytes += bytecount;
+				bytes_compl += skb->len;
+				pkts_compl++;
 			}
 
 			e1000_put_txbuf(adapter, buffer_info);
@@ -650,6 +653,8 @@ static bool e1000_clean_tx_irq(struct e1000_adapter *adapter)
 
 	tx_ring->next_to_clean = i;
 
+	netdev_completed_queue(netdev, pkts_compl, bytes_compl);
+
 #define TX_WAKE_THRESHOLD 32
 	if (count && netif_carrier_ok(netdev) &&
 	    e1000_desc_unused(tx_ring) >= TX_WAKE_THRESHOLD) {
@@ -1780,6 +1785,8 @@ static void e1000_clean_tx_ring(struct e1000_adapter *adapter)
 	tx_ring->next_to_use = 0;
 	tx_ring->next_to_clean = 0;
 
+	netdev_reset_queue(adapter->netdev);
+
 	writel(0, adapter->hw.hw_addr + tx_ring->head);
 	writel(0, adapter->hw.hw_addr + tx_ring->tail);
 }
@@ -4213,6 +4220,7 @@ static netdev_tx_t e1000_xmit_frame(struct sk_buff *skb,
 	/* if count is 0 then mapping error has occured */
 	count = e1000_tx_map(adapter, skb, first, max_per_txd, nr_frags, mss);
 	if (count) {
+		netdev_sent_queue(netdev, skb->len);
 		e1000_tx_queue(adapter, tx_flags, count);
 		/* Make sure there is space in the ring for the next send. */
 		e1000_maybe_stop_tx(netdev, MAX_SKB_FRAGS + 2);
@@ -2621,7 +2621,7 @@ static void igb_unmap_and_free_tx_resource(struct igb_adapter *adapter,
 	if (buffer_info->skb) {
 		skb_dma_unmap(&adapter->pdev->dev, buffer_info->skb,
 		              DMA_TO_DEVICE);
-		dev_kfree_skb_any(buffer_info->skb);
+		dev_kfree_skb_recycle(buffer_info->skb);
 		buffer_info->skb = NULL;
 	}
 	buffer_info->time_stamp = 0;
@@ -2658,6 +2658,9 @@ static void igb_clean_tx_ring(struct igb_ring *tx_ring)
 	tx_ring->next_to_use = 0;
 	tx_ring->next_to_clean = 0;
 
+	netdev_tx_reset_queue(netdev_get_tx_queue(adapter->netdev,
+						  tx_ring->queue_index));
+
 	writel(0, adapter->hw.hw_addr + tx_ring->head);
 	writel(0, adapter->hw.hw_addr + tx_ring->tail);
 }
@@ -3571,11 +3574,8 @@ static inline void igb_tx_queue_adv(struct igb_adapter *adapter,
 	 * such as IA-64). */
 	wmb();
 
+	/* the tail is written by igb_xmit_frame_adv() */
 	tx_ring->next_to_use = i;
-	writel(i, adapter->hw.hw_addr + tx_ring->tail);
-	/* we need this if more than one processor can write to our tail
-	 * at a time, it syncronizes IO on IA64/Altix systems */
-	mmiowb();
 }
 
 static int __igb_maybe_stop_tx(struct net_device *netdev,
@@ -3676,6 +3676,9 @@ static netdev_tx_t igb_xmit_frame_ring_adv(struct sk_buff *skb,
 	count = igb_tx_map_adv(adapter, tx_ring, skb, first);
 
 	if (count) {
+		netdev_tx_sent_queue(netdev_get_tx_queue(netdev,
+							 tx_ring->queue_index),
+				     skb->len);
 		igb_tx_queue_adv(adapter, tx_ring, tx_flags, count,
 			         skb->len, hdr_len);
 		/* Make sure there is space in the ring for the next send. */
@@ -3694,6 +3697,8 @@ static netdev_tx_t igb_xmit_frame_adv(struct sk_buff *skb,
 {
 	struct igb_adapter *adapter = netdev_priv(netdev);
 	struct igb_ring *tx_ring;
+	bool more = skb->xmit_more;
+	netdev_tx_t ret;
 
 	int r_idx = 0;
 	r_idx = skb->queue_mapping & (IGB_ABS_MAX_TX_QUEUES - 1);
@@ -3703,7 +3708,19 @@ static netdev_tx_t igb_xmit_frame_adv(struct sk_buff *skb,
 	 * to a flow.  Right now, performance is impacted slightly negatively
 	 * if using multiple tx queues.  If the stack breaks away from a
 	 * single qdisc implementation, we can look at this again. */
-	return igb_xmit_frame_ring_adv(skb, netdev, tx_ring);
+	ret = igb_xmit_frame_ring_adv(skb, netdev, tx_ring);
+
+	/* Notify the hardware once per batch, or when no more will come */
+	if ((!more || netif_xmit_stopped(netdev_get_tx_queue(netdev,
+						tx_ring->queue_index))) &&
+	    !test_bit(__IGB_DOWN, &adapter->state)) {
+		writel(tx_ring->next_to_use,
+		       adapter->hw.hw_addr + tx_ring->tail);
+		/* we need this if more than one processor can write to our
+		 * tail at a time, it syncronizes IO on IA64/Altix systems */
+		mmiowb();
+	}
+	return ret;
 }
 
 /**
@@ -4714,6 +4731,7 @@ static bool igb_clean_tx_irq(struct igb_q_vector *q_vector)
 	struct sk_buff *skb;
 	union e1000_adv_tx_desc *tx_desc, *eop_desc;
 	unsigned int total_bytes = 0, total_packets = 0;
+	unsigned int bytes_compl = 0, pkts_compl = 0;
 	unsigned int i, eop, count = 0;
 	bool cleaned = false;
 
@@ -4738,6 +4756,8 @@ static bool igb_clean_tx_irq(struct igb_q_vector *q_vector)
 					    skb->len;
 				total_packets += segs;
 				total_bytes += bytecount;
+				bytes_compl += skb->len;
+				pkts_compl++;
 
 				igb_tx_hwtstamp(q_vector, skb);
 			}
@@ -4755,6 +4775,10 @@ static bool igb_clean_tx_irq(struct igb_q_vector *q_vector)
 
 	tx_ring->next_to_clean = i;
 
+	netdev_tx_completed_queue(netdev_get_tx_queue(netdev,
+						      tx_ring->queue_index),
+				  pkts_compl, bytes_compl);
+
 	if (unlikely(count &&
 		     netif_carrier_ok(netdev) &&
 		     igb_desc_unused(tx_ring) >= IGB_TX_QUEUE_WAKE)) {
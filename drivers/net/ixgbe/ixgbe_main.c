@@ -229,7 +229,7 @@ static void ixgbe_unmap_and_free_tx_resource(struct ixgbe_adapter *adapter,
 	if (tx_buffer_info->skb) {
 		skb_dma_unmap(&adapter->pdev->dev, tx_buffer_info->skb,
 		              DMA_TO_DEVICE);
-		dev_kfree_skb_any(tx_buffer_info->skb);
+		dev_kfree_skb_recycle(tx_buffer_info->skb);
 		tx_buffer_info->skb = NULL;
 	}
 	tx_buffer_info->time_stamp = 0;
@@ -345,6 +345,7 @@ static bool ixgbe_clean_tx_irq(struct ixgbe_q_vector *q_vector,
 	struct ixgbe_tx_buffer *tx_buffer_info;
 	unsigned int i, eop, count = 0;
 	unsigned int total_bytes = 0, total_packets = 0;
+	unsigned int bytes_compl = 0, pkts_compl = 0;
 
 	i = tx_ring->next_to_clean;
 	eop = tx_ring->tx_buffer_info[i].next_to_watch;
@@ -382,6 +383,8 @@ static bool ixgbe_clean_tx_irq(struct ixgbe_q_vector *q_vector,
 				bytecount = ((segs - 1) * hlen) + skb->len;
 				total_packets += segs;
 				total_bytes += bytecount;
+				bytes_compl += skb->len;
+				pkts_compl++;
 			}
 
 			ixgbe_unmap_and_free_tx_resource(adapter,
@@ -400,6 +403,10 @@ static bool ixgbe_clean_tx_irq(struct ixgbe_q_vector *q_vector,
 
 	tx_ring->next_to_clean = i;
 
+	netdev_tx_completed_queue(netdev_get_tx_queue(netdev,
+						      tx_ring->queue_index),
+				  pkts_compl, bytes_compl);
+
 #define TX_WAKE_THRESHOLD (DESC_NEEDED * 2)
 	if (unlikely(count && netif_carrier_ok(netdev) &&
 	             (IXGBE_DESC_UNUSED(tx_ring) >= TX_WAKE_THRESHOLD))) {
@@ -3048,6 +3055,9 @@ static void ixgbe_clean_tx_ring(struct ixgbe_adapter *adapter,
 	tx_ring->next_to_use = 0;
 	tx_ring->next_to_clean = 0;
 
+	netdev_tx_reset_queue(netdev_get_tx_queue(adapter->netdev,
+						  tx_ring->queue_index));
+
 	if (tx_ring->head)
 		writel(0, adapter->hw.hw_addr + tx_ring->head);
 	if (tx_ring->tail)
@@ -5247,8 +5257,8 @@ static void ixgbe_tx_queue(struct ixgbe_adapter *adapter,
 	 */
 	wmb();
 
+	/* the tail is written by ixgbe_xmit_frame() */
 	tx_ring->next_to_use = i;
-	writel(i, adapter->hw.hw_addr + tx_ring->tail);
 }
 
 static void ixgbe_atr(struct ixgbe_adapter *adapter, struct sk_buff *skb,
@@ -5360,6 +5370,8 @@ static netdev_tx_t ixgbe_xmit_frame(struct sk_buff *skb,
 	int tso;
 	int count = 0;
 	unsigned int f;
+	bool more = skb->xmit_more;
+	netdev_tx_t ret = NETDEV_TX_OK;
 
 	if (adapter->vlgrp && vlan_tx_tag_present(skb)) {
 		tx_flags |= vlan_tx_tag_get(skb);
@@ -5414,7 +5426,8 @@ static netdev_tx_t ixgbe_xmit_frame(struct sk_buff *skb,
 
 	if (ixgbe_maybe_stop_tx(netdev, tx_ring, count)) {
 		adapter->tx_busy++;
-		return NETDEV_TX_BUSY;
+		ret = NETDEV_TX_BUSY;
+		goto kick;
 	}
 
 	first = tx_ring->next_to_use;
@@ -5424,7 +5437,7 @@ static netdev_tx_t ixgbe_xmit_frame(struct sk_buff *skb,
 		tso = ixgbe_fso(adapter, tx_ring, skb, tx_flags, &hdr_len);
 		if (tso < 0) {
 			dev_kfree_skb_any(skb);
-			return NETDEV_TX_OK;
+			goto kick;
 		}
 		if (tso)
 			tx_flags |= IXGBE_TX_FLAGS_FSO;
@@ -5435,7 +5448,7 @@ static netdev_tx_t ixgbe_xmit_frame(struct sk_buff *skb,
 		tso = ixgbe_tso(adapter, tx_ring, skb, tx_flags, &hdr_len);
 		if (tso < 0) {
 			dev_kfree_skb_any(skb);
-			return NETDEV_TX_OK;
+			goto kick;
 		}
 
 		if (tso)
@@ -5458,6 +5471,9 @@ static netdev_tx_t ixgbe_xmit_frame(struct sk_buff *skb,
 				tx_ring->atr_count = 0;
 			}
 		}
+		netdev_tx_sent_queue(netdev_get_tx_queue(netdev,
+							 tx_ring->queue_index),
+				     skb->len);
 		ixgbe_tx_queue(adapter, tx_ring, tx_flags, count, skb->len,
 		               hdr_len);
 		ixgbe_maybe_stop_tx(netdev, tx_ring, DESC_NEEDED);
@@ -5468,7 +5484,13 @@ static netdev_tx_t ixgbe_xmit_frame(struct sk_buff *skb,
 		tx_ring->next_to_use = first;
 	}
 
-	return NETDEV_TX_OK;
+kick:
+	/* Notify the hardware once per batch, or when no more will come */
+	if (!more || netif_xmit_stopped(netdev_get_tx_queue(netdev,
+						tx_ring->queue_index)))
+		writel(tx_ring->next_to_use,
+		       adapter->hw.hw_addr + tx_ring->tail);
+	return ret;
 }
 
 /**
@@ -29,6 +29,7 @@
 #include <linux/timer.h>
 #include <linux/aio.h>
 #include <linux/highmem.h>
+#include <linux/pagemap.h>
 #include <linux/workqueue.h>
 #include <linux/security.h>
 #include <linux/eventfd.h>
@@ -51,6 +52,7 @@
 static DEFINE_SPINLOCK(aio_nr_lock);
 unsigned long aio_nr;		/* current system wide number of aio requests */
 unsigned long aio_max_nr = 0x10000; /* system wide maximum number of aio requests */
+unsigned long aio_poll_usecs = 50; /* longest IOCB_FLAG_POLL spin */
 /*----end sysctl variables---*/
 
 static struct kmem_cache	*kiocb_cachep;
@@ -202,6 +204,7 @@ static void ctx_rcu_free(struct rcu_head *head)
 	struct kioctx *ctx = container_of(head, struct kioctx, rcu_head);
 	unsigned nr_events = ctx->max_reqs;
 
+	free_percpu(ctx->active_reqs);
 	kmem_cache_free(kioctx_cachep, ctx);
 
 	if (nr_events) {
@@ -218,7 +221,7 @@ static void ctx_rcu_free(struct rcu_head *head)
  */
 static void __put_ioctx(struct kioctx *ctx)
 {
-	BUG_ON(ctx->reqs_active);
+	BUG_ON(atomic_read(&ctx->reqs_active));
 
 	cancel_delayed_work(&ctx->wq);
 	cancel_work_sync(&ctx->wq.work);
@@ -247,6 +250,7 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 	struct mm_struct *mm;
 	struct kioctx *ctx;
 	int did_sync = 0;
+	int cpu;
 
 	/* Prevent overflows */
 	if ((nr_events > (0x10000000U / sizeof(struct io_event))) ||
@@ -262,6 +266,18 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 	if (!ctx)
 		return ERR_PTR(-ENOMEM);
 
+	ctx->active_reqs = alloc_percpu(struct aio_active_reqs);
+	if (!ctx->active_reqs) {
+		kmem_cache_free(kioctx_cachep, ctx);
+		return ERR_PTR(-ENOMEM);
+	}
+	for_each_possible_cpu(cpu) {
+		struct aio_active_reqs *reqs = per_cpu_ptr(ctx->active_reqs, cpu);
+
+		spin_lock_init(&reqs->lock);
+		INIT_LIST_HEAD(&reqs->list);
+	}
+
 	ctx->max_reqs = nr_events;
 	mm = ctx->mm = current->mm;
 	atomic_inc(&mm->mm_count);
@@ -271,7 +287,6 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 	spin_lock_init(&ctx->ring_info.ring_lock);
 	init_waitqueue_head(&ctx->wait);
 
-	INIT_LIST_HEAD(&ctx->active_reqs);
 	INIT_LIST_HEAD(&ctx->run_list);
 	INIT_DELAYED_WORK(&ctx->wq, aio_kick_handler);
 
@@ -314,6 +329,7 @@ out_cleanup:
 
 out_freectx:
 	mmdrop(mm);
+	free_percpu(ctx->active_reqs);
 	kmem_cache_free(kioctx_cachep, ctx);
 	ctx = ERR_PTR(-ENOMEM);
 
@@ -330,22 +346,30 @@ static void aio_cancel_all(struct kioctx *ctx)
 {
 	int (*cancel)(struct kiocb *, struct io_event *);
 	struct io_event res;
+	int cpu;
+
 	spin_lock_irq(&ctx->ctx_lock);
 	ctx->dead = 1;
-	while (!list_empty(&ctx->active_reqs)) {
-		struct list_head *pos = ctx->active_reqs.next;
-		struct kiocb *iocb = list_kiocb(pos);
-		list_del_init(&iocb->ki_list);
-		cancel = iocb->ki_cancel;
-		kiocbSetCancelled(iocb);
-		if (cancel) {
-			iocb->ki_users++;
-			spin_unlock_irq(&ctx->ctx_lock);
-			cancel(iocb, &res);
-			spin_lock_irq(&ctx->ctx_lock);
+	spin_unlock_irq(&ctx->ctx_lock);
+
+	for_each_possible_cpu(cpu) {
+		struct aio_active_reqs *reqs = per_cpu_ptr(ctx->active_reqs, cpu);
+
+		spin_lock_irq(&reqs->lock);
+		while (!list_empty(&reqs->list)) {
+			struct kiocb *iocb = list_kiocb(reqs->list.next);
+			list_del_init(&iocb->ki_list);
+			cancel = iocb->ki_cancel;
+			kiocbSetCancelled(iocb);
+			/* a zero count means the final put is under way */
+			if (cancel && atomic_inc_not_zero(&iocb->ki_users)) {
+				spin_unlock_irq(&reqs->lock);
+				cancel(iocb, &res);
+				spin_lock_irq(&reqs->lock);
+			}
 		}
+		spin_unlock_irq(&reqs->lock);
 	}
-	spin_unlock_irq(&ctx->ctx_lock);
 }
 
 static void wait_for_all_aios(struct kioctx *ctx)
@@ -353,23 +377,17 @@ static void wait_for_all_aios(struct kioctx *ctx)
 	struct task_struct *tsk = current;
 	DECLARE_WAITQUEUE(wait, tsk);
 
-	spin_lock_irq(&ctx->ctx_lock);
-	if (!ctx->reqs_active)
-		goto out;
+	if (!atomic_read(&ctx->reqs_active))
+		return;
 
 	add_wait_queue(&ctx->wait, &wait);
 	set_task_state(tsk, TASK_UNINTERRUPTIBLE);
-	while (ctx->reqs_active) {
-		spin_unlock_irq(&ctx->ctx_lock);
+	while (atomic_read(&ctx->reqs_active)) {
 		io_schedule();
 		set_task_state(tsk, TASK_UNINTERRUPTIBLE);
-		spin_lock_irq(&ctx->ctx_lock);
 	}
 	__set_task_state(tsk, TASK_RUNNING);
 	remove_wait_queue(&ctx->wait, &wait);
-
-out:
-	spin_unlock_irq(&ctx->ctx_lock);
 }
 
 /* wait_on_sync_kiocb:
@@ -377,9 +395,9 @@ out:
  */
 ssize_t wait_on_sync_kiocb(struct kiocb *iocb)
 {
-	while (iocb->ki_users) {
+	while (atomic_read(&iocb->ki_users)) {
 		set_current_state(TASK_UNINTERRUPTIBLE);
-		if (!iocb->ki_users)
+		if (!atomic_read(&iocb->ki_users))
 			break;
 		io_schedule();
 	}
@@ -415,7 +433,7 @@ void exit_aio(struct mm_struct *mm)
 			printk(KERN_DEBUG
 				"exit_aio:ioctx still alive: %d %d %d\n",
 				atomic_read(&ctx->users), ctx->dead,
-				ctx->reqs_active);
+				atomic_read(&ctx->reqs_active));
 		put_ioctx(ctx);
 	}
 }
@@ -430,9 +448,16 @@ void exit_aio(struct mm_struct *mm)
  * This prevents races between the aio code path referencing the
  * req (after submitting it) and aio_complete() freeing the req.
  */
+static void aio_dec_active(struct kioctx *ctx)
+{
+	if (atomic_dec_and_test(&ctx->reqs_active) && unlikely(ctx->dead))
+		wake_up(&ctx->wait);
+}
+
 static struct kiocb *__aio_get_req(struct kioctx *ctx)
 {
 	struct kiocb *req = NULL;
+	struct aio_active_reqs *reqs;
 	struct aio_ring *ring;
 	int okay = 0;
 
@@ -441,7 +466,7 @@ static struct kiocb *__aio_get_req(struct kioctx *ctx)
 		return NULL;
 
 	req->ki_flags = 0;
-	req->ki_users = 2;
+	atomic_set(&req->ki_users, 2);
 	req->ki_key = 0;
 	req->ki_ctx = ctx;
 	req->ki_cancel = NULL;
@@ -455,17 +480,20 @@ static struct kiocb *__aio_get_req(struct kioctx *ctx)
 	/* Check if the completion queue has enough free space to
 	 * accept an event from this io.
 	 */
-	spin_lock_irq(&ctx->ctx_lock);
 	ring = kmap_atomic(ctx->ring_info.ring_pages[0], KM_USER0);
-	if (ctx->reqs_active < aio_ring_avail(&ctx->ring_info, ring)) {
-		list_add(&req->ki_list, &ctx->active_reqs);
-		ctx->reqs_active++;
+	if (atomic_inc_return(&ctx->reqs_active) <=
+	    aio_ring_avail(&ctx->ring_info, ring))
 		okay = 1;
-	}
 	kunmap_atomic(ring, KM_USER0);
-	spin_unlock_irq(&ctx->ctx_lock);
 
-	if (!okay) {
+	if (okay) {
+		req->ki_cpu = raw_smp_processor_id();
+		reqs = per_cpu_ptr(ctx->active_reqs, req->ki_cpu);
+		spin_lock_irq(&reqs->lock);
+		list_add(&req->ki_list, &reqs->list);
+		spin_unlock_irq(&reqs->lock);
+	} else {
+		aio_dec_active(ctx);
 		kmem_cache_free(kiocb_cachep, req);
 		req = NULL;
 	}
@@ -490,8 +518,6 @@ static inline struct kiocb *aio_get_req(struct kioctx *ctx)
 
 static inline void really_put_req(struct kioctx *ctx, struct kiocb *req)
 {
-	assert_spin_locked(&ctx->ctx_lock);
-
 	if (req->ki_eventfd != NULL)
 		eventfd_ctx_put(req->ki_eventfd);
 	if (req->ki_dtor)
@@ -499,10 +525,7 @@ static inline void really_put_req(struct kioctx *ctx, struct kiocb *req)
 	if (req->ki_iovec != &req->ki_inline_vec)
 		kfree(req->ki_iovec);
 	kmem_cache_free(kiocb_cachep, req);
-	ctx->reqs_active--;
-
-	if (unlikely(!ctx->reqs_active && ctx->dead))
-		wake_up(&ctx->wait);
+	aio_dec_active(ctx);
 }
 
 static void aio_fput_routine(struct work_struct *data)
@@ -520,9 +543,7 @@ static void aio_fput_routine(struct work_struct *data)
 			__fput(req->ki_filp);
 
 		/* Link the iocb into the context's free list */
-		spin_lock_irq(&ctx->ctx_lock);
 		really_put_req(ctx, req);
-		spin_unlock_irq(&ctx->ctx_lock);
 
 		put_ioctx(ctx);
 		spin_lock_irq(&fput_lock);
@@ -532,19 +553,24 @@ static void aio_fput_routine(struct work_struct *data)
 
 /* __aio_put_req
  *	Returns true if this put was the last user of the request.
+ *	Needs no lock: only the final put touches the per-cpu list
+ *	of active requests, under that list's lock.
  */
 static int __aio_put_req(struct kioctx *ctx, struct kiocb *req)
 {
+	struct aio_active_reqs *reqs;
+	unsigned long flags;
+
 	dprintk(KERN_DEBUG "aio_put(%p): f_count=%ld\n",
 		req, atomic_long_read(&req->ki_filp->f_count));
 
-	assert_spin_locked(&ctx->ctx_lock);
-
-	req->ki_users--;
-	BUG_ON(req->ki_users < 0);
-	if (likely(req->ki_users))
+	BUG_ON(atomic_read(&req->ki_users) <= 0);
+	if (likely(!atomic_dec_and_test(&req->ki_users)))
 		return 0;
+	reqs = per_cpu_ptr(ctx->active_reqs, req->ki_cpu);
+	spin_lock_irqsave(&reqs->lock, flags);
 	list_del(&req->ki_list);		/* remove from active_reqs */
+	spin_unlock_irqrestore(&reqs->lock, flags);
 	req->ki_cancel = NULL;
 	req->ki_retry = NULL;
 
@@ -556,9 +582,9 @@ static int __aio_put_req(struct kioctx *ctx, struct kiocb *req)
 	 */
 	if (unlikely(atomic_long_dec_and_test(&req->ki_filp->f_count))) {
 		get_ioctx(ctx);
-		spin_lock(&fput_lock);
+		spin_lock_irqsave(&fput_lock, flags);
 		list_add(&req->ki_list, &fput_head);
-		spin_unlock(&fput_lock);
+		spin_unlock_irqrestore(&fput_lock, flags);
 		queue_work(aio_wq, &fput_work);
 	} else {
 		req->ki_filp = NULL;
@@ -573,12 +599,7 @@ static int __aio_put_req(struct kioctx *ctx, struct kiocb *req)
  */
 int aio_put_req(struct kiocb *req)
 {
-	struct kioctx *ctx = req->ki_ctx;
-	int ret;
-	spin_lock_irq(&ctx->ctx_lock);
-	ret = __aio_put_req(ctx, req);
-	spin_unlock_irq(&ctx->ctx_lock);
-	return ret;
+	return __aio_put_req(req->ki_ctx, req);
 }
 EXPORT_SYMBOL(aio_put_req);
 
@@ -703,7 +724,7 @@ static ssize_t aio_run_iocb(struct kiocb *iocb)
 	ret = retry(iocb);
 
 	if (ret != -EIOCBRETRY && ret != -EIOCBQUEUED) {
-		BUG_ON(!list_empty(&iocb->ki_wait.task_list));
+		BUG_ON(!list_empty(&iocb->ki_wait.wait.task_list));
 		aio_complete(iocb, ret, 0);
 	}
 out:
@@ -758,7 +779,7 @@ static int __aio_run_iocbs(struct kioctx *ctx)
 		/*
 		 * Hold an extra reference while retrying i/o.
 		 */
-		iocb->ki_users++;       /* grab extra reference */
+		atomic_inc(&iocb->ki_users);	/* grab extra reference */
 		aio_run_iocb(iocb);
 		__aio_put_req(ctx, iocb);
  	}
@@ -862,7 +883,7 @@ static void try_queue_kicked_iocb(struct kiocb *iocb)
 	 * than retry has happened before we could queue the iocb.  This also
 	 * means that the retry could have completed and freed our iocb, no
 	 * good. */
-	BUG_ON((!list_empty(&iocb->ki_wait.task_list)));
+	BUG_ON((!list_empty(&iocb->ki_wait.wait.task_list)));
 
 	spin_lock_irqsave(&ctx->ctx_lock, flags);
 	/* set this inside the lock so that we can't race with aio_run_iocb()
@@ -907,7 +928,7 @@ int aio_complete(struct kiocb *iocb, long res, long res2)
 	struct aio_ring	*ring;
 	struct io_event	*event;
 	unsigned long	flags;
-	unsigned long	tail;
+	unsigned	slot, tail;
 	int		ret;
 
 	/*
@@ -918,25 +939,22 @@ int aio_complete(struct kiocb *iocb, long res, long res2)
 	 *  - the sync task helpfully left a reference to itself in the iocb
 	 */
 	if (is_sync_kiocb(iocb)) {
-		BUG_ON(iocb->ki_users != 1);
+		BUG_ON(atomic_read(&iocb->ki_users) != 1);
 		iocb->ki_user_data = res;
-		iocb->ki_users = 0;
+		atomic_set(&iocb->ki_users, 0);
 		wake_up_process(iocb->ki_obj.tsk);
 		return 1;
 	}
 
 	info = &ctx->ring_info;
 
-	/* add a completion event to the ring buffer.
-	 * must be done holding ctx->ctx_lock to prevent
-	 * other code from messing with the tail
-	 * pointer since we might be called from irq
-	 * context.
-	 */
-	spin_lock_irqsave(&ctx->ctx_lock, flags);
-
-	if (iocb->ki_run_list.prev && !list_empty(&iocb->ki_run_list))
-		list_del_init(&iocb->ki_run_list);
+	/* only an iocb kicked for a retry can still be on the run list */
+	if (iocb->ki_run_list.prev && !list_empty(&iocb->ki_run_list)) {
+		spin_lock_irqsave(&ctx->ctx_lock, flags);
+		if (iocb->ki_run_list.prev && !list_empty(&iocb->ki_run_list))
+			list_del_init(&iocb->ki_run_list);
+		spin_unlock_irqrestore(&ctx->ctx_lock, flags);
+	}
 
 	/*
 	 * cancelled requests don't get events, userland was given one
@@ -945,34 +963,47 @@ int aio_complete(struct kiocb *iocb, long res, long res2)
 	if (kiocbIsCancelled(iocb))
 		goto put_rq;
 
-	ring = kmap_atomic(info->ring_pages[0], KM_IRQ1);
-
-	tail = info->tail;
-	event = aio_ring_event(info, tail, KM_IRQ0);
-	if (++tail >= info->nr)
-		tail = 0;
+	/*
+	 * Add a completion event to the ring buffer without a lock:
+	 * claim a slot, fill it in, then publish it once every slot
+	 * claimed before it has been published, so that the tail only
+	 * ever moves past complete events.  Submission never admits more
+	 * requests than there are free slots.  Interrupts stay off so
+	 * that a completion can't spin on one it interrupted.
+	 */
+	local_irq_save(flags);
+	do {
+		slot = ACCESS_ONCE(info->tail_reserved);
+		tail = slot + 1;
+		if (tail >= info->nr)
+			tail = 0;
+	} while (cmpxchg(&info->tail_reserved, slot, tail) != slot);
 
+	event = aio_ring_event(info, slot, KM_IRQ0);
 	event->obj = (u64)(unsigned long)iocb->ki_obj.user;
 	event->data = iocb->ki_user_data;
 	event->res = res;
 	event->res2 = res2;
+	put_aio_ring_event(event, KM_IRQ0);
 
-	dprintk("aio_complete: %p[%lu]: %p: %p %Lx %lx %lx\n",
-		ctx, tail, iocb, iocb->ki_obj.user, iocb->ki_user_data,
+	dprintk("aio_complete: %p[%u]: %p: %p %Lx %lx %lx\n",
+		ctx, slot, iocb, iocb->ki_obj.user, iocb->ki_user_data,
 		res, res2);
 
-	/* after flagging the request as done, we
-	 * must never even look at it again
-	 */
 	smp_wmb();	/* make event visible before updating tail */
 
-	info->tail = tail;
-	ring->tail = tail;
+	while (ACCESS_ONCE(info->tail) != slot)
+		cpu_relax();
 
-	put_aio_ring_event(event, KM_IRQ0);
+	ring = kmap_atomic(info->ring_pages[0], KM_IRQ1);
+	ring->tail = tail;
 	kunmap_atomic(ring, KM_IRQ1);
+	/* the next slot's owner stores ring->tail after us */
+	smp_wmb();
+	info->tail = tail;
+	local_irq_restore(flags);
 
-	pr_debug("added to ring %p at [%lu]\n", iocb, tail);
+	pr_debug("added to ring %p at [%u]\n", iocb, tail);
 
 	/*
 	 * Check if the user asked us to deliver the result through an
@@ -983,6 +1014,9 @@ int aio_complete(struct kiocb *iocb, long res, long res2)
 		eventfd_signal(iocb->ki_eventfd, 1);
 
 put_rq:
+	/* lets a polling submitter stop spinning */
+	kiocbSetCompleted(iocb);
+
 	/* everything turned out well, dispose of the aiocb. */
 	ret = __aio_put_req(ctx, iocb);
 
@@ -1002,7 +1036,6 @@ put_rq:
 		wake_up(&ctx->poll_wait);
 #endif
 
-	spin_unlock_irqrestore(&ctx->ctx_lock, flags);
 	return ret;
 }
 EXPORT_SYMBOL(aio_complete);
@@ -1012,14 +1045,15 @@ EXPORT_SYMBOL(aio_complete);
  *	events fetched (0 or 1 ;-)
  *	If ent parameter is 0, just returns the number of events that would
  *	be fetched.
- *	FIXME: make this use cmpxchg.
- *	TODO: make the ringbuffer user mmap()able (requires FIXME).
+ *	The ring is shared with userspace, which may be reaping events
+ *	itself: ring->head is only ever trusted modulo the ring size and
+ *	the published tail is taken from the kernel's own copy.
  */
 static int aio_read_evt(struct kioctx *ioctx, struct io_event *ent)
 {
 	struct aio_ring_info *info = &ioctx->ring_info;
 	struct aio_ring *ring;
-	unsigned long head;
+	unsigned long head, tail;
 	int ret = 0;
 
 	ring = kmap_atomic(info->ring_pages[0], KM_USER0);
@@ -1027,13 +1061,15 @@ static int aio_read_evt(struct kioctx *ioctx, struct io_event *ent)
 		 (unsigned long)ring->head, (unsigned long)ring->tail,
 		 (unsigned long)ring->nr);
 
-	if (ring->head == ring->tail)
+	tail = ACCESS_ONCE(info->tail);
+	if (ring->head == tail)
 		goto out;
+	smp_rmb();	/* read the events only after the tail */
 
 	spin_lock(&info->ring_lock);
 
 	head = ring->head % info->nr;
-	if (head != ring->tail) {
+	if (head != tail) {
 		if (ent) { /* event requested */
 			struct io_event *evp =
 				aio_ring_event(info, head, KM_USER1);
@@ -1174,7 +1210,7 @@ retry:
 				break;
 			/* Try to only show up in io wait if there are ops
 			 *  in flight */
-			if (ctx->reqs_active)
+			if (atomic_read(&ctx->reqs_active))
 				io_schedule();
 			else
 				schedule();
@@ -1461,6 +1497,10 @@ static ssize_t aio_rw_vect_retry(struct kiocb *iocb)
 	    && iocb->ki_nbytes - iocb->ki_left)
 		ret = iocb->ki_nbytes - iocb->ki_left;
 
+	/* a partial transfer may have parked us on a page we no longer need */
+	if (ret != -EIOCBRETRY)
+		cancel_page_wait_async(&iocb->ki_wait);
+
 	return ret;
 }
 
@@ -1615,6 +1655,8 @@ static ssize_t aio_setup_iocb(struct kiocb *kiocb)
  * aio_wake_function:
  * 	wait queue callback function for aio notification,
  * 	Simply triggers a retry of the operation via kick_iocb.
+ *	Bit wakeups on the hashed page wait queues are filtered
+ *	against the page and bit the iocb is waiting for.
  *
  * 	This callback is specified in the wait queue entry in
  *	a kiocb.
@@ -1629,18 +1671,61 @@ static ssize_t aio_setup_iocb(struct kiocb *kiocb)
 static int aio_wake_function(wait_queue_t *wait, unsigned mode,
 			     int sync, void *key)
 {
-	struct kiocb *iocb = container_of(wait, struct kiocb, ki_wait);
+	struct kiocb *iocb = container_of(wait, struct kiocb, ki_wait.wait);
+	struct wait_bit_key *bit_key = key;
+
+	if (bit_key && (iocb->ki_wait.key.flags != bit_key->flags ||
+			iocb->ki_wait.key.bit_nr != bit_key->bit_nr))
+		return 0;
 
 	list_del_init(&wait->task_list);
 	kick_iocb(iocb);
 	return 1;
 }
 
+/*
+ * IOCB_FLAG_POLL: spin in io_submit until the request completes, so that
+ * its event is in the ring when we return and userspace can reap it
+ * without sleeping or being woken up.  How long completions take is
+ * learnt per context; once that exceeds aio_poll_usecs the device is
+ * too slow to be worth it and we only spin again after the estimate
+ * has decayed.
+ */
+static void aio_poll_completion(struct kioctx *ctx, struct kiocb *req,
+				ktime_t start)
+{
+	unsigned long max = aio_poll_usecs * NSEC_PER_USEC;
+	unsigned long est = ctx->poll_ns;
+	unsigned long elapsed;
+
+	if (!max)
+		return;
+	if (est > max) {
+		ctx->poll_ns = est - (est >> 3);
+		return;
+	}
+
+	for (;;) {
+		elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+		if (kiocbIsCompleted(req))
+			break;
+		if (elapsed > max || need_resched() ||
+		    signal_pending(current)) {
+			elapsed = 2 * max;
+			break;
+		}
+		cpu_relax();
+	}
+
+	ctx->poll_ns = est ? est - (est >> 3) + (elapsed >> 3) : elapsed;
+}
+
 static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 			 struct iocb *iocb)
 {
 	struct kiocb *req;
 	struct file *file;
+	ktime_t start = ktime_set(0, 0);
 	ssize_t ret;
 
 	/* enforce forwards compatibility on users */
@@ -1697,14 +1782,18 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	req->ki_buf = (char __user *)(unsigned long)iocb->aio_buf;
 	req->ki_left = req->ki_nbytes = iocb->aio_nbytes;
 	req->ki_opcode = iocb->aio_lio_opcode;
-	init_waitqueue_func_entry(&req->ki_wait, aio_wake_function);
-	INIT_LIST_HEAD(&req->ki_wait.task_list);
+	init_waitqueue_func_entry(&req->ki_wait.wait, aio_wake_function);
+	INIT_LIST_HEAD(&req->ki_wait.wait.task_list);
+	req->ki_wait.key.flags = NULL;
 
 	ret = aio_setup_iocb(req);
 
 	if (ret)
 		goto out_put_req;
 
+	if (iocb->aio_flags & IOCB_FLAG_POLL)
+		start = ktime_get();
+
 	spin_lock_irq(&ctx->ctx_lock);
 	aio_run_iocb(req);
 	if (!list_empty(&ctx->run_list)) {
@@ -1713,6 +1802,10 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 			;
 	}
 	spin_unlock_irq(&ctx->ctx_lock);
+
+	if (iocb->aio_flags & IOCB_FLAG_POLL)
+		aio_poll_completion(ctx, req, start);
+
 	aio_put_req(req);	/* drop extra ref to req */
 	return 0;
 
@@ -1783,15 +1876,15 @@ SYSCALL_DEFINE3(io_submit, aio_context_t, ctx_id, long, nr,
 /* lookup_kiocb
  *	Finds a given iocb for cancellation.
  */
-static struct kiocb *lookup_kiocb(struct kioctx *ctx, struct iocb __user *iocb,
-				  u32 key)
+static struct kiocb *lookup_kiocb(struct aio_active_reqs *reqs,
+				  struct iocb __user *iocb, u32 key)
 {
 	struct list_head *pos;
 
-	assert_spin_locked(&ctx->ctx_lock);
+	assert_spin_locked(&reqs->lock);
 
 	/* TODO: use a hash or array, this sucks. */
-	list_for_each(pos, &ctx->active_reqs) {
+	list_for_each(pos, &reqs->list) {
 		struct kiocb *kiocb = list_kiocb(pos);
 		if (kiocb->ki_obj.user == iocb && kiocb->ki_key == key)
 			return kiocb;
@@ -1817,6 +1910,7 @@ SYSCALL_DEFINE3(io_cancel, aio_context_t, ctx_id, struct iocb __user *, iocb,
 	struct kiocb *kiocb;
 	u32 key;
 	int ret;
+	int cpu;
 
 	ret = get_user(key, &iocb->aio_key);
 	if (unlikely(ret))
@@ -1826,16 +1920,21 @@ SYSCALL_DEFINE3(io_cancel, aio_context_t, ctx_id, struct iocb __user *, iocb,
 	if (unlikely(!ctx))
 		return -EINVAL;
 
-	spin_lock_irq(&ctx->ctx_lock);
-	ret = -EAGAIN;
-	kiocb = lookup_kiocb(ctx, iocb, key);
-	if (kiocb && kiocb->ki_cancel) {
-		cancel = kiocb->ki_cancel;
-		kiocb->ki_users ++;
-		kiocbSetCancelled(kiocb);
-	} else
-		cancel = NULL;
-	spin_unlock_irq(&ctx->ctx_lock);
+	cancel = NULL;
+	for_each_possible_cpu(cpu) {
+		struct aio_active_reqs *reqs = per_cpu_ptr(ctx->active_reqs, cpu);
+
+		spin_lock_irq(&reqs->lock);
+		kiocb = lookup_kiocb(reqs, iocb, key);
+		if (kiocb && kiocb->ki_cancel &&
+		    atomic_inc_not_zero(&kiocb->ki_users)) {
+			cancel = kiocb->ki_cancel;
+			kiocbSetCancelled(kiocb);
+		}
+		spin_unlock_irq(&reqs->lock);
+		if (kiocb)
+			break;
+	}
 
 	if (NULL != cancel) {
 		struct io_event tmp;
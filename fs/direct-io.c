@@ -125,6 +125,7 @@ struct dio {
 	unsigned long refcount;		/* direct_io_worker() and bios */
 	struct bio *bio_list;		/* singly linked via bi_private */
 	struct task_struct *waiter;	/* waiting task (NULL if none) */
+	struct request_queue *poll_queue; /* spin on it before sleeping */
 
 	/* AIO related stuff */
 	struct kiocb *iocb;		/* kiocb */
@@ -355,6 +356,14 @@ static void dio_cleanup(struct dio *dio)
 		page_cache_release(dio_get_page(dio));
 }
 
+/* blk_poll() stops once a BIO has completed or none is left in flight */
+static int dio_bio_ready(void *data)
+{
+	struct dio *dio = data;
+
+	return dio->refcount == 1 || dio->bio_list != NULL;
+}
+
 /*
  * Wait for the next BIO to complete.  Remove it and return it.  NULL is
  * returned once all BIOs have been completed.  This must only be called once
@@ -366,6 +375,14 @@ static struct bio *dio_await_one(struct dio *dio)
 	unsigned long flags;
 	struct bio *bio = NULL;
 
+	/*
+	 * On devices that complete within a few microseconds, reap our bio
+	 * from the driver instead of waiting for its interrupt.  This is
+	 * only a hint, the condition is checked again below under the lock.
+	 */
+	if (dio->poll_queue && !dio_bio_ready(dio))
+		blk_poll(dio->poll_queue, dio_bio_ready, dio);
+
 	spin_lock_irqsave(&dio->bio_lock, flags);
 
 	/*
@@ -940,6 +957,7 @@ direct_io_worker(int rw, struct kiocb *iocb, struct inode *inode,
 	ssize_t ret = 0;
 	ssize_t ret2;
 	size_t bytes;
+	struct blk_plug plug;
 
 	dio->inode = inode;
 	dio->rw = rw;
@@ -972,6 +990,8 @@ direct_io_worker(int rw, struct kiocb *iocb, struct inode *inode,
 				- user_addr/PAGE_SIZE);
 	}
 
+	blk_start_plug(&plug);
+
 	for (seg = 0; seg < nr_segs; seg++) {
 		user_addr = (unsigned long)iov[seg].iov_base;
 		dio->size += bytes = iov[seg].iov_len;
@@ -1029,6 +1049,7 @@ direct_io_worker(int rw, struct kiocb *iocb, struct inode *inode,
 		dio_bio_submit(dio);
 
 	/* All IO is now issued, send it on its way */
+	blk_finish_plug(&plug);
 	blk_run_address_space(inode->i_mapping);
 
 	/*
@@ -1203,6 +1224,8 @@ __blockdev_direct_IO(int rw, struct kiocb *iocb, struct inode *inode,
 	 */
 	dio->is_async = !is_sync_kiocb(iocb) && !((rw & WRITE) &&
 		(end > i_size_read(inode)));
+	if (bdev && !dio->is_async)
+		dio->poll_queue = bdev_get_queue(bdev);
 
 	retval = direct_io_worker(rw, iocb, inode, iov, offset,
 				nr_segs, blkbits, get_block, end_io, dio);
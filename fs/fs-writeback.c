@@ -722,14 +722,23 @@ void writeback_inodes_wbc(struct writeback_control *wbc)
  */
 #define MAX_WRITEBACK_PAGES     1024
 
-static inline bool over_bground_thresh(void)
+static inline bool over_bground_thresh(struct backing_dev_info *bdi)
 {
 	unsigned long background_thresh, dirty_thresh;
 
 	get_dirty_limits(&background_thresh, &dirty_thresh, NULL, NULL);
 
-	return (global_page_state(NR_FILE_DIRTY) +
-		global_page_state(NR_UNSTABLE_NFS) >= background_thresh);
+	if (global_page_state(NR_FILE_DIRTY) +
+	    global_page_state(NR_UNSTABLE_NFS) >= background_thresh)
+		return true;
+
+	/*
+	 * Dirtiers are throttled against their bdi's share of the dirty
+	 * limit and no longer write anything themselves, so keep going
+	 * while this bdi is over its share of the background threshold.
+	 */
+	return bdi_stat(bdi, BDI_RECLAIMABLE) >
+				bdi_dirty_limit(bdi, background_thresh);
 }
 
 /*
@@ -758,6 +767,7 @@ static long wb_writeback(struct bdi_writeback *wb,
 		.for_kupdate		= args->for_kupdate,
 		.range_cyclic		= args->range_cyclic,
 	};
+	unsigned long wb_start = jiffies;
 	unsigned long oldest_jif;
 	long wrote = 0;
 	struct inode *inode;
@@ -783,7 +793,7 @@ static long wb_writeback(struct bdi_writeback *wb,
 		 * For background writeout, stop when we are below the
 		 * background dirty threshold
 		 */
-		if (args->for_background && !over_bground_thresh())
+		if (args->for_background && !over_bground_thresh(wb->bdi))
 			break;
 
 		wbc.more_io = 0;
@@ -791,6 +801,7 @@ static long wb_writeback(struct bdi_writeback *wb,
 		wbc.nr_to_write = MAX_WRITEBACK_PAGES;
 		wbc.pages_skipped = 0;
 		writeback_inodes_wb(wb, &wbc);
+		bdi_update_bandwidth(wb->bdi, 0, 0, 0, 0, 0, wb_start);
 		args->nr_pages -= MAX_WRITEBACK_PAGES - wbc.nr_to_write;
 		wrote += MAX_WRITEBACK_PAGES - wbc.nr_to_write;
 
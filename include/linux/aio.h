@@ -34,6 +34,7 @@ struct kioctx;
 /* #define KIF_LOCKED		0 */
 #define KIF_KICKED		1
 #define KIF_CANCELLED		2
+#define KIF_COMPLETED		3
 
 #define kiocbTryLock(iocb)	test_and_set_bit(KIF_LOCKED, &(iocb)->ki_flags)
 #define kiocbTryKick(iocb)	test_and_set_bit(KIF_KICKED, &(iocb)->ki_flags)
@@ -41,6 +42,7 @@ struct kioctx;
 #define kiocbSetLocked(iocb)	set_bit(KIF_LOCKED, &(iocb)->ki_flags)
 #define kiocbSetKicked(iocb)	set_bit(KIF_KICKED, &(iocb)->ki_flags)
 #define kiocbSetCancelled(iocb)	set_bit(KIF_CANCELLED, &(iocb)->ki_flags)
+#define kiocbSetCompleted(iocb)	set_bit(KIF_COMPLETED, &(iocb)->ki_flags)
 
 #define kiocbClearLocked(iocb)	clear_bit(KIF_LOCKED, &(iocb)->ki_flags)
 #define kiocbClearKicked(iocb)	clear_bit(KIF_KICKED, &(iocb)->ki_flags)
@@ -49,6 +51,7 @@ struct kioctx;
 #define kiocbIsLocked(iocb)	test_bit(KIF_LOCKED, &(iocb)->ki_flags)
 #define kiocbIsKicked(iocb)	test_bit(KIF_KICKED, &(iocb)->ki_flags)
 #define kiocbIsCancelled(iocb)	test_bit(KIF_CANCELLED, &(iocb)->ki_flags)
+#define kiocbIsCompleted(iocb)	test_bit(KIF_COMPLETED, &(iocb)->ki_flags)
 
 /* is there a better place to document function pointer methods? */
 /**
@@ -78,7 +81,8 @@ struct kioctx;
  * If ki_retry returns -EIOCBRETRY it has made a promise that kick_iocb()
  * will be called on the kiocb pointer in the future.  This may happen
  * through generic helpers that associate kiocb->ki_wait with a wait
- * queue head that ki_retry uses via current->io_wait.  It can also happen
+ * queue head, such as wait_on_page_bit_async() used by buffered reads
+ * and writes (see kiocb_async_wait()).  It can also happen
  * with custom tracking and manual calls to kick_iocb(), though that is
  * discouraged.  In either case, kick_iocb() must be called once and only
  * once.  ki_retry must ensure forward progress, the AIO core will wait
@@ -87,8 +91,9 @@ struct kioctx;
 struct kiocb {
 	struct list_head	ki_run_list;
 	unsigned long		ki_flags;
-	int			ki_users;
+	atomic_t		ki_users;
 	unsigned		ki_key;		/* id of this request */
+	int			ki_cpu;		/* whose active_reqs we are on */
 
 	struct file		*ki_filp;
 	struct kioctx		*ki_ctx;	/* may be NULL for sync ops */
@@ -102,7 +107,7 @@ struct kiocb {
 	} ki_obj;
 
 	__u64			ki_user_data;	/* user's data for completion */
-	wait_queue_t		ki_wait;
+	struct wait_bit_queue	ki_wait;
 	loff_t			ki_pos;
 
 	void			*private;
@@ -131,7 +136,7 @@ struct kiocb {
 	do {						\
 		struct task_struct *tsk = current;	\
 		(x)->ki_flags = 0;			\
-		(x)->ki_users = 1;			\
+		atomic_set(&(x)->ki_users, 1);		\
 		(x)->ki_key = KIOCB_SYNC_KEY;		\
 		(x)->ki_filp = (filp);			\
 		(x)->ki_ctx = NULL;			\
@@ -140,11 +145,16 @@ struct kiocb {
 		(x)->ki_dtor = NULL;			\
 		(x)->ki_obj.tsk = tsk;			\
 		(x)->ki_user_data = 0;                  \
-		init_wait((&(x)->ki_wait));             \
+		init_wait((&(x)->ki_wait.wait));        \
 	} while (0)
 
+/*
+ * The ring is mapped into the owner's address space; the layout and the
+ * rules for reaping events from userspace are described in
+ * Documentation/filesystems/aio-ring.txt and must not change.
+ */
 #define AIO_RING_MAGIC			0xa10a10a1
-#define AIO_RING_COMPAT_FEATURES	1
+#define AIO_RING_COMPAT_FEATURES	(1 | AIO_RING_F_USER_REAP)
 #define AIO_RING_INCOMPAT_FEATURES	0
 struct aio_ring {
 	unsigned	id;	/* kernel internal index number */
@@ -161,7 +171,7 @@ struct aio_ring {
 	struct io_event		io_events[0];
 }; /* 128 bytes + ring size */
 
-#define aio_ring_avail(info, ring)	(((ring)->head + (info)->nr - 1 - (ring)->tail) % (info)->nr)
+#define aio_ring_avail(info, ring)	(((ring)->head + (info)->nr - 1 - (info)->tail) % (info)->nr)
 
 #define AIO_RING_PAGES	8
 struct aio_ring_info {
@@ -173,10 +183,17 @@ struct aio_ring_info {
 	long			nr_pages;
 
 	unsigned		nr, tail;
+	unsigned		tail_reserved;	/* next slot to hand out */
 
 	struct page		*internal_pages[AIO_RING_PAGES];
 };
 
+/* requests in flight, per submitting cpu, for cancellation */
+struct aio_active_reqs {
+	spinlock_t		lock;
+	struct list_head	list;
+};
+
 struct kioctx {
 	atomic_t		users;
 	int			dead;
@@ -190,10 +207,12 @@ struct kioctx {
 
 	spinlock_t		ctx_lock;
 
-	int			reqs_active;
-	struct list_head	active_reqs;	/* used for cancellation */
+	atomic_t		reqs_active;
+	struct aio_active_reqs	*active_reqs;	/* per cpu */
 	struct list_head	run_list;	/* used for kicked reqs */
 
+	unsigned long		poll_ns;	/* IOCB_FLAG_POLL estimate */
+
 	/* sys_io_setup currently limits this to an unsigned int */
 	unsigned		max_reqs;
 
@@ -229,7 +248,16 @@ struct mm_struct;
 static inline void exit_aio(struct mm_struct *mm) { }
 #endif /* CONFIG_AIO */
 
-#define io_wait_to_kiocb(wait) container_of(wait, struct kiocb, ki_wait)
+#define io_wait_to_kiocb(wait) container_of(wait, struct kiocb, ki_wait.wait)
+
+/*
+ * Wait entry a retried operation parks on instead of sleeping, or NULL
+ * if the caller must block: synchronous kiocbs have no one to retry them.
+ */
+static inline struct wait_bit_queue *kiocb_async_wait(struct kiocb *iocb)
+{
+	return is_sync_kiocb(iocb) ? NULL : &iocb->ki_wait;
+}
 
 static inline struct kiocb *list_kiocb(struct list_head *h)
 {
@@ -239,5 +267,6 @@ static inline struct kiocb *list_kiocb(struct list_head *h)
 /* for sysctl: */
 extern unsigned long aio_nr;
 extern unsigned long aio_max_nr;
+extern unsigned long aio_poll_usecs;
 
 #endif /* __LINUX__AIO_H */
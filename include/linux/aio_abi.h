@@ -51,8 +51,20 @@ enum {
  *
  * IOCB_FLAG_RESFD - Set if the "aio_resfd" member of the "struct iocb"
  *                   is valid.
+ * IOCB_FLAG_POLL  - io_submit spins briefly for the completion, so it can
+ *                   be reaped from the ring on return.  Only worth it for
+ *                   devices completing within fs.aio-poll-usecs.
  */
 #define IOCB_FLAG_RESFD		(1 << 0)
+#define IOCB_FLAG_POLL		(1 << 1)
+
+/*
+ * Bits in the compat_features word of the completion ring header, see
+ * Documentation/filesystems/aio-ring.txt.
+ *
+ * AIO_RING_F_USER_REAP - userspace may consume events by advancing head.
+ */
+#define AIO_RING_F_USER_REAP	(1 << 1)
 
 /* read() from /dev/aio returns these structures. */
 struct io_event {
@@ -176,7 +176,6 @@ extern struct cred init_cred;
 		[PIDTYPE_PGID] = INIT_PID_LINK(PIDTYPE_PGID),		\
 		[PIDTYPE_SID]  = INIT_PID_LINK(PIDTYPE_SID),		\
 	},								\
-	.dirties = INIT_PROP_LOCAL_SINGLE(dirties),			\
 	INIT_UTRACE(tsk)						\
 	INIT_IDS							\
 	INIT_PERF_EVENTS(tsk)						\
@@ -1222,7 +1222,6 @@ extern int filemap_fault(struct vm_area_struct *, struct vm_fault *);
 
 /* mm/page-writeback.c */
 int write_one_page(struct page *page, int wait);
-void task_dirty_inc(struct task_struct *tsk);
 
 /* readahead.c */
 #ifndef CONFIG_KERNEL_DESKTOP
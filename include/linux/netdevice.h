@@ -42,6 +42,7 @@
 #include <linux/rculist.h>
 #include <linux/dmaengine.h>
 #include <linux/workqueue.h>
+#include <linux/dynamic_queue_limits.h>
 
 #include <linux/ethtool.h>
 #include <net/net_namespace.h>
@@ -457,10 +458,16 @@ static inline void napi_synchronize(const struct napi_struct *n)
 # define napi_synchronize(n)	barrier()
 #endif
 
+/*
+ * __QUEUE_STATE_XOFF is set and cleared by the driver when its ring is
+ * full; __QUEUE_STATE_STACK_XOFF is owned by the stack (byte queue
+ * limits).  The queue may only be fed while neither is set.
+ */
 enum netdev_queue_state_t
 {
 	__QUEUE_STATE_XOFF,
 	__QUEUE_STATE_FROZEN,
+	__QUEUE_STATE_STACK_XOFF,
 };
 
 struct netdev_queue {
@@ -483,8 +490,40 @@ struct netdev_queue {
 	unsigned long		tx_bytes;
 	unsigned long		tx_packets;
 	unsigned long		tx_dropped;
+#ifdef CONFIG_SYSFS
+	struct kobject		kobj;
+#endif
+#ifdef CONFIG_BQL
+	/*
+	 * byte queue limits, touched by both the xmit and completion paths
+	 */
+	struct dql		dql;
+#endif
 } ____cacheline_aligned_in_smp;
 
+#ifdef CONFIG_XPS
+/*
+ * Transmit packet steering: for every CPU, the list of TX queues that
+ * packets sent from it may use.  Maps are replaced under RCU.
+ */
+struct xps_map {
+	unsigned int		len;
+	unsigned int		alloc_len;
+	struct rcu_head		rcu;
+	u16			queues[0];
+};
+#define XPS_MAP_SIZE(_num) (sizeof(struct xps_map) + ((_num) * sizeof(u16)))
+#define XPS_MIN_MAP_ALLOC ((L1_CACHE_BYTES - sizeof(struct xps_map))	\
+			   / sizeof(u16))
+
+struct xps_dev_maps {
+	struct rcu_head		rcu;
+	struct xps_map		*cpu_map[0];
+};
+#define XPS_DEV_MAPS_SIZE (sizeof(struct xps_dev_maps) +		\
+			   (nr_cpu_ids * sizeof(struct xps_map *)))
+#endif /* CONFIG_XPS */
+
 
 /*
  * This structure defines the management hooks for network devices.
@@ -722,6 +761,8 @@ struct net_device
 #define NETIF_F_TSO_ECN		(SKB_GSO_TCP_ECN << NETIF_F_GSO_SHIFT)
 #define NETIF_F_TSO6		(SKB_GSO_TCPV6 << NETIF_F_GSO_SHIFT)
 #define NETIF_F_FSO		(SKB_GSO_FCOE << NETIF_F_GSO_SHIFT)
+#define NETIF_F_GSO_GRE		(SKB_GSO_GRE << NETIF_F_GSO_SHIFT)
+#define NETIF_F_GSO_UDP_TUNNEL	(SKB_GSO_UDP_TUNNEL << NETIF_F_GSO_SHIFT)
 
 	/* List of features with software fallbacks. */
 #define NETIF_F_GSO_SOFTWARE	(NETIF_F_TSO | NETIF_F_TSO_ECN | NETIF_F_TSO6)
@@ -836,6 +877,15 @@ struct net_device
 	/* Number of TX queues currently active in device  */
 	unsigned int		real_num_tx_queues;
 
+#ifdef CONFIG_XPS
+	/* CPU to TX queue maps */
+	struct xps_dev_maps	*xps_maps;
+#endif
+#ifdef CONFIG_SYSFS
+	/* sysfs kset of the TX queues */
+	struct kset		*queues_kset;
+#endif
+
 	/* root qdisc from userspace point of view */
 	struct Qdisc		*qdisc;
 
@@ -1050,6 +1100,9 @@ struct napi_gro_cb {
 
 	/* Free the skb? */
 	int free;
+
+	/* Set once a tunnel header has been parsed, to refuse nesting. */
+	int encap_mark;
 };
 
 #define NAPI_GRO_CB(skb) ((struct napi_gro_cb *)(skb)->cb)
@@ -1066,7 +1119,8 @@ struct packet_type {
 	int			(*gso_send_check)(struct sk_buff *skb);
 	struct sk_buff		**(*gro_receive)(struct sk_buff **head,
 					       struct sk_buff *skb);
-	int			(*gro_complete)(struct sk_buff *skb);
+	int			(*gro_complete)(struct sk_buff *skb,
+						int nhoff);
 	void			*af_packet_priv;
 	struct list_head	list;
 };
@@ -1138,6 +1192,8 @@ extern int		netpoll_trap(void);
 extern int	       skb_gro_receive(struct sk_buff **head,
 				       struct sk_buff *skb);
 extern void	       skb_gro_reset_offset(struct sk_buff *skb);
+extern struct packet_type *gro_find_receive_by_type(__be16 type);
+extern struct packet_type *gro_find_complete_by_type(__be16 type);
 
 static inline unsigned int skb_gro_offset(const struct sk_buff *skb)
 {
@@ -1175,7 +1231,7 @@ static inline void *skb_gro_header_slow(struct sk_buff *skb, unsigned int hlen,
 
 static inline void *skb_gro_mac_header(struct sk_buff *skb)
 {
-	return NAPI_GRO_CB(skb)->frag0 ?: skb_mac_header(skb);
+	return skb_mac_header(skb);
 }
 
 static inline void *skb_gro_network_header(struct sk_buff *skb)
@@ -1232,9 +1288,23 @@ DECLARE_PER_CPU(struct softnet_data,softnet_data);
 
 extern void __netif_schedule(struct Qdisc *q);
 
+static inline int netif_xmit_stopped(const struct netdev_queue *dev_queue)
+{
+	return dev_queue->state & ((1 << __QUEUE_STATE_XOFF) |
+				   (1 << __QUEUE_STATE_STACK_XOFF));
+}
+
+static inline int
+netif_xmit_frozen_or_stopped(const struct netdev_queue *dev_queue)
+{
+	return dev_queue->state & ((1 << __QUEUE_STATE_XOFF) |
+				   (1 << __QUEUE_STATE_STACK_XOFF) |
+				   (1 << __QUEUE_STATE_FROZEN));
+}
+
 static inline void netif_schedule_queue(struct netdev_queue *txq)
 {
-	if (!test_bit(__QUEUE_STATE_XOFF, &txq->state))
+	if (!netif_xmit_stopped(txq))
 		__netif_schedule(txq->qdisc);
 }
 
@@ -1354,6 +1424,105 @@ static inline int netif_tx_queue_frozen(const struct netdev_queue *dev_queue)
 	return test_bit(__QUEUE_STATE_FROZEN, &dev_queue->state);
 }
 
+/**
+ *	netdev_tx_sent_queue - account bytes handed to the hardware
+ *	@dev_queue: transmit queue
+ *	@bytes: number of bytes just posted to the ring
+ *
+ *	Called by the driver's start_xmit once the frame is on the ring.
+ *	Stops the queue on behalf of the stack when the byte queue limit
+ *	is exceeded; netdev_tx_completed_queue() restarts it.
+ */
+static inline void netdev_tx_sent_queue(struct netdev_queue *dev_queue,
+					unsigned int bytes)
+{
+#ifdef CONFIG_BQL
+	dql_queued(&dev_queue->dql, bytes);
+
+	if (likely(dql_avail(&dev_queue->dql) >= 0))
+		return;
+
+	set_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state);
+
+	/*
+	 * The XOFF flag must be set before checking the dql_avail below,
+	 * because in netdev_tx_completed_queue we update the dql_completed
+	 * before checking the XOFF flag.
+	 */
+	smp_mb();
+
+	/* check again in case another CPU has just made room avail */
+	if (unlikely(dql_avail(&dev_queue->dql) >= 0))
+		clear_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state);
+#endif
+}
+
+static inline void netdev_sent_queue(struct net_device *dev, unsigned int bytes)
+{
+	netdev_tx_sent_queue(netdev_get_tx_queue(dev, 0), bytes);
+}
+
+/**
+ *	netdev_tx_completed_queue - account bytes reclaimed from the hardware
+ *	@dev_queue: transmit queue
+ *	@pkts: number of packets completed
+ *	@bytes: number of bytes completed
+ *
+ *	Called by the driver's TX completion handler, once per cleaning
+ *	pass, with the totals of what netdev_tx_sent_queue() was told.
+ */
+static inline void netdev_tx_completed_queue(struct netdev_queue *dev_queue,
+					     unsigned int pkts,
+					     unsigned int bytes)
+{
+#ifdef CONFIG_BQL
+	if (unlikely(!bytes))
+		return;
+
+	dql_completed(&dev_queue->dql, bytes);
+
+	/*
+	 * Without the memory barrier there is a small possiblity that
+	 * netdev_tx_sent_queue will miss the update and cause the queue to
+	 * be stopped forever
+	 */
+	smp_mb();
+
+	if (dql_avail(&dev_queue->dql) < 0)
+		return;
+
+	if (test_and_clear_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state))
+		netif_schedule_queue(dev_queue);
+#endif
+}
+
+static inline void netdev_completed_queue(struct net_device *dev,
+					  unsigned int pkts,
+					  unsigned int bytes)
+{
+	netdev_tx_completed_queue(netdev_get_tx_queue(dev, 0), pkts, bytes);
+}
+
+/**
+ *	netdev_tx_reset_queue - forget bytes in flight
+ *	@dev_queue: transmit queue
+ *
+ *	Called when the driver drops everything on its ring (ring reset,
+ *	interface down) so that the accounting starts again from zero.
+ */
+static inline void netdev_tx_reset_queue(struct netdev_queue *dev_queue)
+{
+#ifdef CONFIG_BQL
+	clear_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state);
+	dql_reset(&dev_queue->dql);
+#endif
+}
+
+static inline void netdev_reset_queue(struct net_device *dev)
+{
+	netdev_tx_reset_queue(netdev_get_tx_queue(dev, 0));
+}
+
 /**
  *	netif_running - test if up
  *	@dev: network device
@@ -1505,7 +1674,8 @@ extern int		dev_set_mac_address(struct net_device *,
 					    struct sockaddr *);
 extern int		dev_hard_start_xmit(struct sk_buff *skb,
 					    struct net_device *dev,
-					    struct netdev_queue *txq);
+					    struct netdev_queue *txq,
+					    bool more);
 
 extern int		netdev_budget;
 
@@ -1890,6 +2060,12 @@ extern int		weight_p;
 extern int		netdev_set_master(struct net_device *dev, struct net_device *master);
 extern int skb_checksum_help(struct sk_buff *skb);
 extern struct sk_buff *skb_gso_segment(struct sk_buff *skb, int features);
+extern struct sk_buff *skb_tunnel_gso_segment(struct sk_buff *skb,
+					      int features,
+					      unsigned int tnl_hlen,
+					      unsigned int inner_mac_len,
+					      __be16 inner_protocol,
+					      int gso_type);
 #ifdef CONFIG_BUG
 extern void netdev_rx_csum_fault(struct net_device *dev);
 #else
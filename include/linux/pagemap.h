@@ -356,6 +356,22 @@ static inline void lock_page_nosync(struct page *page)
 extern void wait_on_page_bit(struct page *page, int bit_nr);
 extern void __wait_on_page_locked(struct page *page);
 
+/*
+ * Asynchronous waits, for AIO retries: instead of sleeping, @wait is
+ * hooked on the page's wait queue and -EIOCBRETRY returned.
+ */
+extern int wait_on_page_bit_async(struct page *page, int bit_nr,
+				  struct wait_bit_queue *wait);
+extern void cancel_page_wait_async(struct wait_bit_queue *wait);
+
+static inline int wait_on_page_locked_async(struct page *page,
+					    struct wait_bit_queue *wait)
+{
+	if (PageLocked(page))
+		return wait_on_page_bit_async(page, PG_locked, wait);
+	return 0;
+}
+
 /* 
  * Wait for a page to be unlocked.
  *
@@ -243,6 +243,12 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	/* The payload is carried in a GRE tunnel (no checksum/sequence). */
+	SKB_GSO_GRE = 1 << 6,
+
+	/* The payload is carried in a UDP encapsulation such as VXLAN. */
+	SKB_GSO_UDP_TUNNEL = 1 << 7,
 };
 
 #if BITS_PER_LONG > 32
@@ -306,6 +312,10 @@ typedef unsigned char *sk_buff_data_t;
  *	@tc_index: Traffic control index
  *	@tc_verd: traffic control verdict
  *	@ndisc_nodetype: router type (from link layer)
+ *	@head_frag: head was allocated with netdev_alloc_frag()
+ *	@ooo_okay: allow the mapping of a socket to a queue to be changed
+ *	@xmit_more: more packets for the same TX queue follow this one, the
+ *		driver may defer notifying the hardware
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
  *	@secmark: security marking
@@ -384,6 +394,9 @@ struct sk_buff {
 #ifdef	CONFIG_NETVM
 	__u8			emergency:1;
 #endif
+	__u8			head_frag:1;
+	__u8			ooo_okay:1;
+	__u8			xmit_more:1;
 #ifdef CONFIG_XEN
 	__u8			proto_data_valid:1,
 				proto_csum_blank:1;
@@ -476,6 +489,10 @@ static inline struct sk_buff *alloc_skb_fclone(unsigned int size,
 }
 
 extern int skb_recycle_check(struct sk_buff *skb, int skb_size);
+extern void dev_kfree_skb_recycle(struct sk_buff *skb);
+extern struct sk_buff *build_skb(void *data, unsigned int frag_size);
+extern void *netdev_alloc_frag(unsigned int fragsz);
+extern int sysctl_skb_recycle_max;
 
 extern struct sk_buff *skb_morph(struct sk_buff *dst, struct sk_buff *src);
 extern struct sk_buff *skb_clone(struct sk_buff *skb,
@@ -2076,6 +2093,7 @@ static inline bool skb_rx_queue_recorded(const struct sk_buff *skb)
 
 extern u16 skb_tx_hash(const struct net_device *dev,
 		       const struct sk_buff *skb);
+extern u32 skb_flow_hash(const struct sk_buff *skb);
 
 #ifdef CONFIG_XFRM
 static inline struct sec_path *skb_sec_path(struct sk_buff *skb)
@@ -8,6 +8,7 @@
 #include <linux/memcontrol.h>
 #include <linux/sched.h>
 #include <linux/node.h>
+#include <linux/workqueue.h>
 
 #include <asm/atomic.h>
 #include <asm/page.h>
@@ -143,7 +144,6 @@ enum {
 	SWP_USED	= (1 << 0),	/* is slot in swap_info[] used? */
 	SWP_WRITEOK	= (1 << 1),	/* ok to write to this swap?	*/
 	SWP_DISCARDABLE = (1 << 2),	/* blkdev supports discard */
-	SWP_DISCARDING	= (1 << 3),	/* now discarding a free cluster */
 	SWP_SOLIDSTATE	= (1 << 4),	/* blkdev seeks are cheap */
 	SWP_FILE	= (1 << 5),	/* file swap area */
 					/* add others here before... */
@@ -156,8 +156,39 @@ enum {
 #define SWAP_MAP_BAD	0x7fff
 #define SWAP_HAS_CACHE  0x8000		/* There is a swap cache of entry. */
 #define SWAP_COUNT_MASK (~SWAP_HAS_CACHE)
+
+/*
+ * Solid state swap areas are allocated in clusters of SWAPFILE_CLUSTER
+ * slots.  A cluster_info entry counts the slots in use in its cluster;
+ * while the cluster is on the free or the discard list, it holds the
+ * index of the next cluster on that list instead.
+ */
+struct swap_cluster_info {
+	unsigned int data:24;
+	unsigned int flags:8;
+};
+#define CLUSTER_FLAG_FREE	1	/* this cluster is free */
+#define CLUSTER_FLAG_NEXT_NULL	2	/* this cluster has no next cluster */
+
+/* A list of clusters; head and tail have CLUSTER_FLAG_NEXT_NULL if empty */
+struct swap_cluster_list {
+	struct swap_cluster_info head;
+	struct swap_cluster_info tail;
+};
+
 /*
- * The in-memory structure used to track swap areas.
+ * Each CPU allocates from its own cluster, so that parallel swapout
+ * writes sequential runs rather than interleaving slots.
+ */
+struct percpu_cluster {
+	struct swap_cluster_info index;	/* current cluster index */
+	unsigned int next;		/* likely next allocation offset */
+};
+
+/*
+ * The in-memory structure used to track swap areas.  swap_lock protects
+ * the swap list and the SWP_USED and SWP_WRITEOK flags; everything
+ * about the slots of the area is protected by its own lock.
  */
 struct swap_info_struct {
 	unsigned long flags;
@@ -168,10 +199,14 @@ struct swap_info_struct {
 	struct list_head extent_list;
 	struct swap_extent *curr_swap_extent;
 	unsigned short *swap_map;
+	struct swap_cluster_info *cluster_info;	/* NULL unless solid state */
+	struct swap_cluster_list free_clusters;
+	struct swap_cluster_list discard_clusters; /* freed, to be discarded */
+	struct percpu_cluster *percpu_cluster;
+	struct work_struct discard_work; /* discards freed clusters */
+	spinlock_t lock;		/* protects swap_map and below */
 	unsigned int lowest_bit;
 	unsigned int highest_bit;
-	unsigned int lowest_alloc;	/* while preparing discard cluster */
-	unsigned int highest_alloc;	/* while preparing discard cluster */
 	unsigned int cluster_next;
 	unsigned int cluster_nr;
 	unsigned int pages;
@@ -237,7 +272,7 @@ struct swap_list_t {
 };
 
 /* Swap 50% full? Release swapcache more aggressively.. */
-#define vm_swap_full() (nr_swap_pages*2 < total_swap_pages)
+#define vm_swap_full() (get_nr_swap_pages()*2 < total_swap_pages)
 
 /* linux/mm/page_alloc.c */
 extern unsigned long totalram_pages;
@@ -363,8 +398,14 @@ extern struct page *swapin_readahead(swp_entry_t, gfp_t,
 			struct vm_area_struct *vma, unsigned long addr);
 
 /* linux/mm/swapfile.c */
-extern long nr_swap_pages;
+extern atomic_long_t nr_swap_pages;
 extern long total_swap_pages;
+
+static inline long get_nr_swap_pages(void)
+{
+	return atomic_long_read(&nr_swap_pages);
+}
+
 extern void si_swapinfo(struct sysinfo *);
 extern swp_entry_t get_swap_page(void);
 extern swp_entry_t get_swap_page_of_type(int);
@@ -424,7 +465,7 @@ static inline void mem_cgroup_uncharge_swap(swp_entry_t ent)
 
 #else /* CONFIG_SWAP */
 
-#define nr_swap_pages				0L
+#define get_nr_swap_pages()			0L
 #define total_swap_pages			0L
 #define total_swapcache_pages			0UL
 
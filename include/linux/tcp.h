@@ -96,11 +96,14 @@ enum {
 #define TCP_QUICKACK		12	/* Block/reenable quick acks */
 #define TCP_CONGESTION		13	/* Congestion control algorithm */
 #define TCP_MD5SIG		14	/* TCP MD5 Signature (RFC2385) */
+#define TCP_FASTOPEN		23	/* Accept data in SYN, max pending */
+#define TCP_ZEROCOPY_RECEIVE	35	/* Map received pages, see tcp_mmap() */
 
 #define TCPI_OPT_TIMESTAMPS	1
 #define TCPI_OPT_SACK		2
 #define TCPI_OPT_WSCALE		4
 #define TCPI_OPT_ECN		8
+#define TCPI_OPT_SYN_DATA	32 /* SYN-ACK acked data in SYN sent or rcvd */
 
 enum tcp_ca_state
 {
@@ -157,6 +160,9 @@ struct tcp_info
 	__u32	tcpi_rcv_space;
 
 	__u32	tcpi_total_retrans;
+
+	__u64	tcpi_pacing_rate;
+	__u64	tcpi_max_pacing_rate;
 };
 
 /* for TCP_MD5SIG socket option */
@@ -170,10 +176,24 @@ struct tcp_md5sig {
 	__u8	tcpm_key[TCP_MD5SIG_MAXKEYLEN];		/* key (binary) */
 };
 
+/* getsockopt(fd, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE, ...)
+ *
+ * @address must point into a mapping obtained by mmap() on the socket.
+ * On return @length holds the number of bytes mapped there, and
+ * @recv_skip_hint the number of bytes that could not be mapped (partial
+ * pages) and must be consumed with recvmsg() before retrying.
+ */
+struct tcp_zerocopy_receive {
+	__u64	address;	/* in: address of mapping */
+	__u32	length;		/* in/out: number of bytes to map/mapped */
+	__u32	recv_skip_hint;	/* out: amount of bytes to skip */
+};
+
 #ifdef __KERNEL__
 
 #include <linux/skbuff.h>
 #include <linux/dmaengine.h>
+#include <linux/hrtimer.h>
 #include <net/sock.h>
 #include <net/inet_connection_sock.h>
 #include <net/inet_timewait_sock.h>
@@ -223,6 +243,16 @@ struct tcp_options_received {
 	u16	mss_clamp;	/* Maximal mss, negotiated at connection setup */
 };
 
+/* TCP Fast Open cookie as stored in memory */
+#define TCP_FASTOPEN_COOKIE_MIN	4	/* Min Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_MAX	16	/* Max Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_SIZE 8	/* the size employed by this impl. */
+
+struct tcp_fastopen_cookie {
+	s8	len;	/* -1: none, 0: request, else cookie length */
+	u8	val[TCP_FASTOPEN_COOKIE_MAX];
+};
+
 /* This is the max number of SACKS that we'll generate and process. It's safe
  * to increse this, although since:
  *   size = TCPOLEN_SACK_BASE_ALIGNED (4) + n * TCPOLEN_SACK_PERBLOCK (8)
@@ -237,6 +267,8 @@ struct tcp_request_sock {
 #endif
 	u32			 	rcv_isn;
 	u32			 	snt_isn;
+	u32				rcv_nxt; /* the ack # by SYN-ACK */
+	struct sock			*listener; /* Fast Open: counted in */
 };
 
 static inline struct tcp_request_sock *tcp_rsk(const struct request_sock *req)
@@ -316,6 +348,11 @@ struct tcp_sock {
 	u32	snd_up;		/* Urgent pointer		*/
 
 	u8	keepalive_probes; /* num of allowed keep alive probes	*/
+	u8	syn_fastopen:1,	/* SYN includes Fast Open option */
+		syn_data:1,	/* SYN includes data */
+		syn_data_acked:1,/* data in SYN is acked by SYN-ACK */
+		do_early_retrans:1,/* Enable RFC5827 early-retransmit  */
+		early_retrans_delayed:1; /* Delayed ER timer installed */
 /*
  *      Options received (usually on last packet, some only on SYN packets).
  */
@@ -366,6 +403,11 @@ struct tcp_sock {
 	u32	prior_ssthresh; /* ssthresh saved at recovery start	*/
 	u32	high_seq;	/* snd_nxt at onset of congestion	*/
 
+	u32	prior_cwnd;	/* Congestion window at start of Recovery. */
+	u32	prr_delivered;	/* Number of newly delivered packets to
+				 * receiver in Recovery. */
+	u32	prr_out;	/* Total number of pkts sent during Recovery. */
+
 	u32	retrans_stamp;	/* Timestamp of the last retransmit,
 				 * also used in SYN-SENT to remember stamp of
 				 * the first SYN. */
@@ -399,6 +441,25 @@ struct tcp_sock {
 		u32		  probe_seq_end;
 	} mtu_probe;
 
+/* TCP Small Queues: throttled until some of our skbs leave the device */
+	unsigned long	tsq_flags;
+	struct list_head tsq_node; /* anchor in tsq_tasklet.head list */
+
+/* Internal pacing: no new segment is sent while this timer is pending */
+	struct hrtimer	pacing_timer;
+
+/* TCP Fast Open: connect() in progress from sendmsg(MSG_FASTOPEN), and
+ * on a passive child the request sock used to retransmit the SYN-ACK
+ * until the handshake completes.
+ */
+	struct tcp_fastopen_request *fastopen_req;
+	struct request_sock *fastopen_rsk;
+/* On a listener, TCP_FASTOPEN: passive Fast Open children still waiting
+ * for the end of their handshake, and how many of them are allowed.
+ */
+	atomic_t fastopen_qlen;
+	int	fastopen_max_qlen;
+
 #ifdef CONFIG_TCP_MD5SIG
 /* TCP AF-Specific parts; only used by MD5 Signature support so far */
 	const struct tcp_sock_af_ops	*af_specific;
@@ -408,6 +469,12 @@ struct tcp_sock {
 #endif
 };
 
+enum tsq_flags {
+	TSQ_THROTTLED,
+	TSQ_QUEUED,
+	TSQ_OWNED, /* tcp_tasklet_func() found socket was locked */
+};
+
 static inline struct tcp_sock *tcp_sk(const struct sock *sk)
 {
 	return (struct tcp_sock *)sk;
@@ -27,6 +27,11 @@ struct inet_peer
 	atomic_t		rid;		/* Frag reception counter */
 	__u32			tcp_ts;
 	unsigned long		tcp_ts_stamp;
+	/* TCP Fast Open client cache, under tcp_fastopen_lock */
+	__u16			tcp_fastopen_mss;
+	__s8			tcp_fastopen_cookie_len;
+	__u8			tcp_fastopen_cookie[16];
+	unsigned long		tcp_fastopen_syn_loss; /* jiffies */
 };
 
 void			inet_initpeers(void) __init;
@@ -89,7 +89,7 @@ extern void qdisc_put_stab(struct qdisc_size_table *tab);
 extern void qdisc_warn_nonwc(char *txt, struct Qdisc *qdisc);
 extern int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 			   struct net_device *dev, struct netdev_queue *txq,
-			   spinlock_t *root_lock);
+			   spinlock_t *root_lock, struct sk_buff_head *more);
 
 extern void __qdisc_run(struct Qdisc *q);
 
@@ -47,6 +47,9 @@ struct Qdisc
 #define TCQ_F_INGRESS		4
 #define TCQ_F_CAN_BYPASS	8
 #define TCQ_F_MQROOT		16
+#define TCQ_F_ONETXQUEUE	32	/* dequeues for a single TX queue,
+					 * may hand the driver batches
+					 */
 #define TCQ_F_WARN_NONWC	(1 << 16)
 	int			padded;
 	struct Qdisc_ops	*ops;
@@ -69,6 +72,8 @@ struct Qdisc
 	struct Qdisc		*next_sched;
 
 	struct sk_buff		*gso_skb;
+	/* unsent tail of a bulk dequeue, sent after gso_skb */
+	struct sk_buff_head	requeue;
 	/*
 	 * For performance sake on SMP, we put highly modified fields at the end
 	 */
@@ -76,6 +81,8 @@ struct Qdisc
 	struct sk_buff_head	q;
 	struct gnet_stats_basic_packed bstats;
 	struct gnet_stats_queue	qstats;
+	/* serializes senders waiting for the root lock of a running qdisc */
+	spinlock_t		busylock;
 };
 
 struct Qdisc_class_ops
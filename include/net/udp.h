@@ -210,4 +210,30 @@ extern void udp_init(void);
 
 extern int udp4_ufo_send_check(struct sk_buff *skb);
 extern struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, int features);
+
+/*
+ *	UDP encapsulations (VXLAN and the like) register their destination
+ *	port here so that GRO aggregates the inner flow before the tunnel
+ *	socket sees it, and GSO can segment SKB_GSO_UDP_TUNNEL frames.
+ *
+ *	@hdrlen is the length of the encapsulation header that follows the
+ *	UDP header and @inner_proto the ethertype it carries (ETH_P_TEB for
+ *	Ethernet).  @gro_receive is entered with the GRO offset just past
+ *	the UDP header, @gro_complete with the offset of the same point.
+ */
+struct udp_offload {
+	__be16			port;
+	__be16			inner_proto;
+	unsigned int		hdrlen;
+	struct sk_buff		**(*gro_receive)(struct sk_buff **head,
+						 struct sk_buff *skb);
+	int			(*gro_complete)(struct sk_buff *skb, int nhoff);
+	struct list_head	list;
+};
+
+extern int udp_add_offload(struct udp_offload *uo);
+extern void udp_del_offload(struct udp_offload *uo);
+extern struct sk_buff **udp4_gro_receive(struct sk_buff **head,
+					 struct sk_buff *skb);
+extern int udp4_gro_complete(struct sk_buff *skb, int nhoff);
 #endif	/* _UDP_H */
@@ -132,6 +132,37 @@ TRACE_EVENT(timer_cancel,
 	TP_printk("timer %p", __entry->timer)
 );
 
+/**
+ * timer_wheel_expire - called after a wheel bucket has been expired
+ * @clk:	the wheel clock the bucket expired at
+ * @level:	the wheel level the bucket belongs to
+ * @count:	number of timers which were run from the bucket
+ *
+ * Allows to observe the occupancy of the individual wheel levels and
+ * the size of the expiry batches.
+ */
+TRACE_EVENT(timer_wheel_expire,
+
+	TP_PROTO(unsigned long clk, unsigned int level, unsigned int count),
+
+	TP_ARGS(clk, level, count),
+
+	TP_STRUCT__entry(
+		__field( unsigned long,	clk	)
+		__field( unsigned int,	level	)
+		__field( unsigned int,	count	)
+	),
+
+	TP_fast_assign(
+		__entry->clk	= clk;
+		__entry->level	= level;
+		__entry->count	= count;
+	),
+
+	TP_printk("clk %lu level %u count %u",
+		  __entry->clk, __entry->level, __entry->count)
+);
+
 /**
  * hrtimer_init - called when the hrtimer is initialized
  * @timer:	pointer to struct hrtimer
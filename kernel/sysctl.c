@@ -1630,6 +1630,13 @@ static struct ctl_table fs_table[] = {
 		.mode		= 0644,
 		.proc_handler	= &proc_doulongvec_minmax,
 	},
+	{
+		.procname	= "aio-poll-usecs",
+		.data		= &aio_poll_usecs,
+		.maxlen		= sizeof(aio_poll_usecs),
+		.mode		= 0644,
+		.proc_handler	= &proc_doulongvec_minmax,
+	},
 #endif /* CONFIG_AIO */
 #ifdef CONFIG_INOTIFY_USER
 	{
@@ -54,33 +54,72 @@ u64 jiffies_64 __cacheline_aligned_in_smp = INITIAL_JIFFIES;
 EXPORT_SYMBOL(jiffies_64);
 
 /*
- * per-CPU timer vector definitions:
+ * The timer wheel has LVL_DEPTH levels of LVL_SIZE buckets each. Each
+ * level is LVL_CLK_DIV times coarser than the previous one. Unlike the
+ * classic cascading wheel a timer is queued exactly once, into the level
+ * whose range covers its timeout, and expires directly from there: timers
+ * are never cascaded down into finer levels. Timers in the outer levels
+ * therefore expire up to one granule of their level late, which is the
+ * right trade off for the long timeouts (retransmits, keepalives,
+ * watchdogs) that live there and almost always get cancelled or re-armed
+ * before they fire.
+ *
+ * HZ 1000:
+ * Level Offset  Granularity            Range
+ *  0      0         1 ms                0 ms -         62 ms
+ *  1     64         8 ms               63 ms -        503 ms
+ *  2    128        64 ms              504 ms -       4031 ms (~4s)
+ *  3    192       512 ms             4032 ms -      32255 ms (~32s)
+ *  4    256      4096 ms (~4s)      32256 ms -     258047 ms (~4m)
+ *  5    320     32768 ms (~32s)    258048 ms -    2064383 ms (~34m)
+ *  6    384    262144 ms (~4m)    2064384 ms -   16515071 ms (~4h)
+ *  7    448   2097152 ms (~34m)  16515072 ms -  132120575 ms (~1d)
+ *  8    512  16777216 ms (~4h)  132120576 ms - 1056964607 ms (~12d)
+ *
+ * Timeouts beyond the last level are clamped to WHEEL_TIMEOUT_MAX.
  */
-#define TVN_BITS (CONFIG_BASE_SMALL ? 4 : 6)
-#define TVR_BITS (CONFIG_BASE_SMALL ? 6 : 8)
-#define TVN_SIZE (1 << TVN_BITS)
-#define TVR_SIZE (1 << TVR_BITS)
-#define TVN_MASK (TVN_SIZE - 1)
-#define TVR_MASK (TVR_SIZE - 1)
-
-struct tvec {
-	struct list_head vec[TVN_SIZE];
-};
+#define LVL_CLK_SHIFT	3
+#define LVL_CLK_DIV	(1UL << LVL_CLK_SHIFT)
+#define LVL_CLK_MASK	(LVL_CLK_DIV - 1)
+#define LVL_SHIFT(n)	((n) * LVL_CLK_SHIFT)
+#define LVL_GRAN(n)	(1UL << LVL_SHIFT(n))
+
+/* The start of level n is the end of level n - 1 */
+#define LVL_START(n)	((LVL_SIZE - 1) << (((n) - 1) * LVL_CLK_SHIFT))
+
+#define LVL_BITS	6
+#define LVL_SIZE	(1UL << LVL_BITS)
+#define LVL_MASK	(LVL_SIZE - 1)
+#define LVL_OFFS(n)	((n) * LVL_SIZE)
+
+#if HZ > 100
+# define LVL_DEPTH	9
+#else
+# define LVL_DEPTH	8
+#endif
 
-struct tvec_root {
-	struct list_head vec[TVR_SIZE];
-};
+#define WHEEL_TIMEOUT_CUTOFF	(LVL_START(LVL_DEPTH))
+#define WHEEL_TIMEOUT_MAX	(WHEEL_TIMEOUT_CUTOFF - LVL_GRAN(LVL_DEPTH - 1))
+#define WHEEL_SIZE		(LVL_SIZE * LVL_DEPTH)
 
+/*
+ * timer_jiffies is the next tick the wheel has to process. next_timer
+ * caches the earliest bucket expiry of all non-deferrable timers (for
+ * NOHZ), next_expiry the earliest bucket expiry of all timers. Both are
+ * only ever lowered when timers are queued; removing a timer leaves them
+ * conservatively early until the next recalculation.
+ *
+ * pending_map bits are cleared lazily: a set bit may refer to a bucket
+ * whose timers have all been deleted in the meantime.
+ */
 struct tvec_base {
 	spinlock_t lock;
 	struct timer_list *running_timer;
 	unsigned long timer_jiffies;
 	unsigned long next_timer;
-	struct tvec_root tv1;
-	struct tvec tv2;
-	struct tvec tv3;
-	struct tvec tv4;
-	struct tvec tv5;
+	unsigned long next_expiry;
+	DECLARE_BITMAP(pending_map, WHEEL_SIZE);
+	struct list_head vectors[WHEEL_SIZE];
 } ____cacheline_aligned;
 
 struct tvec_base boot_tvec_bases;
@@ -327,46 +366,186 @@ static inline void set_running_timer(struct tvec_base *base,
 #endif
 }
 
-static void internal_add_timer(struct tvec_base *base, struct timer_list *timer)
+/*
+ * Helper function to calculate the array index for a given expiry
+ * time. The outer levels truncate the expiry time to their granularity,
+ * so round up to make sure a timer never fires before ->expires.
+ */
+static inline unsigned int calc_index(unsigned long expires, unsigned int lvl,
+				      unsigned long *bucket_expiry)
+{
+	if (lvl)
+		expires = (expires >> LVL_SHIFT(lvl)) + 1;
+	*bucket_expiry = expires << LVL_SHIFT(lvl);
+	return LVL_OFFS(lvl) + (expires & LVL_MASK);
+}
+
+static unsigned int calc_wheel_index(unsigned long expires, unsigned long clk,
+				     unsigned long *bucket_expiry)
 {
-	unsigned long expires = timer->expires;
-	unsigned long idx = expires - base->timer_jiffies;
-	struct list_head *vec;
-
-	if (idx < TVR_SIZE) {
-		int i = expires & TVR_MASK;
-		vec = base->tv1.vec + i;
-	} else if (idx < 1 << (TVR_BITS + TVN_BITS)) {
-		int i = (expires >> TVR_BITS) & TVN_MASK;
-		vec = base->tv2.vec + i;
-	} else if (idx < 1 << (TVR_BITS + 2 * TVN_BITS)) {
-		int i = (expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK;
-		vec = base->tv3.vec + i;
-	} else if (idx < 1 << (TVR_BITS + 3 * TVN_BITS)) {
-		int i = (expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK;
-		vec = base->tv4.vec + i;
-	} else if ((signed long) idx < 0) {
+	unsigned long delta = expires - clk;
+	unsigned int lvl;
+
+	if ((long) delta < 0) {
 		/*
 		 * Can happen if you add a timer with expires == jiffies,
 		 * or you set a timer to go off in the past
 		 */
-		vec = base->tv1.vec + (base->timer_jiffies & TVR_MASK);
-	} else {
-		int i;
-		/* If the timeout is larger than 0xffffffff on 64-bit
-		 * architectures then we use the maximum timeout:
-		 */
-		if (idx > 0xffffffffUL) {
-			idx = 0xffffffffUL;
-			expires = idx + base->timer_jiffies;
-		}
-		i = (expires >> (TVR_BITS + 3 * TVN_BITS)) & TVN_MASK;
-		vec = base->tv5.vec + i;
+		*bucket_expiry = clk;
+		return clk & LVL_MASK;
 	}
+
+	/*
+	 * Force expire obscene large timeouts to expire at the
+	 * capacity limit of the wheel.
+	 */
+	if (delta >= WHEEL_TIMEOUT_CUTOFF) {
+		expires = clk + WHEEL_TIMEOUT_MAX;
+		delta = WHEEL_TIMEOUT_MAX;
+	}
+
+	for (lvl = 0; lvl < LVL_DEPTH - 1; lvl++)
+		if (delta < LVL_START(lvl + 1))
+			break;
+
+	return calc_index(expires, lvl, bucket_expiry);
+}
+
+static void internal_add_timer(struct tvec_base *base, struct timer_list *timer)
+{
+	unsigned long bucket_expiry;
+	unsigned int idx;
+
+	idx = calc_wheel_index(timer->expires, base->timer_jiffies,
+			       &bucket_expiry);
 	/*
 	 * Timers are FIFO:
 	 */
-	list_add_tail(&timer->entry, vec);
+	list_add_tail(&timer->entry, base->vectors + idx);
+	__set_bit(idx, base->pending_map);
+
+	if (time_before(bucket_expiry, base->next_expiry))
+		base->next_expiry = bucket_expiry;
+	if (time_before(bucket_expiry, base->next_timer) &&
+	    !tbase_get_deferrable(timer->base))
+		base->next_timer = bucket_expiry;
+}
+
+/*
+ * Returns true if the bucket at @idx holds a timer which has to be taken
+ * into account for the next expiry. Empty buckets have their stale
+ * pending bit cleared on the way.
+ */
+static bool bucket_pending(struct tvec_base *base, unsigned int idx,
+			   bool skip_deferrable)
+{
+	struct list_head *vec = base->vectors + idx;
+	struct timer_list *timer;
+
+	if (list_empty(vec)) {
+		__clear_bit(idx, base->pending_map);
+		return false;
+	}
+	if (!skip_deferrable)
+		return true;
+
+	list_for_each_entry(timer, vec, entry)
+		if (!tbase_get_deferrable(timer->base))
+			return true;
+	return false;
+}
+
+/*
+ * Search the first pending bucket of the level starting at @offset,
+ * beginning at bucket @clk and wrapping around. Returns the distance in
+ * level granules or -1 if the level is empty.
+ */
+static int next_pending_bucket(struct tvec_base *base, unsigned int offset,
+			       unsigned int clk, bool skip_deferrable)
+{
+	unsigned int pos, start = offset + clk;
+	unsigned int end = offset + LVL_SIZE;
+
+	for (pos = find_next_bit(base->pending_map, end, start); pos < end;
+	     pos = find_next_bit(base->pending_map, end, pos + 1))
+		if (bucket_pending(base, pos, skip_deferrable))
+			return pos - start;
+
+	for (pos = find_next_bit(base->pending_map, start, offset); pos < start;
+	     pos = find_next_bit(base->pending_map, start, pos + 1))
+		if (bucket_pending(base, pos, skip_deferrable))
+			return pos + LVL_SIZE - start;
+
+	return -1;
+}
+
+/*
+ * Find the expiry time of the next pending bucket in the wheel, ignoring
+ * buckets which only hold deferrable timers if @skip_deferrable is set.
+ * Must be called with base->lock held.
+ */
+static unsigned long __next_timer_interrupt(struct tvec_base *base,
+					    bool skip_deferrable)
+{
+	unsigned long clk, next, adj;
+	unsigned int lvl, offset = 0;
+
+	next = base->timer_jiffies + NEXT_TIMER_MAX_DELTA;
+	clk = base->timer_jiffies;
+	for (lvl = 0; lvl < LVL_DEPTH; lvl++, offset += LVL_SIZE) {
+		int pos = next_pending_bucket(base, offset, clk & LVL_MASK,
+					      skip_deferrable);
+
+		if (pos >= 0) {
+			unsigned long tmp = clk + (unsigned long) pos;
+
+			tmp <<= LVL_SHIFT(lvl);
+			if (time_before(tmp, next))
+				next = tmp;
+		}
+		/*
+		 * The next level only needs to be looked at from the next
+		 * bucket on if this level's clock is not aligned: the
+		 * current bucket of the next level has already expired.
+		 */
+		adj = clk & LVL_CLK_MASK ? 1 : 0;
+		clk >>= LVL_CLK_SHIFT;
+		clk += adj;
+	}
+	return next;
+}
+
+/*
+ * A base which was idle lags behind jiffies. Bring its clock forward
+ * before queueing a new timer, otherwise the timer would be queued
+ * relative to the stale clock into a coarser level than necessary.
+ */
+static void forward_timer_base(struct tvec_base *base)
+{
+	unsigned long jnow = jiffies;
+
+	if ((long)(jnow - base->timer_jiffies) < 2)
+		return;
+
+	if (!time_after(base->next_expiry, base->timer_jiffies))
+		base->next_expiry = __next_timer_interrupt(base, false);
+
+	if (time_after(base->next_expiry, jnow))
+		base->timer_jiffies = jnow;
+	else
+		base->timer_jiffies = base->next_expiry;
+}
+
+/*
+ * Removing a timer can only make the cached next event later. Invalidate
+ * the cache if the removed timer could have been the next one.
+ */
+static inline void timer_update_next(struct tvec_base *base,
+				     struct timer_list *timer)
+{
+	if (!tbase_get_deferrable(timer->base) &&
+	    time_before_eq(timer->expires, base->next_timer))
+		base->next_timer = base->timer_jiffies;
 }
 
 #ifdef CONFIG_TIMER_STATS
@@ -549,6 +728,7 @@ static void __init_timer(struct timer_list *timer,
 {
 	timer->entry.next = NULL;
 	timer->base = __raw_get_cpu_var(tvec_bases);
+	timer->slack = 0;
 #ifdef CONFIG_TIMER_STATS
 	timer->start_site = NULL;
 	timer->start_pid = -1;
@@ -645,9 +825,7 @@ __mod_timer(struct timer_list *timer, unsigned long expires,
 
 	if (timer_pending(timer)) {
 		detach_timer(timer, 0);
-		if (timer->expires == base->next_timer &&
-		    !tbase_get_deferrable(timer->base))
-			base->next_timer = base->timer_jiffies;
+		timer_update_next(base, timer);
 		ret = 1;
 	} else {
 		if (pending_only)
@@ -688,10 +866,8 @@ __mod_timer(struct timer_list *timer, unsigned long expires,
 		}
 	}
 
+	forward_timer_base(base);
 	timer->expires = expires;
-	if (time_before(timer->expires, base->next_timer) &&
-	    !tbase_get_deferrable(timer->base))
-		base->next_timer = timer->expires;
 	internal_add_timer(base, timer);
 
 out_unlock:
@@ -716,6 +892,43 @@ int mod_timer_pending(struct timer_list *timer, unsigned long expires)
 }
 EXPORT_SYMBOL(mod_timer_pending);
 
+/*
+ * Decide where to put the timer while taking the slack into account
+ *
+ * Algorithm:
+ *   1) calculate the maximum (absolute) time
+ *   2) calculate the highest bit where the expires and new max are different
+ *   3) use this bit to make a mask
+ *   4) use the bitmask to round down the maximum time, so that all last
+ *      bits are zeros
+ *
+ * All timers of this CPU which allow the same slack then end up with the
+ * same expiry time and are run from one bucket in one batch.
+ */
+static inline
+unsigned long apply_slack(struct timer_list *timer, unsigned long expires)
+{
+	unsigned long expires_limit, mask;
+	int bit;
+
+	if (timer->slack <= 0)
+		return expires;
+
+	expires_limit = expires + timer->slack;
+
+	mask = expires ^ expires_limit;
+	if (mask == 0)
+		return expires;
+
+	bit = find_last_bit(&mask, BITS_PER_LONG);
+
+	mask = (1UL << bit) - 1;
+
+	expires_limit = expires_limit & ~(mask);
+
+	return expires_limit;
+}
+
 /**
  * mod_timer - modify a timer's timeout
  * @timer: the timer to be modified
@@ -738,6 +951,8 @@ EXPORT_SYMBOL(mod_timer_pending);
  */
 int mod_timer(struct timer_list *timer, unsigned long expires)
 {
+	expires = apply_slack(timer, expires);
+
 	/*
 	 * This is a common optimization triggered by the
 	 * networking code - if the timer is re-modified
@@ -772,6 +987,25 @@ int mod_timer_pinned(struct timer_list *timer, unsigned long expires)
 }
 EXPORT_SYMBOL(mod_timer_pinned);
 
+/**
+ * set_timer_slack - set the allowed slack for a timer
+ * @timer: the timer to be modified
+ * @slack_hz: the amount of time (in jiffies) allowed for rounding
+ *
+ * Set the amount of time, in jiffies, that a certain timer has
+ * in terms of slack. By setting this value, the timer subsystem
+ * will schedule the actual timer somewhere between
+ * the time mod_timer() asks for, and that time plus the slack.
+ *
+ * By default timers have no slack beyond the granularity of the wheel
+ * level they end up in.
+ */
+void set_timer_slack(struct timer_list *timer, int slack_hz)
+{
+	timer->slack = slack_hz;
+}
+EXPORT_SYMBOL_GPL(set_timer_slack);
+
 /**
  * add_timer - start a timer
  * @timer: the timer to be added
@@ -810,9 +1044,7 @@ void add_timer_on(struct timer_list *timer, int cpu)
 	spin_lock_irqsave(&base->lock, flags);
 	timer_set_base(timer, base);
 	debug_activate(timer, timer->expires);
-	if (time_before(timer->expires, base->next_timer) &&
-	    !tbase_get_deferrable(timer->base))
-		base->next_timer = timer->expires;
+	forward_timer_base(base);
 	internal_add_timer(base, timer);
 	/*
 	 * Check whether the other CPU is idle and needs to be
@@ -849,9 +1081,7 @@ int del_timer(struct timer_list *timer)
 		base = lock_timer_base(timer, &flags);
 		if (timer_pending(timer)) {
 			detach_timer(timer, 1);
-			if (timer->expires == base->next_timer &&
-			    !tbase_get_deferrable(timer->base))
-				base->next_timer = base->timer_jiffies;
+			timer_update_next(base, timer);
 			ret = 1;
 		}
 		spin_unlock_irqrestore(&base->lock, flags);
@@ -885,9 +1115,7 @@ int try_to_del_timer_sync(struct timer_list *timer)
 	ret = 0;
 	if (timer_pending(timer)) {
 		detach_timer(timer, 1);
-		if (timer->expires == base->next_timer &&
-		    !tbase_get_deferrable(timer->base))
-			base->next_timer = base->timer_jiffies;
+		timer_update_next(base, timer);
 		ret = 1;
 	}
 out:
@@ -935,191 +1163,142 @@ int del_timer_sync(struct timer_list *timer)
 EXPORT_SYMBOL(del_timer_sync);
 #endif
 
-static int cascade(struct tvec_base *base, struct tvec *tv, int index)
+static void expire_timers(struct tvec_base *base, struct list_head *head,
+			  unsigned long clk, unsigned int level)
 {
-	/* cascade all the timers from tv up one level */
-	struct timer_list *timer, *tmp;
-	struct list_head tv_list;
+	unsigned int count = 0;
+
+	while (!list_empty(head)) {
+		struct timer_list *timer;
+		void (*fn)(unsigned long);
+		unsigned long data;
+
+		timer = list_first_entry(head, struct timer_list, entry);
+		fn = timer->function;
+		data = timer->data;
+
+		timer_stats_account_timer(timer);
+
+		set_running_timer(base, timer);
+		detach_timer(timer, 1);
+
+		spin_unlock_irq(&base->lock);
+		{
+			int preempt_count = preempt_count();
+
+#ifdef CONFIG_LOCKDEP
+			/*
+			 * It is permissible to free the timer from
+			 * inside the function that is called from
+			 * it, this we need to take into account for
+			 * lockdep too. To avoid bogus "held lock
+			 * freed" warnings as well as problems when
+			 * looking into timer->lockdep_map, make a
+			 * copy and use that here.
+			 */
+			struct lockdep_map lockdep_map =
+				timer->lockdep_map;
+#endif
+			/*
+			 * Couple the lock chain with the lock chain at
+			 * del_timer_sync() by acquiring the lock_map
+			 * around the fn() call here and in
+			 * del_timer_sync().
+			 */
+			lock_map_acquire(&lockdep_map);
 
-	list_replace_init(tv->vec + index, &tv_list);
+			trace_timer_expire_entry(timer);
+			fn(data);
+			trace_timer_expire_exit(timer);
+
+			lock_map_release(&lockdep_map);
+
+			if (preempt_count != preempt_count()) {
+				printk(KERN_ERR "huh, entered %p "
+				       "with preempt_count %08x, exited"
+				       " with %08x?\n",
+				       fn, preempt_count,
+				       preempt_count());
+				BUG();
+			}
+		}
+		spin_lock_irq(&base->lock);
+		count++;
+	}
+	trace_timer_wheel_expire(clk, level, count);
+}
+
+/*
+ * Move the buckets of all levels which expire at the current tick onto
+ * @heads, so they can be run as one batch. Returns the number of levels
+ * collected.
+ */
+static int collect_expired_timers(struct tvec_base *base,
+				  struct list_head *heads, unsigned int *lvls)
+{
+	unsigned long clk;
+	unsigned int i, idx;
+	int levels = 0;
 
 	/*
-	 * We are removing _all_ timers from the list, so we
-	 * don't have to detach them individually.
+	 * If the base was idle for more than a couple of ticks, skip the
+	 * empty ticks in between and go straight to the next pending
+	 * bucket instead of walking the wheel tick by tick.
 	 */
-	list_for_each_entry_safe(timer, tmp, &tv_list, entry) {
-		BUG_ON(tbase_get_base(timer->base) != base);
-		internal_add_timer(base, timer);
+	if ((long)(jiffies - base->timer_jiffies) > 2) {
+		unsigned long next = __next_timer_interrupt(base, false);
+
+		base->next_expiry = next;
+		if (time_after(next, jiffies))
+			base->timer_jiffies = jiffies;
+		else
+			base->timer_jiffies = next;
 	}
-
-	return index;
+	clk = base->timer_jiffies;
+	for (i = 0; i < LVL_DEPTH; i++) {
+		idx = (clk & LVL_MASK) + i * LVL_SIZE;
+
+		if (__test_and_clear_bit(idx, base->pending_map) &&
+		    !list_empty(base->vectors + idx)) {
+			lvls[levels] = i;
+			list_replace_init(base->vectors + idx, heads + levels);
+			levels++;
+		}
+		/* Is it time to look at the next level? */
+		if (clk & LVL_CLK_MASK)
+			break;
+		/* Shift clock for the next level granularity */
+		clk >>= LVL_CLK_SHIFT;
+	}
+	return levels;
 }
 
-#define INDEX(N) ((base->timer_jiffies >> (TVR_BITS + (N) * TVN_BITS)) & TVN_MASK)
-
 /**
  * __run_timers - run all expired timers (if any) on this CPU.
  * @base: the timer vector to be processed.
  *
- * This function cascades all vectors and executes all expired timer
- * vectors.
+ * This function collects the expired buckets of all wheel levels and
+ * executes them in one batch per tick.
  */
 static inline void __run_timers(struct tvec_base *base)
 {
-	struct timer_list *timer;
+	struct list_head heads[LVL_DEPTH];
+	unsigned int lvls[LVL_DEPTH];
+	unsigned long clk;
+	int levels;
 
 	spin_lock_irq(&base->lock);
 	while (time_after_eq(jiffies, base->timer_jiffies)) {
-		struct list_head work_list;
-		struct list_head *head = &work_list;
-		int index = base->timer_jiffies & TVR_MASK;
-
-		/*
-		 * Cascade timers:
-		 */
-		if (!index &&
-			(!cascade(base, &base->tv2, INDEX(0))) &&
-				(!cascade(base, &base->tv3, INDEX(1))) &&
-					!cascade(base, &base->tv4, INDEX(2)))
-			cascade(base, &base->tv5, INDEX(3));
-		++base->timer_jiffies;
-		list_replace_init(base->tv1.vec + index, &work_list);
-		while (!list_empty(head)) {
-			void (*fn)(unsigned long);
-			unsigned long data;
-
-			timer = list_first_entry(head, struct timer_list,entry);
-			fn = timer->function;
-			data = timer->data;
-
-			timer_stats_account_timer(timer);
-
-			set_running_timer(base, timer);
-			detach_timer(timer, 1);
-
-			spin_unlock_irq(&base->lock);
-			{
-				int preempt_count = preempt_count();
-
-#ifdef CONFIG_LOCKDEP
-				/*
-				 * It is permissible to free the timer from
-				 * inside the function that is called from
-				 * it, this we need to take into account for
-				 * lockdep too. To avoid bogus "held lock
-				 * freed" warnings as well as problems when
-				 * looking into timer->lockdep_map, make a
-				 * copy and use that here.
-				 */
-				struct lockdep_map lockdep_map =
-					timer->lockdep_map;
-#endif
-				/*
-				 * Couple the lock chain with the lock chain at
-				 * del_timer_sync() by acquiring the lock_map
-				 * around the fn() call here and in
-				 * del_timer_sync().
-				 */
-				lock_map_acquire(&lockdep_map);
-
-				trace_timer_expire_entry(timer);
-				fn(data);
-				trace_timer_expire_exit(timer);
-
-				lock_map_release(&lockdep_map);
-
-				if (preempt_count != preempt_count()) {
-					printk(KERN_ERR "huh, entered %p "
-					       "with preempt_count %08x, exited"
-					       " with %08x?\n",
-					       fn, preempt_count,
-					       preempt_count());
-					BUG();
-				}
-			}
-			spin_lock_irq(&base->lock);
-		}
+		levels = collect_expired_timers(base, heads, lvls);
+		clk = base->timer_jiffies++;
+		while (levels--)
+			expire_timers(base, heads + levels, clk, lvls[levels]);
 	}
 	set_running_timer(base, NULL);
 	spin_unlock_irq(&base->lock);
 }
 
 #if defined(CONFIG_NO_HZ) || defined(CONFIG_NO_IDLE_HZ)
-/*
- * Find out when the next timer event is due to happen. This
- * is used on S/390 to stop all activity when a CPU is idle.
- * This function needs to be called with interrupts disabled.
- */
-static unsigned long __next_timer_interrupt(struct tvec_base *base)
-{
-	unsigned long timer_jiffies = base->timer_jiffies;
-	unsigned long expires = timer_jiffies + NEXT_TIMER_MAX_DELTA;
-	int index, slot, array, found = 0;
-	struct timer_list *nte;
-	struct tvec *varray[4];
-
-	/* Look for timer events in tv1. */
-	index = slot = timer_jiffies & TVR_MASK;
-	do {
-		list_for_each_entry(nte, base->tv1.vec + slot, entry) {
-			if (tbase_get_deferrable(nte->base))
-				continue;
-
-			found = 1;
-			expires = nte->expires;
-			/* Look at the cascade bucket(s)? */
-			if (!index || slot < index)
-				goto cascade;
-			return expires;
-		}
-		slot = (slot + 1) & TVR_MASK;
-	} while (slot != index);
-
-cascade:
-	/* Calculate the next cascade event */
-	if (index)
-		timer_jiffies += TVR_SIZE - index;
-	timer_jiffies >>= TVR_BITS;
-
-	/* Check tv2-tv5. */
-	varray[0] = &base->tv2;
-	varray[1] = &base->tv3;
-	varray[2] = &base->tv4;
-	varray[3] = &base->tv5;
-
-	for (array = 0; array < 4; array++) {
-		struct tvec *varp = varray[array];
-
-		index = slot = timer_jiffies & TVN_MASK;
-		do {
-			list_for_each_entry(nte, varp->vec + slot, entry) {
-				if (tbase_get_deferrable(nte->base))
-					continue;
-
-				found = 1;
-				if (time_before(nte->expires, expires))
-					expires = nte->expires;
-			}
-			/*
-			 * Do we still search for the first timer or are
-			 * we looking up the cascade buckets ?
-			 */
-			if (found) {
-				/* Look at the cascade bucket(s)? */
-				if (!index || slot < index)
-					break;
-				return expires;
-			}
-			slot = (slot + 1) & TVN_MASK;
-		} while (slot != index);
-
-		if (index)
-			timer_jiffies += TVN_SIZE - index;
-		timer_jiffies >>= TVN_BITS;
-	}
-	return expires;
-}
-
 /*
  * Check, if the next hrtimer event is before the next timer wheel
  * event:
@@ -1175,7 +1354,7 @@ unsigned long get_next_timer_interrupt(unsigned long now)
 
 	spin_lock(&base->lock);
 	if (time_before_eq(base->next_timer, base->timer_jiffies))
-		base->next_timer = __next_timer_interrupt(base);
+		base->next_timer = __next_timer_interrupt(base, true);
 	expires = base->next_timer;
 	spin_unlock(&base->lock);
 
@@ -1554,17 +1733,13 @@ static int __cpuinit init_timers_cpu(int cpu)
 
 	spin_lock_init(&base->lock);
 
-	for (j = 0; j < TVN_SIZE; j++) {
-		INIT_LIST_HEAD(base->tv5.vec + j);
-		INIT_LIST_HEAD(base->tv4.vec + j);
-		INIT_LIST_HEAD(base->tv3.vec + j);
-		INIT_LIST_HEAD(base->tv2.vec + j);
-	}
-	for (j = 0; j < TVR_SIZE; j++)
-		INIT_LIST_HEAD(base->tv1.vec + j);
+	for (j = 0; j < WHEEL_SIZE; j++)
+		INIT_LIST_HEAD(base->vectors + j);
+	bitmap_zero(base->pending_map, WHEEL_SIZE);
 
 	base->timer_jiffies = jiffies;
 	base->next_timer = base->timer_jiffies;
+	base->next_expiry = base->timer_jiffies;
 	return 0;
 }
 
@@ -1577,9 +1752,6 @@ static void migrate_timer_list(struct tvec_base *new_base, struct list_head *hea
 		timer = list_first_entry(head, struct timer_list, entry);
 		detach_timer(timer, 0);
 		timer_set_base(timer, new_base);
-		if (time_before(timer->expires, new_base->next_timer) &&
-		    !tbase_get_deferrable(timer->base))
-			new_base->next_timer = timer->expires;
 		internal_add_timer(new_base, timer);
 	}
 }
@@ -1602,14 +1774,10 @@ static void __cpuinit migrate_timers(int cpu)
 
 	BUG_ON(old_base->running_timer);
 
-	for (i = 0; i < TVR_SIZE; i++)
-		migrate_timer_list(new_base, old_base->tv1.vec + i);
-	for (i = 0; i < TVN_SIZE; i++) {
-		migrate_timer_list(new_base, old_base->tv2.vec + i);
-		migrate_timer_list(new_base, old_base->tv3.vec + i);
-		migrate_timer_list(new_base, old_base->tv4.vec + i);
-		migrate_timer_list(new_base, old_base->tv5.vec + i);
-	}
+	forward_timer_base(new_base);
+	for (i = 0; i < WHEEL_SIZE; i++)
+		migrate_timer_list(new_base, old_base->vectors + i);
+	bitmap_zero(old_base->pending_map, WHEEL_SIZE);
 
 	spin_unlock(&old_base->lock);
 	spin_unlock_irq(&new_base->lock);
@@ -61,7 +61,7 @@
  *
  *  ->i_mmap_lock		(truncate_pagecache)
  *    ->private_lock		(__free_pte->__set_page_dirty_buffers)
- *      ->swap_lock		(exclusive_swap_page, others)
+ *      ->swap_info_struct->lock	(exclusive_swap_page, others)
  *        ->mapping->tree_lock
  *
  *  ->i_mutex
@@ -92,7 +92,7 @@
  *    ->page_table_lock or pte_lock	(anon_vma_prepare and various)
  *
  *  ->page_table_lock or pte_lock
- *    ->swap_lock		(try_to_unmap_one)
+ *    ->swap_info_struct->lock	(try_to_unmap_one)
  *    ->private_lock		(try_to_unmap_one)
  *    ->tree_lock		(try_to_unmap_one)
  *    ->zone.lru_lock		(follow_page->mark_page_accessed)
@@ -165,12 +165,9 @@ void remove_from_page_cache(struct page *page)
 }
 EXPORT_SYMBOL_GPL(remove_from_page_cache);
 
-static int sync_page(void *word)
+static void unplug_page_io(struct page *page)
 {
 	struct address_space *mapping;
-	struct page *page;
-
-	page = container_of((unsigned long *)word, struct page, flags);
 
 	/*
 	 * page_mapping() is being called without PG_locked held.
@@ -197,6 +194,11 @@ static int sync_page(void *word)
 	mapping = page_mapping(page);
 	if (mapping && mapping->a_ops && mapping->a_ops->sync_page)
 		mapping->a_ops->sync_page(page);
+}
+
+static int sync_page(void *word)
+{
+	unplug_page_io(container_of((unsigned long *)word, struct page, flags));
 	io_schedule();
 
 	return 0;
@@ -626,6 +628,70 @@ void wait_on_page_bit(struct page *page, int bit_nr)
 }
 EXPORT_SYMBOL(wait_on_page_bit);
 
+/**
+ * cancel_page_wait_async - unhook an asynchronous page waiter
+ * @wait: wait entry passed to wait_on_page_bit_async() earlier
+ *
+ * Safe to call whether or not @wait is still queued.  @wait->key.flags
+ * is non-NULL from the time @wait is hooked on a page until it is
+ * cancelled; the wake function may unhook it concurrently, so once it
+ * has been hooked the queue lock must be taken to be sure it is gone.
+ */
+void cancel_page_wait_async(struct wait_bit_queue *wait)
+{
+	wait_queue_head_t *wq;
+	unsigned long flags;
+
+	if (!wait->key.flags)
+		return;
+
+	wq = page_waitqueue(container_of(wait->key.flags, struct page, flags));
+	spin_lock_irqsave(&wq->lock, flags);
+	list_del_init(&wait->wait.task_list);
+	spin_unlock_irqrestore(&wq->lock, flags);
+	wait->key.flags = NULL;
+}
+EXPORT_SYMBOL(cancel_page_wait_async);
+
+/**
+ * wait_on_page_bit_async - wait for a page bit to clear without sleeping
+ * @page: the page
+ * @bit_nr: page flag to wait on
+ * @wait: wait entry whose wake function restarts the caller
+ *
+ * Returns 0 if @bit_nr is clear.  Otherwise @wait is left on the page's
+ * wait queue, I/O against the page is kicked off, and -EIOCBRETRY is
+ * returned: the wakeup will call @wait's function once the bit clears.
+ * A waiter is on at most one page at a time.
+ */
+int wait_on_page_bit_async(struct page *page, int bit_nr,
+			   struct wait_bit_queue *wait)
+{
+	wait_queue_head_t *wq = page_waitqueue(page);
+	unsigned long flags;
+
+	if (!test_bit(bit_nr, &page->flags))
+		return 0;
+
+	cancel_page_wait_async(wait);
+	wait->key.flags = &page->flags;
+	wait->key.bit_nr = bit_nr;
+
+	spin_lock_irqsave(&wq->lock, flags);
+	__add_wait_queue_tail(wq, &wait->wait);
+	spin_unlock_irqrestore(&wq->lock, flags);
+	if (bit_nr == PG_locked)
+		SetPageWaiters(page);
+
+	if (likely(test_bit(bit_nr, &page->flags))) {
+		unplug_page_io(page);
+		return -EIOCBRETRY;
+	}
+	cancel_page_wait_async(wait);
+	return 0;
+}
+EXPORT_SYMBOL(wait_on_page_bit_async);
+
 /**
  * add_page_wait_queue - Add an arbitrary waiter to a page's wait queue
  * @page: Page defining the wait queue of interest
@@ -1142,7 +1208,8 @@ static void shrink_readahead_size_eio(struct file *filp,
  * of the logic when it comes to error handling etc.
  */
 static void do_generic_file_read(struct file *filp, loff_t *ppos,
-		read_descriptor_t *desc, read_actor_t actor)
+		read_descriptor_t *desc, read_actor_t actor,
+		struct wait_bit_queue *wait)
 {
 	struct address_space *mapping = filp->f_mapping;
 	struct inode *inode = mapping->host;
@@ -1258,6 +1325,13 @@ page_ok:
 		goto out;
 
 page_not_up_to_date:
+		/* AIO: don't sleep on the read in flight, retry after it */
+		if (wait) {
+			error = wait_on_page_locked_async(page, wait);
+			if (error)
+				goto readpage_error;
+		}
+
 		/* Get exclusive access to the page ... */
 		error = lock_page_killable(page);
 		if (unlikely(error))
@@ -1290,6 +1364,11 @@ readpage:
 		}
 
 		if (!PageUptodate(page)) {
+			if (wait) {
+				error = wait_on_page_locked_async(page, wait);
+				if (error)
+					goto readpage_error;
+			}
 			error = lock_page_killable(page);
 			if (unlikely(error))
 				goto readpage_error;
@@ -1441,6 +1520,7 @@ generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 		unsigned long nr_segs, loff_t pos)
 {
 	struct file *filp = iocb->ki_filp;
+	struct wait_bit_queue *wait = kiocb_async_wait(iocb);
 	ssize_t retval;
 	unsigned long seg;
 	size_t count;
@@ -1487,7 +1567,7 @@ generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 		if (desc.count == 0)
 			continue;
 		desc.error = 0;
-		do_generic_file_read(filp, ppos, &desc, file_read_actor);
+		do_generic_file_read(filp, ppos, &desc, file_read_actor, wait);
 		retval += desc.written;
 		if (desc.error) {
 			retval = retval ?: desc.error;
@@ -2361,8 +2441,46 @@ repeat:
 }
 EXPORT_SYMBOL(grab_cache_page_write_begin);
 
+/*
+ * Make sure write_begin will not have to sleep on the page at @pos: wait
+ * for it to be unlocked, and start reading it in first if the write
+ * covers only part of it.  write_begin itself is left to lock the page
+ * and take care of any race.
+ */
+static int prepare_write_page_async(struct file *file,
+		struct address_space *mapping, loff_t pos, unsigned long bytes,
+		struct wait_bit_queue *wait)
+{
+	pgoff_t index = pos >> PAGE_CACHE_SHIFT;
+	struct page *page;
+	int partial;
+	int ret;
+
+	partial = bytes < PAGE_CACHE_SIZE && mapping->a_ops->readpage &&
+		  ((loff_t)index << PAGE_CACHE_SHIFT) < i_size_read(mapping->host);
+
+	page = find_get_page(mapping, index);
+	if (page) {
+		ret = wait_on_page_locked_async(page, wait);
+		if (ret || !partial || PageUptodate(page))
+			goto out;
+		page_cache_release(page);
+	} else if (!partial)
+		return 0;
+
+	page = read_cache_page_async(mapping, index,
+			(filler_t *)mapping->a_ops->readpage, file);
+	if (IS_ERR(page))
+		return 0;	/* let write_begin deal with it */
+	ret = wait_on_page_locked_async(page, wait);
+out:
+	page_cache_release(page);
+	return ret;
+}
+
 static ssize_t generic_perform_write(struct file *file,
-				struct iov_iter *i, loff_t pos)
+				struct iov_iter *i, loff_t pos,
+				struct wait_bit_queue *wait)
 {
 	struct address_space *mapping = file->f_mapping;
 	const struct address_space_operations *a_ops = mapping->a_ops;
@@ -2406,6 +2524,13 @@ again:
 			break;
 		}
 
+		if (wait) {
+			status = prepare_write_page_async(file, mapping,
+							  pos, bytes, wait);
+			if (status)
+				break;
+		}
+
 		status = a_ops->write_begin(file, mapping, pos, bytes, flags,
 						&page, &fsdata);
 		if (unlikely(status))
@@ -2463,7 +2588,8 @@ generic_file_buffered_write(struct kiocb *iocb, const struct iovec *iov,
 	struct iov_iter i;
 
 	iov_iter_init(&i, iov, nr_segs, count, written);
-	status = generic_perform_write(file, &i, pos);
+	status = generic_perform_write(file, &i, pos,
+			(file->f_flags & O_DIRECT) ? NULL : kiocb_async_wait(iocb));
 
 	if (likely(status >= 0)) {
 		written += status;
@@ -5252,7 +5252,7 @@ unsigned long pagecache_over_limit()
 				        + global_page_state(NR_INACTIVE_FILE);
 	unsigned long free_pages = global_page_state(NR_FREE_PAGES);
 	/* In theory, we'd need to take the swap lock here ... */
-	unsigned long swap_pages = total_swap_pages - nr_swap_pages;
+	unsigned long swap_pages = total_swap_pages - get_nr_swap_pages();
 	unsigned long limit;
 
 	if (vm_pagecache_ignore_dirty != 0)
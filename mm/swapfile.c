@@ -41,10 +41,11 @@
 
 static DEFINE_SPINLOCK(swap_lock);
 static unsigned int nr_swapfiles;
-long nr_swap_pages;
+atomic_long_t nr_swap_pages;
 long total_swap_pages;
 static int swap_overflow;
 static int least_priority;
+static atomic_t highest_priority_index = ATOMIC_INIT(-1);
 
 static const char Bad_file[] = "Bad swap file entry ";
 static const char Unused_file[] = "Unused swap file entry ";
@@ -176,7 +177,7 @@ static int discard_swap(struct swap_info_struct *si)
 }
 
 /*
- * swap allocation tell device that a cluster of swap can now be discarded,
+ * tell device that a freed cluster of swap can now be discarded,
  * to allow the swap device to optimize its wear-levelling.
  */
 static void discard_swap_cluster(struct swap_info_struct *si,
@@ -217,14 +218,282 @@ static void discard_swap_cluster(struct swap_info_struct *si,
 	}
 }
 
-static int wait_for_discard(void *word)
+#define SWAPFILE_CLUSTER	256
+#define LATENCY_LIMIT		256
+
+static inline void cluster_set_flag(struct swap_cluster_info *info,
+				    unsigned int flag)
 {
-	schedule();
-	return 0;
+	info->flags = flag;
 }
 
-#define SWAPFILE_CLUSTER	256
-#define LATENCY_LIMIT		256
+static inline unsigned int cluster_count(struct swap_cluster_info *info)
+{
+	return info->data;
+}
+
+static inline void cluster_set_count(struct swap_cluster_info *info,
+				     unsigned int count)
+{
+	info->data = count;
+}
+
+static inline unsigned int cluster_next(struct swap_cluster_info *info)
+{
+	return info->data;
+}
+
+static inline void cluster_set_next(struct swap_cluster_info *info,
+				    unsigned int next)
+{
+	info->data = next;
+}
+
+static inline void cluster_set_next_flag(struct swap_cluster_info *info,
+					 unsigned int next, unsigned int flag)
+{
+	info->flags = flag;
+	info->data = next;
+}
+
+static inline bool cluster_is_free(struct swap_cluster_info *info)
+{
+	return info->flags & CLUSTER_FLAG_FREE;
+}
+
+static inline bool cluster_is_null(struct swap_cluster_info *info)
+{
+	return info->flags & CLUSTER_FLAG_NEXT_NULL;
+}
+
+static inline void cluster_set_null(struct swap_cluster_info *info)
+{
+	cluster_set_next_flag(info, 0, CLUSTER_FLAG_NEXT_NULL);
+}
+
+static inline void cluster_list_init(struct swap_cluster_list *list)
+{
+	cluster_set_null(&list->head);
+	cluster_set_null(&list->tail);
+}
+
+static inline bool cluster_list_empty(struct swap_cluster_list *list)
+{
+	return cluster_is_null(&list->head);
+}
+
+static inline unsigned int cluster_list_first(struct swap_cluster_list *list)
+{
+	return cluster_next(&list->head);
+}
+
+static void cluster_list_add_tail(struct swap_cluster_list *list,
+				  struct swap_cluster_info *ci,
+				  unsigned int idx)
+{
+	if (cluster_list_empty(list)) {
+		cluster_set_next_flag(&list->head, idx, 0);
+	} else {
+		unsigned int tail = cluster_next(&list->tail);
+
+		cluster_set_next(&ci[tail], idx);
+	}
+	cluster_set_next_flag(&list->tail, idx, 0);
+}
+
+static unsigned int cluster_list_del_first(struct swap_cluster_list *list,
+					   struct swap_cluster_info *ci)
+{
+	unsigned int idx = cluster_next(&list->head);
+
+	if (cluster_next(&list->tail) == idx)
+		cluster_list_init(list);
+	else
+		cluster_set_next_flag(&list->head, cluster_next(&ci[idx]), 0);
+	return idx;
+}
+
+/*
+ * A cluster of a discardable area that has just become empty goes on
+ * the discard list; it is discarded from a workqueue, or by the next
+ * allocation that finds no free cluster, and only then made free.  Its
+ * slots are marked bad meanwhile, so that no scan allocates them.
+ */
+static void swap_cluster_schedule_discard(struct swap_info_struct *si,
+					  unsigned int idx)
+{
+	unsigned short *map = si->swap_map + idx * SWAPFILE_CLUSTER;
+	int i;
+
+	for (i = 0; i < SWAPFILE_CLUSTER; i++)
+		map[i] = SWAP_MAP_BAD;
+
+	cluster_list_add_tail(&si->discard_clusters, si->cluster_info, idx);
+	schedule_work(&si->discard_work);
+}
+
+/*
+ * Discard all clusters on the discard list and put them on the free
+ * list.  Called with si->lock held, which is dropped for the discards.
+ */
+static void swap_do_scheduled_discard(struct swap_info_struct *si)
+{
+	struct swap_cluster_info *info = si->cluster_info;
+	unsigned long start;
+	unsigned int idx;
+	int i;
+
+	while (!cluster_list_empty(&si->discard_clusters)) {
+		idx = cluster_list_del_first(&si->discard_clusters, info);
+		start = idx * SWAPFILE_CLUSTER;
+		spin_unlock(&si->lock);
+
+		discard_swap_cluster(si, start, SWAPFILE_CLUSTER);
+
+		spin_lock(&si->lock);
+		cluster_set_flag(&info[idx], CLUSTER_FLAG_FREE);
+		cluster_list_add_tail(&si->free_clusters, info, idx);
+		for (i = 0; i < SWAPFILE_CLUSTER; i++)
+			si->swap_map[start + i] = 0;
+		if (start < si->lowest_bit)
+			si->lowest_bit = start;
+		if (start + SWAPFILE_CLUSTER - 1 > si->highest_bit)
+			si->highest_bit = start + SWAPFILE_CLUSTER - 1;
+	}
+}
+
+static void swap_discard_work(struct work_struct *work)
+{
+	struct swap_info_struct *si;
+
+	si = container_of(work, struct swap_info_struct, discard_work);
+
+	spin_lock(&si->lock);
+	swap_do_scheduled_discard(si);
+	spin_unlock(&si->lock);
+}
+
+/*
+ * Account a slot allocated in its cluster, taking the cluster off the
+ * free list if it was free.
+ */
+static void inc_cluster_info_page(struct swap_info_struct *si,
+				  unsigned long offset)
+{
+	struct swap_cluster_info *info = si->cluster_info;
+	unsigned long idx = offset / SWAPFILE_CLUSTER;
+
+	if (!info)
+		return;
+	if (cluster_is_free(&info[idx])) {
+		VM_BUG_ON(cluster_list_first(&si->free_clusters) != idx);
+		cluster_list_del_first(&si->free_clusters, info);
+		cluster_set_next_flag(&info[idx], 0, 0);
+	}
+
+	VM_BUG_ON(cluster_count(&info[idx]) >= SWAPFILE_CLUSTER);
+	cluster_set_count(&info[idx], cluster_count(&info[idx]) + 1);
+}
+
+/*
+ * Account a slot freed in its cluster.  Once the cluster is empty, it
+ * is freed, or on a discardable area, scheduled for discard first.
+ */
+static void dec_cluster_info_page(struct swap_info_struct *si,
+				  unsigned long offset)
+{
+	struct swap_cluster_info *info = si->cluster_info;
+	unsigned long idx = offset / SWAPFILE_CLUSTER;
+
+	if (!info)
+		return;
+
+	VM_BUG_ON(cluster_count(&info[idx]) == 0);
+	cluster_set_count(&info[idx], cluster_count(&info[idx]) - 1);
+	if (cluster_count(&info[idx]))
+		return;
+
+	if ((si->flags & (SWP_WRITEOK | SWP_DISCARDABLE)) ==
+	    (SWP_WRITEOK | SWP_DISCARDABLE)) {
+		swap_cluster_schedule_discard(si, idx);
+		return;
+	}
+
+	cluster_set_flag(&info[idx], CLUSTER_FLAG_FREE);
+	cluster_list_add_tail(&si->free_clusters, info, idx);
+}
+
+/*
+ * The linear scan may find a slot in a free cluster.  Allocating from
+ * any free cluster but the first one on the free list would break the
+ * list, so drop our cluster and start again from the list's head.
+ */
+static bool scan_swap_map_ssd_cluster_conflict(struct swap_info_struct *si,
+					       unsigned long offset)
+{
+	struct percpu_cluster *cluster;
+	unsigned long idx = offset / SWAPFILE_CLUSTER;
+
+	if (cluster_list_empty(&si->free_clusters) ||
+	    cluster_list_first(&si->free_clusters) == idx ||
+	    !cluster_is_free(&si->cluster_info[idx]))
+		return false;
+
+	cluster = per_cpu_ptr(si->percpu_cluster, smp_processor_id());
+	cluster_set_null(&cluster->index);
+	return true;
+}
+
+/*
+ * On a solid state area, each CPU allocates sequentially from its own
+ * cluster and takes the first free cluster when that one is used up.
+ * Without free clusters, *offset is left alone and the caller falls back
+ * to scanning for any free slot.
+ */
+static void scan_swap_map_try_ssd_cluster(struct swap_info_struct *si,
+					  unsigned long *offset,
+					  unsigned long *scan_base)
+{
+	struct percpu_cluster *cluster;
+	unsigned long tmp, end;
+
+new_cluster:
+	cluster = per_cpu_ptr(si->percpu_cluster, smp_processor_id());
+	if (cluster_is_null(&cluster->index)) {
+		if (!cluster_list_empty(&si->free_clusters)) {
+			cluster->index = si->free_clusters.head;
+			cluster->next = cluster_next(&cluster->index) *
+					SWAPFILE_CLUSTER;
+		} else if (!cluster_list_empty(&si->discard_clusters) &&
+			   (si->flags & SWP_WRITEOK)) {
+			/*
+			 * No free cluster, but some are waiting to be
+			 * discarded: discard them now, and reuse them.
+			 */
+			swap_do_scheduled_discard(si);
+			*scan_base = *offset = si->cluster_next;
+			goto new_cluster;
+		} else
+			return;
+	}
+
+	/*
+	 * Other CPUs may have allocated from our cluster when they found
+	 * no free one, so check it still has a free slot.
+	 */
+	tmp = cluster->next;
+	end = min_t(unsigned long, si->max,
+		    (cluster_next(&cluster->index) + 1) * SWAPFILE_CLUSTER);
+	while (tmp < end && si->swap_map[tmp])
+		tmp++;
+	if (tmp >= end) {
+		cluster_set_null(&cluster->index);
+		goto new_cluster;
+	}
+	cluster->next = tmp + 1;
+	*offset = tmp;
+	*scan_base = tmp;
+}
 
 static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 					  int cache)
@@ -233,7 +502,6 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 	unsigned long scan_base;
 	unsigned long last_in_cluster = 0;
 	int latency_ration = LATENCY_LIMIT;
-	int found_free_cluster = 0;
 
 	/*
 	 * We try to cluster swap pages by allocating them sequentially
@@ -244,41 +512,30 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 	 * overall disk seek times between swap pages.  -- sct
 	 * But we do now try to find an empty cluster.  -Andrea
 	 * And we let swap pages go all over an SSD partition.  Hugh
+	 * Where each CPU now fills a cluster of its own, taken from a
+	 * list of free clusters rather than searched for.
 	 */
 
 	si->flags += SWP_SCANNING;
 	scan_base = offset = si->cluster_next;
 
+	if (si->cluster_info) {
+		scan_swap_map_try_ssd_cluster(si, &offset, &scan_base);
+		goto checks;
+	}
+
 	if (unlikely(!si->cluster_nr--)) {
 		if (si->pages - si->inuse_pages < SWAPFILE_CLUSTER) {
 			si->cluster_nr = SWAPFILE_CLUSTER - 1;
 			goto checks;
 		}
-		if (si->flags & SWP_DISCARDABLE) {
-			/*
-			 * Start range check on racing allocations, in case
-			 * they overlap the cluster we eventually decide on
-			 * (we scan without swap_lock to allow preemption).
-			 * It's hardly conceivable that cluster_nr could be
-			 * wrapped during our scan, but don't depend on it.
-			 */
-			if (si->lowest_alloc)
-				goto checks;
-			si->lowest_alloc = si->max;
-			si->highest_alloc = 0;
-		}
-		spin_unlock(&swap_lock);
+		spin_unlock(&si->lock);
 
 		/*
-		 * If seek is expensive, start searching for new cluster from
-		 * start of partition, to minimize the span of allocated swap.
-		 * But if seek is cheap, search from our current position, so
-		 * that swap is allocated from all over the partition: if the
-		 * Flash Translation Layer only remaps within limited zones,
-		 * we don't want to wear out the first zone too quickly.
+		 * Start searching for new cluster from start of partition,
+		 * to minimize the span of allocated swap.
 		 */
-		if (!(si->flags & SWP_SOLIDSTATE))
-			scan_base = offset = si->lowest_bit;
+		scan_base = offset = si->lowest_bit;
 		last_in_cluster = offset + SWAPFILE_CLUSTER - 1;
 
 		/* Locate the first empty (unaligned) cluster */
@@ -286,32 +543,10 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 			if (si->swap_map[offset])
 				last_in_cluster = offset + SWAPFILE_CLUSTER;
 			else if (offset == last_in_cluster) {
-				spin_lock(&swap_lock);
+				spin_lock(&si->lock);
 				offset -= SWAPFILE_CLUSTER - 1;
 				si->cluster_next = offset;
 				si->cluster_nr = SWAPFILE_CLUSTER - 1;
-				found_free_cluster = 1;
-				goto checks;
-			}
-			if (unlikely(--latency_ration < 0)) {
-				cond_resched();
-				latency_ration = LATENCY_LIMIT;
-			}
-		}
-
-		offset = si->lowest_bit;
-		last_in_cluster = offset + SWAPFILE_CLUSTER - 1;
-
-		/* Locate the first empty (unaligned) cluster */
-		for (; last_in_cluster < scan_base; offset++) {
-			if (si->swap_map[offset])
-				last_in_cluster = offset + SWAPFILE_CLUSTER;
-			else if (offset == last_in_cluster) {
-				spin_lock(&swap_lock);
-				offset -= SWAPFILE_CLUSTER - 1;
-				si->cluster_next = offset;
-				si->cluster_nr = SWAPFILE_CLUSTER - 1;
-				found_free_cluster = 1;
 				goto checks;
 			}
 			if (unlikely(--latency_ration < 0)) {
@@ -321,9 +556,8 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 		}
 
 		offset = scan_base;
-		spin_lock(&swap_lock);
+		spin_lock(&si->lock);
 		si->cluster_nr = SWAPFILE_CLUSTER - 1;
-		si->lowest_alloc = 0;
 	}
 
 checks:
@@ -333,13 +567,17 @@ checks:
 		goto no_page;
 	if (offset > si->highest_bit)
 		scan_base = offset = si->lowest_bit;
+	if (si->cluster_info) {
+		while (scan_swap_map_ssd_cluster_conflict(si, offset))
+			scan_swap_map_try_ssd_cluster(si, &offset, &scan_base);
+	}
 
 	/* reuse swap entry of cache-only swap if not busy. */
 	if (vm_swap_full() && si->swap_map[offset] == SWAP_HAS_CACHE) {
 		int swap_was_freed;
-		spin_unlock(&swap_lock);
+		spin_unlock(&si->lock);
 		swap_was_freed = __try_to_reclaim_swap(si, offset);
-		spin_lock(&swap_lock);
+		spin_lock(&si->lock);
 		/* entry was freed successfully, try to use this again */
 		if (swap_was_freed)
 			goto checks;
@@ -362,73 +600,21 @@ checks:
 		si->swap_map[offset] = encode_swapmap(0, true);
 	else /* at suspend */
 		si->swap_map[offset] = encode_swapmap(1, false);
+	inc_cluster_info_page(si, offset);
 	si->cluster_next = offset + 1;
 	si->flags -= SWP_SCANNING;
 
-	if (si->lowest_alloc) {
-		/*
-		 * Only set when SWP_DISCARDABLE, and there's a scan
-		 * for a free cluster in progress or just completed.
-		 */
-		if (found_free_cluster) {
-			/*
-			 * To optimize wear-levelling, discard the
-			 * old data of the cluster, taking care not to
-			 * discard any of its pages that have already
-			 * been allocated by racing tasks (offset has
-			 * already stepped over any at the beginning).
-			 */
-			if (offset < si->highest_alloc &&
-			    si->lowest_alloc <= last_in_cluster)
-				last_in_cluster = si->lowest_alloc - 1;
-			si->flags |= SWP_DISCARDING;
-			spin_unlock(&swap_lock);
-
-			if (offset < last_in_cluster)
-				discard_swap_cluster(si, offset,
-					last_in_cluster - offset + 1);
-
-			spin_lock(&swap_lock);
-			si->lowest_alloc = 0;
-			si->flags &= ~SWP_DISCARDING;
-
-			smp_mb();	/* wake_up_bit advises this */
-			wake_up_bit(&si->flags, ilog2(SWP_DISCARDING));
-
-		} else if (si->flags & SWP_DISCARDING) {
-			/*
-			 * Delay using pages allocated by racing tasks
-			 * until the whole discard has been issued. We
-			 * could defer that delay until swap_writepage,
-			 * but it's easier to keep this self-contained.
-			 */
-			spin_unlock(&swap_lock);
-			wait_on_bit(&si->flags, ilog2(SWP_DISCARDING),
-				wait_for_discard, TASK_UNINTERRUPTIBLE);
-			spin_lock(&swap_lock);
-		} else {
-			/*
-			 * Note pages allocated by racing tasks while
-			 * scan for a free cluster is in progress, so
-			 * that its final discard can exclude them.
-			 */
-			if (offset < si->lowest_alloc)
-				si->lowest_alloc = offset;
-			if (offset > si->highest_alloc)
-				si->highest_alloc = offset;
-		}
-	}
 	return offset;
 
 scan:
-	spin_unlock(&swap_lock);
+	spin_unlock(&si->lock);
 	while (++offset <= si->highest_bit) {
 		if (!si->swap_map[offset]) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			goto checks;
 		}
 		if (vm_swap_full() && si->swap_map[offset] == SWAP_HAS_CACHE) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			goto checks;
 		}
 		if (unlikely(--latency_ration < 0)) {
@@ -439,11 +625,11 @@ scan:
 	offset = si->lowest_bit;
 	while (++offset < scan_base) {
 		if (!si->swap_map[offset]) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			goto checks;
 		}
 		if (vm_swap_full() && si->swap_map[offset] == SWAP_HAS_CACHE) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			goto checks;
 		}
 		if (unlikely(--latency_ration < 0)) {
@@ -451,26 +637,54 @@ scan:
 			latency_ration = LATENCY_LIMIT;
 		}
 	}
-	spin_lock(&swap_lock);
+	spin_lock(&si->lock);
 
 no_page:
 	si->flags -= SWP_SCANNING;
 	return 0;
 }
 
+/*
+ * Remember the highest priority area a slot was freed on, so that
+ * get_swap_page() goes back to it without swap_entry_free() having to
+ * take swap_lock.
+ */
+static void set_highest_priority_index(int type)
+{
+	int old_hp_index, new_hp_index;
+
+	do {
+		old_hp_index = atomic_read(&highest_priority_index);
+		if (old_hp_index != -1 &&
+		    swap_info[old_hp_index].prio >= swap_info[type].prio)
+			break;
+		new_hp_index = type;
+	} while (atomic_cmpxchg(&highest_priority_index,
+				old_hp_index, new_hp_index) != old_hp_index);
+}
+
 swp_entry_t get_swap_page(void)
 {
 	struct swap_info_struct *si;
 	pgoff_t offset;
 	int type, next;
 	int wrapped = 0;
+	int hp_index;
 
 	spin_lock(&swap_lock);
-	if (nr_swap_pages <= 0)
+	if (get_nr_swap_pages() <= 0)
 		goto noswap;
-	nr_swap_pages--;
+	atomic_long_dec(&nr_swap_pages);
 
 	for (type = swap_list.next; type >= 0 && wrapped < 2; type = next) {
+		hp_index = atomic_xchg(&highest_priority_index, -1);
+		if (hp_index != -1 && hp_index != type &&
+		    swap_info[type].prio < swap_info[hp_index].prio &&
+		    (swap_info[hp_index].flags & SWP_WRITEOK)) {
+			type = hp_index;
+			swap_list.next = type;
+		}
+
 		si = swap_info + type;
 		next = si->next;
 		if (next < 0 ||
@@ -479,22 +693,24 @@ swp_entry_t get_swap_page(void)
 			wrapped++;
 		}
 
-		if (!si->highest_bit)
-			continue;
-		if (!(si->flags & SWP_WRITEOK))
+		spin_lock(&si->lock);
+		if (!si->highest_bit || !(si->flags & SWP_WRITEOK)) {
+			spin_unlock(&si->lock);
 			continue;
+		}
 
 		swap_list.next = next;
+		spin_unlock(&swap_lock);
 		/* This is called for allocating swap entry for cache */
 		offset = scan_swap_map(si, SWAP_CACHE);
-		if (offset) {
-			spin_unlock(&swap_lock);
+		spin_unlock(&si->lock);
+		if (offset)
 			return swp_entry(type, offset);
-		}
+		spin_lock(&swap_lock);
 		next = swap_list.next;
 	}
 
-	nr_swap_pages++;
+	atomic_long_inc(&nr_swap_pages);
 noswap:
 	spin_unlock(&swap_lock);
 	return (swp_entry_t) {0};
@@ -506,19 +722,19 @@ swp_entry_t get_swap_page_of_type(int type)
 	struct swap_info_struct *si;
 	pgoff_t offset;
 
-	spin_lock(&swap_lock);
 	si = swap_info + type;
+	spin_lock(&si->lock);
 	if (si->flags & SWP_WRITEOK) {
-		nr_swap_pages--;
+		atomic_long_dec(&nr_swap_pages);
 		/* This is called for allocating swap entry, not cache */
 		offset = scan_swap_map(si, SWAP_MAP);
 		if (offset) {
-			spin_unlock(&swap_lock);
+			spin_unlock(&si->lock);
 			return swp_entry(type, offset);
 		}
-		nr_swap_pages++;
+		atomic_long_inc(&nr_swap_pages);
 	}
-	spin_unlock(&swap_lock);
+	spin_unlock(&si->lock);
 	return (swp_entry_t) {0};
 }
 
@@ -540,7 +756,7 @@ static struct swap_info_struct * swap_info_get(swp_entry_t entry)
 		goto bad_offset;
 	if (!p->swap_map[offset])
 		goto bad_free;
-	spin_lock(&swap_lock);
+	spin_lock(&p->lock);
 	return p;
 
 bad_free:
@@ -585,10 +801,10 @@ static int swap_entry_free(struct swap_info_struct *p,
 			p->lowest_bit = offset;
 		if (offset > p->highest_bit)
 			p->highest_bit = offset;
-		if (p->prio > swap_info[swap_list.next].prio)
-			swap_list.next = p - swap_info;
-		nr_swap_pages++;
+		set_highest_priority_index(p - swap_info);
+		atomic_long_inc(&nr_swap_pages);
 		p->inuse_pages--;
+		dec_cluster_info_page(p, offset);
 		preswap_flush(p - swap_info, offset);
 	}
 	if (!swap_count(count))
@@ -607,7 +823,7 @@ void swap_free(swp_entry_t entry)
 	p = swap_info_get(entry);
 	if (p) {
 		swap_entry_free(p, entry, SWAP_MAP);
-		spin_unlock(&swap_lock);
+		spin_unlock(&p->lock);
 	}
 }
 
@@ -630,7 +846,7 @@ void swapcache_free(swp_entry_t entry, struct page *page)
 				swapout = false; /* no more swap users! */
 			mem_cgroup_uncharge_swapcache(page, entry, swapout);
 		}
-		spin_unlock(&swap_lock);
+		spin_unlock(&p->lock);
 	}
 	return;
 }
@@ -648,7 +864,7 @@ static inline int page_swapcount(struct page *page)
 	p = swap_info_get(entry);
 	if (p) {
 		count = swap_count(p->swap_map[swp_offset(entry)]);
-		spin_unlock(&swap_lock);
+		spin_unlock(&p->lock);
 	}
 	return count;
 }
@@ -716,7 +932,7 @@ int free_swap_and_cache(swp_entry_t entry)
 				page = NULL;
 			}
 		}
-		spin_unlock(&swap_lock);
+		spin_unlock(&p->lock);
 	}
 	if (page) {
 		/*
@@ -798,12 +1014,16 @@ unsigned int count_swap_pages(int type, int free)
 	unsigned int n = 0;
 
 	if (type < nr_swapfiles) {
+		struct swap_info_struct *sis = swap_info + type;
+
 		spin_lock(&swap_lock);
-		if (swap_info[type].flags & SWP_WRITEOK) {
-			n = swap_info[type].pages;
+		spin_lock(&sis->lock);
+		if (sis->flags & SWP_WRITEOK) {
+			n = sis->pages;
 			if (free)
-				n -= swap_info[type].inuse_pages;
+				n -= sis->inuse_pages;
 		}
+		spin_unlock(&sis->lock);
 		spin_unlock(&swap_lock);
 	}
 	return n;
@@ -1210,9 +1430,9 @@ static int try_to_unuse(unsigned int type, unsigned int preswap,
 			goto retry;
 
 		if (swap_count(*swap_map) == SWAP_MAP_MAX) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			*swap_map = encode_swapmap(0, true);
-			spin_unlock(&swap_lock);
+			spin_unlock(&si->lock);
 			reset_overflow = 1;
 		}
 
@@ -1547,6 +1767,8 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 {
 	struct swap_info_struct * p = NULL;
 	unsigned short *swap_map;
+	struct swap_cluster_info *cluster_info;
+	struct percpu_cluster *percpu_cluster;
 	struct file *swap_file, *victim;
 	struct address_space *mapping;
 	struct inode *inode;
@@ -1605,9 +1827,11 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 			swap_info[i].prio = p->prio--;
 		least_priority++;
 	}
-	nr_swap_pages -= p->pages;
+	spin_lock(&p->lock);
+	atomic_long_sub(p->pages, &nr_swap_pages);
 	total_swap_pages -= p->pages;
 	p->flags &= ~SWP_WRITEOK;
+	spin_unlock(&p->lock);
 	spin_unlock(&swap_lock);
 
 	current->flags |= PF_OOM_ORIGIN;
@@ -1630,13 +1854,21 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 			swap_list.head = swap_list.next = p - swap_info;
 		else
 			swap_info[prev].next = p - swap_info;
-		nr_swap_pages += p->pages;
+		spin_lock(&p->lock);
+		atomic_long_add(p->pages, &nr_swap_pages);
 		total_swap_pages += p->pages;
 		p->flags |= SWP_WRITEOK;
+		spin_unlock(&p->lock);
 		spin_unlock(&swap_lock);
 		goto out_dput;
 	}
 
+	/*
+	 * Without SWP_WRITEOK, freed clusters are no longer scheduled for
+	 * discard; finish those that were.
+	 */
+	flush_work(&p->discard_work);
+
 	/* wait for any unplug function to finish */
 	down_write(&swap_unplug_sem);
 	up_write(&swap_unplug_sem);
@@ -1645,13 +1877,16 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
 	drain_mmlist();
+	spin_lock(&p->lock);
 
 	/* wait for anyone still in scan_swap_map */
 	p->highest_bit = 0;		/* cuts scans short */
 	while (p->flags >= SWP_SCANNING) {
+		spin_unlock(&p->lock);
 		spin_unlock(&swap_lock);
 		schedule_timeout_uninterruptible(1);
 		spin_lock(&swap_lock);
+		spin_lock(&p->lock);
 	}
 
 	swap_file = p->swap_file;
@@ -1659,11 +1894,18 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->max = 0;
 	swap_map = p->swap_map;
 	p->swap_map = NULL;
+	cluster_info = p->cluster_info;
+	p->cluster_info = NULL;
+	percpu_cluster = p->percpu_cluster;
+	p->percpu_cluster = NULL;
 	p->flags = 0;
 	preswap_flush_area(p - swap_info);
+	spin_unlock(&p->lock);
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
 	vfree(swap_map);
+	vfree(cluster_info);
+	free_percpu(percpu_cluster);
 #ifdef CONFIG_PRESWAP
 	if (p->preswap_map)
 		vfree(p->preswap_map);
@@ -1804,6 +2046,53 @@ late_initcall(max_swapfiles_check);
  *
  * The swapon system call
  */
+/*
+ * Set up the cluster allocator of a solid state area: count the slots of
+ * each cluster that are bad or lie beyond the end of the area, and put
+ * the empty clusters on the free list, starting from cluster_next so
+ * that wear is spread over the device.
+ */
+static int setup_swap_clusters(struct swap_info_struct *p,
+			       unsigned short *swap_map,
+			       unsigned long maxpages)
+{
+	unsigned long nr_clusters = DIV_ROUND_UP(maxpages, SWAPFILE_CLUSTER);
+	struct swap_cluster_info *info;
+	unsigned long i, idx;
+	int cpu;
+
+	info = vmalloc(nr_clusters * sizeof(*info));
+	if (!info)
+		return -ENOMEM;
+	memset(info, 0, nr_clusters * sizeof(*info));
+
+	p->percpu_cluster = alloc_percpu(struct percpu_cluster);
+	if (!p->percpu_cluster) {
+		vfree(info);
+		return -ENOMEM;
+	}
+	for_each_possible_cpu(cpu)
+		cluster_set_null(&per_cpu_ptr(p->percpu_cluster, cpu)->index);
+
+	p->cluster_info = info;
+	for (i = 0; i < nr_clusters * SWAPFILE_CLUSTER; i++)
+		if (i >= p->max || swap_map[i])
+			inc_cluster_info_page(p, i);
+
+	cluster_list_init(&p->free_clusters);
+	cluster_list_init(&p->discard_clusters);
+	idx = p->cluster_next / SWAPFILE_CLUSTER;
+	for (i = 0; i < nr_clusters; i++) {
+		if (!cluster_count(&info[idx])) {
+			cluster_set_flag(&info[idx], CLUSTER_FLAG_FREE);
+			cluster_list_add_tail(&p->free_clusters, info, idx);
+		}
+		if (++idx == nr_clusters)
+			idx = 0;
+	}
+	return 0;
+}
+
 SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 {
 	struct swap_info_struct * p;
@@ -1842,6 +2131,8 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		nr_swapfiles = type+1;
 	memset(p, 0, sizeof(*p));
 	INIT_LIST_HEAD(&p->extent_list);
+	spin_lock_init(&p->lock);
+	INIT_WORK(&p->discard_work, swap_discard_work);
 	p->flags = SWP_USED;
 	p->next = -1;
 	spin_unlock(&swap_lock);
@@ -2025,6 +2316,9 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		if (blk_queue_nonrot(bdev_get_queue(p->bdev))) {
 			p->flags |= SWP_SOLIDSTATE;
 			p->cluster_next = 1 + (random32() % p->highest_bit);
+			error = setup_swap_clusters(p, swap_map, maxpages);
+			if (error)
+				goto bad_swap;
 		}
 		if (discard_swap(p) == 0)
 			p->flags |= SWP_DISCARDABLE;
@@ -2032,6 +2326,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
+	spin_lock(&p->lock);
 	if (swap_flags & SWAP_FLAG_PREFER)
 		p->prio =
 		  (swap_flags & SWAP_FLAG_PRIO_MASK) >> SWAP_FLAG_PRIO_SHIFT;
@@ -2042,7 +2337,8 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	p->preswap_map = preswap_map;
 #endif
 	p->flags |= SWP_WRITEOK;
-	nr_swap_pages += nr_good_pages;
+	spin_unlock(&p->lock);
+	atomic_long_add(nr_good_pages, &nr_swap_pages);
 	total_swap_pages += nr_good_pages;
 
 	printk(KERN_INFO "Adding %uk swap on %s.  "
@@ -2085,6 +2381,10 @@ bad_swap_2:
 	spin_unlock(&swap_lock);
 	vfree(preswap_map);
 	vfree(swap_map);
+	vfree(p->cluster_info);
+	p->cluster_info = NULL;
+	free_percpu(p->percpu_cluster);
+	p->percpu_cluster = NULL;
 	if (swap_file)
 		filp_close(swap_file, NULL);
 out:
@@ -2114,7 +2414,7 @@ void si_swapinfo(struct sysinfo *val)
 			continue;
 		nr_to_be_unused += swap_info[i].inuse_pages;
 	}
-	val->freeswap = nr_swap_pages + nr_to_be_unused;
+	val->freeswap = get_nr_swap_pages() + nr_to_be_unused;
 	val->totalswap = total_swap_pages + nr_to_be_unused;
 	spin_unlock(&swap_lock);
 }
@@ -2132,7 +2432,7 @@ void kdb_si_swapinfo(struct sysinfo *val)
 			continue;
 		nr_to_be_unused += swap_info[i].inuse_pages;
 	}
-	val->freeswap = nr_swap_pages + nr_to_be_unused;
+	val->freeswap = get_nr_swap_pages() + nr_to_be_unused;
 	val->totalswap = total_swap_pages + nr_to_be_unused;
 }
 #endif	/* CONFIG_KDB */
@@ -2166,7 +2466,7 @@ static int __swap_duplicate(swp_entry_t entry, bool cache)
 	p = type + swap_info;
 	offset = swp_offset(entry);
 
-	spin_lock(&swap_lock);
+	spin_lock(&p->lock);
 
 	if (unlikely(offset >= p->max))
 		goto unlock_out;
@@ -2201,7 +2501,7 @@ static int __swap_duplicate(swp_entry_t entry, bool cache)
 	} else
 		result = -ENOENT; /* unused swap entry */
 unlock_out:
-	spin_unlock(&swap_lock);
+	spin_unlock(&p->lock);
 out:
 	return result;
 
@@ -2270,7 +2570,7 @@ pgoff_t __page_file_index(struct page *page)
 EXPORT_SYMBOL_GPL(__page_file_index);
 
 /*
- * swap_lock prevents swap_map being freed. Don't grab an extra
+ * si->lock prevents swap_map being freed. Don't grab an extra
  * reference on the swaphandle, it doesn't matter if it becomes unused.
  */
 int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
@@ -2291,9 +2591,9 @@ int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
 	if (!base)		/* first page is swap header */
 		base++;
 
-	spin_lock(&swap_lock);
+	spin_lock(&si->lock);
 	if (preswap_test(si, target)) {
-		spin_unlock(&swap_lock);
+		spin_unlock(&si->lock);
 		return 0;
 	}
 	if (end > si->max)	/* don't go beyond end of map */
@@ -2321,7 +2621,7 @@ int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
 		if (preswap_test(si, toff))
 			break;
 	}
-	spin_unlock(&swap_lock);
+	spin_unlock(&si->lock);
 
 	/*
 	 * Indicate starting offset, and return number of pages to get:
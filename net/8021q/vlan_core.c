@@ -122,6 +122,7 @@ int vlan_gro_frags(struct napi_struct *napi, struct vlan_group *grp,
 		return NET_RX_DROP;
 
 	if (netpoll_rx_on(skb)) {
+		__skb_push(skb, ETH_HLEN);
 		skb->protocol = eth_type_trans(skb, skb->dev);
 		return vlan_hwaccel_receive_skb(skb, grp, vlan_tci);
 	}
@@ -1621,6 +1621,81 @@ struct sk_buff *skb_gso_segment(struct sk_buff *skb, int features)
 }
 EXPORT_SYMBOL(skb_gso_segment);
 
+/**
+ *	skb_tunnel_gso_segment - segment an encapsulated GSO packet
+ *	@skb: buffer to segment, data pointing at the tunnel header
+ *	@features: features for the output path
+ *	@tnl_hlen: length of the tunnel header at skb->data
+ *	@inner_mac_len: length of the inner link layer header, if any
+ *	@inner_protocol: ethertype of the inner network header
+ *	@gso_type: tunnel GSO type to strip for the inner pass
+ *
+ *	Segments the inner packet and then copies the outer headers, from
+ *	the outer MAC header to the end of the tunnel header, in front of
+ *	every resulting segment.  The segments are returned with the outer
+ *	network and transport headers set; fixing up lengths, identifiers
+ *	and checksums in them is left to the caller.  @skb is restored to
+ *	its original state before returning.
+ */
+struct sk_buff *skb_tunnel_gso_segment(struct sk_buff *skb, int features,
+				       unsigned int tnl_hlen,
+				       unsigned int inner_mac_len,
+				       __be16 inner_protocol, int gso_type)
+{
+	struct sk_buff *segs, *seg;
+	int mac_offset = skb_mac_header(skb) - skb->data;
+	int network_offset = skb_network_offset(skb);
+	unsigned int outer_hlen = tnl_hlen - mac_offset;
+	unsigned int mac_len = skb->mac_len;
+	__be16 protocol = skb->protocol;
+
+	if (unlikely(!pskb_may_pull(skb, tnl_hlen + inner_mac_len)))
+		return ERR_PTR(-EINVAL);
+
+	__skb_pull(skb, tnl_hlen);
+	skb_reset_mac_header(skb);
+	skb_set_network_header(skb, inner_mac_len);
+	skb->protocol = inner_protocol;
+	skb_shinfo(skb)->gso_type &= ~gso_type;
+
+	segs = skb_gso_segment(skb, features & (NETIF_F_SG |
+						NETIF_F_HIGHDMA |
+						NETIF_F_FRAGLIST |
+						NETIF_F_GEN_CSUM));
+
+	skb_shinfo(skb)->gso_type |= gso_type;
+	skb->protocol = protocol;
+	__skb_push(skb, tnl_hlen);
+	skb_set_mac_header(skb, mac_offset);
+	skb_set_network_header(skb, network_offset);
+	skb_reset_transport_header(skb);
+
+	if (!segs || IS_ERR(segs))
+		return segs;
+
+	for (seg = segs; seg; seg = seg->next) {
+		if (unlikely(skb_cow_head(seg, outer_hlen))) {
+			while (segs) {
+				seg = segs;
+				segs = segs->next;
+				kfree_skb(seg);
+			}
+			return ERR_PTR(-ENOMEM);
+		}
+
+		__skb_push(seg, outer_hlen);
+		skb_copy_to_linear_data(seg, skb_mac_header(skb), outer_hlen);
+		skb_reset_mac_header(seg);
+		skb_set_network_header(seg, mac_len);
+		skb_set_transport_header(seg, outer_hlen - tnl_hlen);
+		seg->mac_len = mac_len;
+		seg->protocol = protocol;
+	}
+
+	return segs;
+}
+EXPORT_SYMBOL(skb_tunnel_gso_segment);
+
 /* Take action when hardware reception checksum errors are detected. */
 #ifdef CONFIG_BUG
 void netdev_rx_csum_fault(struct net_device *dev)
@@ -1709,7 +1784,7 @@ static int dev_gso_segment(struct sk_buff *skb)
 }
 
 int dev_hard_start_xmit(struct sk_buff *skb, struct net_device *dev,
-			struct netdev_queue *txq)
+			struct netdev_queue *txq, bool more)
 {
 	const struct net_device_ops *ops = dev->netdev_ops;
 	int rc;
@@ -1732,6 +1807,7 @@ int dev_hard_start_xmit(struct sk_buff *skb, struct net_device *dev,
 		if (dev->priv_flags & IFF_XMIT_DST_RELEASE)
 			skb_dst_drop(skb);
 
+		skb->xmit_more = more;
 		rc = ops->ndo_start_xmit(skb, dev);
 		if (rc == NETDEV_TX_OK)
 			txq_trans_update(txq);
@@ -1758,6 +1834,7 @@ gso:
 
 		skb->next = nskb->next;
 		nskb->next = NULL;
+		nskb->xmit_more = more || skb->next;
 		rc = ops->ndo_start_xmit(nskb, dev);
 		if (unlikely(rc != NETDEV_TX_OK)) {
 			nskb->next = skb->next;
@@ -1765,7 +1842,7 @@ gso:
 			return rc;
 		}
 		txq_trans_update(txq);
-		if (unlikely(netif_tx_queue_stopped(txq) && skb->next))
+		if (unlikely(netif_xmit_stopped(txq) && skb->next))
 			return NETDEV_TX_BUSY;
 	} while (skb->next);
 
@@ -1800,16 +1877,183 @@ u16 skb_tx_hash(const struct net_device *dev, const struct sk_buff *skb)
 }
 EXPORT_SYMBOL(skb_tx_hash);
 
+/**
+ *	skb_flow_hash - hash an IP packet by flow
+ *	@skb: packet, with the network header set
+ *
+ *	Hashes the IPv4/IPv6 addresses and, for port based transports, the
+ *	ports.  Addresses and ports are ordered before hashing so that both
+ *	directions of a flow get the same value.  Non-IP packets and IP
+ *	fragments hash by addresses only.  Never returns 0.  The skb is not
+ *	modified, so this is safe on shared buffers.
+ */
+u32 skb_flow_hash(const struct sk_buff *skb)
+{
+	int nhoff = skb_network_offset(skb);
+	u32 addr1, addr2, hash;
+	u8 ip_proto = 0;
+	int ihl;
+	union {
+		u32 v32;
+		u16 v16[2];
+	} ports;
+
+	switch (skb->protocol) {
+	case __constant_htons(ETH_P_IP): {
+		const struct iphdr *iph;
+		struct iphdr _iph;
+
+		iph = skb_header_pointer(skb, nhoff, sizeof(_iph), &_iph);
+		if (!iph || iph->ihl < 5)
+			goto proto;
+		if (!(iph->frag_off & htons(IP_MF | IP_OFFSET)))
+			ip_proto = iph->protocol;
+		addr1 = (__force u32) iph->saddr;
+		addr2 = (__force u32) iph->daddr;
+		ihl = iph->ihl;
+		break;
+	}
+	case __constant_htons(ETH_P_IPV6): {
+		const struct ipv6hdr *ip6;
+		struct ipv6hdr _ip6;
+
+		ip6 = skb_header_pointer(skb, nhoff, sizeof(_ip6), &_ip6);
+		if (!ip6)
+			goto proto;
+		ip_proto = ip6->nexthdr;
+		addr1 = (__force u32) ip6->saddr.s6_addr32[3];
+		addr2 = (__force u32) ip6->daddr.s6_addr32[3];
+		ihl = (40 >> 2);
+		break;
+	}
+	default:
+		goto proto;
+	}
+
+	ports.v32 = 0;
+	switch (ip_proto) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_DCCP:
+	case IPPROTO_SCTP:
+	case IPPROTO_UDPLITE: {
+		const u32 *p;
+		u32 _p;
+
+		p = skb_header_pointer(skb, nhoff + (ihl * 4), sizeof(_p), &_p);
+		if (p) {
+			ports.v32 = *p;
+			if (ports.v16[1] < ports.v16[0])
+				swap(ports.v16[0], ports.v16[1]);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	if (addr2 < addr1)
+		swap(addr1, addr2);
+
+	hash = jhash_3words(addr1, addr2, ports.v32, skb_tx_hashrnd);
+	return hash ? : 1;
+
+proto:
+	hash = jhash_1word((__force u32) skb->protocol, skb_tx_hashrnd);
+	return hash ? : 1;
+}
+EXPORT_SYMBOL(skb_flow_hash);
+
+/*
+ * Transmit packet steering: pick a TX queue among those configured for
+ * the sending CPU, so that transmit completion runs where the packet was
+ * queued.  Returns -1 if there is no map for this CPU.
+ */
+static int get_xps_queue(struct net_device *dev, struct sk_buff *skb)
+{
+#ifdef CONFIG_XPS
+	struct xps_dev_maps *dev_maps;
+	struct xps_map *map;
+	int queue_index = -1;
+
+	rcu_read_lock();
+	dev_maps = rcu_dereference(dev->xps_maps);
+	if (dev_maps) {
+		map = rcu_dereference(
+		    dev_maps->cpu_map[raw_smp_processor_id()]);
+		if (map) {
+			if (map->len == 1)
+				queue_index = map->queues[0];
+			else {
+				u32 hash;
+
+				if (skb->sk && skb->sk->sk_hash)
+					hash = skb->sk->sk_hash;
+				else
+					hash = (__force u16) skb->protocol;
+				hash = jhash_1word(hash, skb_tx_hashrnd);
+				queue_index = map->queues[
+				    ((u64)hash * map->len) >> 32];
+			}
+			if (unlikely(queue_index >= dev->real_num_tx_queues))
+				queue_index = -1;
+		}
+	}
+	rcu_read_unlock();
+
+	return queue_index;
+#else
+	return -1;
+#endif
+}
+
+#ifdef CONFIG_XPS
+static void netif_free_xps_maps(struct net_device *dev)
+{
+	struct xps_dev_maps *dev_maps = dev->xps_maps;
+	int cpu;
+
+	if (!dev_maps)
+		return;
+
+	for_each_possible_cpu(cpu)
+		kfree(dev_maps->cpu_map[cpu]);
+	kfree(dev_maps);
+	dev->xps_maps = NULL;
+}
+#endif
+
 static struct netdev_queue *dev_pick_tx(struct net_device *dev,
 					struct sk_buff *skb)
 {
 	const struct net_device_ops *ops = dev->netdev_ops;
-	u16 queue_index = 0;
+	struct sock *sk = skb->sk;
+	int queue_index = 0;
 
 	if (ops->ndo_select_queue)
 		queue_index = ops->ndo_select_queue(dev, skb);
-	else if (dev->real_num_tx_queues > 1)
-		queue_index = skb_tx_hash(dev, skb);
+	else if (dev->real_num_tx_queues > 1) {
+		/*
+		 * A connected socket keeps the queue it was given while it
+		 * has data in flight, so that its packets are not reordered
+		 * across queues; the queue is recomputed (and the sender may
+		 * have moved to another CPU) whenever skb->ooo_okay says so.
+		 */
+		queue_index = sk_tx_queue_get(sk);
+
+		if (queue_index < 0 || skb->ooo_okay ||
+		    queue_index >= dev->real_num_tx_queues) {
+			int old_index = queue_index;
+
+			queue_index = get_xps_queue(dev, skb);
+			if (queue_index < 0)
+				queue_index = skb_tx_hash(dev, skb);
+
+			if (queue_index != old_index && sk &&
+			    sk->sk_dst_cache == skb_dst(skb))
+				sk_tx_queue_set(sk, queue_index);
+		}
+	}
 
 	skb_set_queue_mapping(skb, queue_index);
 	return netdev_get_tx_queue(dev, queue_index);
@@ -1872,21 +2116,37 @@ static inline int __dev_xmit_skb(struct sk_buff *skb, struct Qdisc *q,
 				 struct netdev_queue *txq)
 {
 	spinlock_t *root_lock = qdisc_lock(q);
+	bool contended;
 	int rc;
 
+	/*
+	 * Heuristic to force contended enqueues to serialize on a
+	 * separate lock before trying to get qdisc main lock.
+	 * This permits the __QDISC_STATE_RUNNING owner to get the lock
+	 * more often and dequeue packets faster.
+	 */
+	contended = test_bit(__QDISC_STATE_RUNNING, &q->state);
+	if (unlikely(contended))
+		spin_lock(&q->busylock);
+
 	spin_lock(root_lock);
 	if (unlikely(test_bit(__QDISC_STATE_DEACTIVATED, &q->state))) {
 		kfree_skb(skb);
 		rc = NET_XMIT_DROP;
 	} else if ((q->flags & TCQ_F_CAN_BYPASS) && !qdisc_qlen(q) &&
+		   !netif_xmit_frozen_or_stopped(txq) &&
 		   !test_and_set_bit(__QDISC_STATE_RUNNING, &q->state)) {
 		/*
 		 * This is a work-conserving queue; there are no old skbs
-		 * waiting to be sent out; and the qdisc is not running -
-		 * xmit the skb directly.
+		 * waiting to be sent out; the TX queue is open and the
+		 * qdisc is not running - xmit the skb directly.
 		 */
 		__qdisc_update_bstats(q, skb->len);
-		if (sch_direct_xmit(skb, q, dev, txq, root_lock))
+		if (unlikely(contended)) {
+			spin_unlock(&q->busylock);
+			contended = false;
+		}
+		if (sch_direct_xmit(skb, q, dev, txq, root_lock, NULL))
 			__qdisc_run(q);
 		else
 			clear_bit(__QDISC_STATE_RUNNING, &q->state);
@@ -1894,9 +2154,17 @@ static inline int __dev_xmit_skb(struct sk_buff *skb, struct Qdisc *q,
 		rc = NET_XMIT_SUCCESS;
 	} else {
 		rc = qdisc_enqueue_root(skb, q);
-		qdisc_run(q);
+		if (!test_and_set_bit(__QDISC_STATE_RUNNING, &q->state)) {
+			if (unlikely(contended)) {
+				spin_unlock(&q->busylock);
+				contended = false;
+			}
+			__qdisc_run(q);
+		}
 	}
 	spin_unlock(root_lock);
+	if (unlikely(contended))
+		spin_unlock(&q->busylock);
 
 	return rc;
 }
@@ -2003,9 +2271,9 @@ gso:
 
 			HARD_TX_LOCK(dev, txq, cpu);
 
-			if (!netif_tx_queue_stopped(txq)) {
+			if (!netif_xmit_stopped(txq)) {
 				rc = NET_XMIT_SUCCESS;
-				if (!dev_hard_start_xmit(skb, dev, txq)) {
+				if (!dev_hard_start_xmit(skb, dev, txq, false)) {
 					HARD_TX_UNLOCK(dev, txq);
 					goto out;
 				}
@@ -2539,7 +2807,7 @@ static int napi_gro_complete(struct sk_buff *skb)
 		if (ptype->type != type || ptype->dev || !ptype->gro_complete)
 			continue;
 
-		err = ptype->gro_complete(skb);
+		err = ptype->gro_complete(skb, 0);
 		break;
 	}
 	rcu_read_unlock();
@@ -2569,6 +2837,68 @@ void napi_gro_flush(struct napi_struct *napi)
 }
 EXPORT_SYMBOL(napi_gro_flush);
 
+/* Move @grow bytes of header from frag0 into the linear area. */
+static void gro_pull_from_frag0(struct sk_buff *skb, int grow)
+{
+	BUG_ON(skb->end - skb->tail < grow);
+
+	memcpy(skb_tail_pointer(skb), NAPI_GRO_CB(skb)->frag0, grow);
+
+	skb->tail += grow;
+	skb->data_len -= grow;
+
+	skb_shinfo(skb)->frags[0].page_offset += grow;
+	skb_shinfo(skb)->frags[0].size -= grow;
+
+	if (unlikely(!skb_shinfo(skb)->frags[0].size)) {
+		put_page(skb_shinfo(skb)->frags[0].page);
+		memmove(skb_shinfo(skb)->frags,
+			skb_shinfo(skb)->frags + 1,
+			--skb_shinfo(skb)->nr_frags);
+	}
+}
+
+/**
+ *	gro_find_receive_by_type - find the GRO receive handler for a protocol
+ *	@type: ethertype of the (inner) packet
+ *
+ *	Used by tunnel GRO handlers to hand the decapsulated header on to
+ *	the next layer.  Must be called under rcu_read_lock().
+ */
+struct packet_type *gro_find_receive_by_type(__be16 type)
+{
+	struct list_head *head = &ptype_base[ntohs(type) & PTYPE_HASH_MASK];
+	struct packet_type *ptype;
+
+	list_for_each_entry_rcu(ptype, head, list) {
+		if (ptype->type != type || ptype->dev || !ptype->gro_receive)
+			continue;
+		return ptype;
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(gro_find_receive_by_type);
+
+/**
+ *	gro_find_complete_by_type - find the GRO complete handler for a protocol
+ *	@type: ethertype of the (inner) packet
+ *
+ *	Must be called under rcu_read_lock().
+ */
+struct packet_type *gro_find_complete_by_type(__be16 type)
+{
+	struct list_head *head = &ptype_base[ntohs(type) & PTYPE_HASH_MASK];
+	struct packet_type *ptype;
+
+	list_for_each_entry_rcu(ptype, head, list) {
+		if (ptype->type != type || ptype->dev || !ptype->gro_complete)
+			continue;
+		return ptype;
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(gro_find_complete_by_type);
+
 int dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 {
 	struct sk_buff **pp = NULL;
@@ -2596,6 +2926,7 @@ int dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 		NAPI_GRO_CB(skb)->same_flow = 0;
 		NAPI_GRO_CB(skb)->flush = 0;
 		NAPI_GRO_CB(skb)->free = 0;
+		NAPI_GRO_CB(skb)->encap_mark = 0;
 
 		pp = ptype->gro_receive(&napi->gro_list, skb);
 		break;
@@ -2631,26 +2962,8 @@ int dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 	ret = GRO_HELD;
 
 pull:
-	if (skb_headlen(skb) < skb_gro_offset(skb)) {
-		int grow = skb_gro_offset(skb) - skb_headlen(skb);
-
-		BUG_ON(skb->end - skb->tail < grow);
-
-		memcpy(skb_tail_pointer(skb), NAPI_GRO_CB(skb)->frag0, grow);
-
-		skb->tail += grow;
-		skb->data_len -= grow;
-
-		skb_shinfo(skb)->frags[0].page_offset += grow;
-		skb_shinfo(skb)->frags[0].size -= grow;
-
-		if (unlikely(!skb_shinfo(skb)->frags[0].size)) {
-			put_page(skb_shinfo(skb)->frags[0].page);
-			memmove(skb_shinfo(skb)->frags,
-				skb_shinfo(skb)->frags + 1,
-				--skb_shinfo(skb)->nr_frags);
-		}
-	}
+	if (skb_headlen(skb) < skb_gro_offset(skb))
+		gro_pull_from_frag0(skb, skb_gro_offset(skb) - skb_headlen(skb));
 
 ok:
 	return ret;
@@ -2752,12 +3065,11 @@ int napi_frags_finish(struct napi_struct *napi, struct sk_buff *skb, int ret)
 	switch (ret) {
 	case GRO_NORMAL:
 	case GRO_HELD:
+		__skb_push(skb, ETH_HLEN);
 		skb->protocol = eth_type_trans(skb, skb->dev);
 
 		if (ret == GRO_NORMAL)
 			return netif_receive_skb(skb);
-
-		skb_gro_pull(skb, -ETH_HLEN);
 		break;
 
 	case GRO_DROP:
@@ -2797,14 +3109,25 @@ struct sk_buff *napi_frags_skb(struct napi_struct *napi)
 		}
 	}
 
-	skb_gro_pull(skb, sizeof(*eth));
-
 	/*
 	 * This works because the only protocols we care about don't require
 	 * special handling.  We'll fix it up properly at the end.
 	 */
 	skb->protocol = eth->h_proto;
 
+	/*
+	 * Move the Ethernet header into the linear area and hide it, so
+	 * that GRO offsets are relative to the network header just as for
+	 * napi_gro_receive().  Tunnel handlers rely on this to find the
+	 * headers of held packets at the same offset.
+	 */
+	if (NAPI_GRO_CB(skb)->frag0) {
+		gro_pull_from_frag0(skb, hlen);
+		NAPI_GRO_CB(skb)->frag0 += hlen;
+		NAPI_GRO_CB(skb)->frag0_len -= hlen;
+	}
+	__skb_pull(skb, sizeof(*eth));
+
 out:
 	return skb;
 }
@@ -5230,6 +5553,9 @@ static void netdev_init_one_queue(struct net_device *dev,
 				  void *_unused)
 {
 	queue->dev = dev;
+#ifdef CONFIG_BQL
+	dql_init(&queue->dql, HZ);
+#endif
 }
 
 static void netdev_init_queues(struct net_device *dev)
@@ -5329,6 +5655,9 @@ void free_netdev(struct net_device *dev)
 
 	release_net(dev_net(dev));
 
+#ifdef CONFIG_XPS
+	netif_free_xps_maps(dev);
+#endif
 	kfree(dev->_tx);
 
 	/* Flush device addresses */
@@ -448,6 +448,439 @@ exit:
 }
 #endif
 
+#ifdef CONFIG_SYSFS
+/*
+ * TX queue objects: /sys/class/net/<dev>/queues/tx-<n>/
+ */
+struct netdev_queue_attribute {
+	struct attribute attr;
+	ssize_t (*show)(struct netdev_queue *queue,
+			struct netdev_queue_attribute *attr, char *buf);
+	ssize_t (*store)(struct netdev_queue *queue,
+			 struct netdev_queue_attribute *attr,
+			 const char *buf, size_t len);
+};
+#define to_netdev_queue_attr(_attr) \
+	container_of(_attr, struct netdev_queue_attribute, attr)
+#define to_netdev_queue(obj) container_of(obj, struct netdev_queue, kobj)
+
+static ssize_t netdev_queue_attr_show(struct kobject *kobj,
+				      struct attribute *attr, char *buf)
+{
+	struct netdev_queue_attribute *attribute = to_netdev_queue_attr(attr);
+	struct netdev_queue *queue = to_netdev_queue(kobj);
+
+	if (!attribute->show)
+		return -EIO;
+
+	return attribute->show(queue, attribute, buf);
+}
+
+static ssize_t netdev_queue_attr_store(struct kobject *kobj,
+				       struct attribute *attr,
+				       const char *buf, size_t count)
+{
+	struct netdev_queue_attribute *attribute = to_netdev_queue_attr(attr);
+	struct netdev_queue *queue = to_netdev_queue(kobj);
+
+	if (!attribute->store)
+		return -EIO;
+
+	return attribute->store(queue, attribute, buf, count);
+}
+
+static struct sysfs_ops netdev_queue_sysfs_ops = {
+	.show = netdev_queue_attr_show,
+	.store = netdev_queue_attr_store,
+};
+
+static inline unsigned int get_netdev_queue_index(struct netdev_queue *queue)
+{
+	return queue - netdev_get_tx_queue(queue->dev, 0);
+}
+
+#ifdef CONFIG_BQL
+/*
+ * Byte queue limits: tx-<n>/byte_queue_limits/
+ */
+static ssize_t bql_show(char *buf, unsigned int value)
+{
+	return sprintf(buf, "%u\n", value);
+}
+
+static ssize_t bql_set(const char *buf, const size_t count,
+		       unsigned int *pvalue)
+{
+	unsigned long value;
+	int err;
+
+	if (!strcmp(buf, "max") || !strcmp(buf, "max\n"))
+		value = DQL_MAX_LIMIT;
+	else {
+		err = strict_strtoul(buf, 10, &value);
+		if (err < 0)
+			return err;
+		if (value > DQL_MAX_LIMIT)
+			return -EINVAL;
+	}
+
+	*pvalue = value;
+
+	return count;
+}
+
+static ssize_t bql_show_hold_time(struct netdev_queue *queue,
+				  struct netdev_queue_attribute *attr,
+				  char *buf)
+{
+	struct dql *dql = &queue->dql;
+
+	return sprintf(buf, "%u\n", jiffies_to_msecs(dql->slack_hold_time));
+}
+
+static ssize_t bql_set_hold_time(struct netdev_queue *queue,
+				 struct netdev_queue_attribute *attribute,
+				 const char *buf, size_t len)
+{
+	struct dql *dql = &queue->dql;
+	unsigned long value;
+	int err;
+
+	err = strict_strtoul(buf, 10, &value);
+	if (err < 0)
+		return err;
+
+	dql->slack_hold_time = msecs_to_jiffies(value);
+
+	return len;
+}
+
+static struct netdev_queue_attribute bql_hold_time_attribute =
+	__ATTR(hold_time, S_IRUGO | S_IWUSR, bql_show_hold_time,
+	       bql_set_hold_time);
+
+static ssize_t bql_show_inflight(struct netdev_queue *queue,
+				 struct netdev_queue_attribute *attr,
+				 char *buf)
+{
+	struct dql *dql = &queue->dql;
+
+	return sprintf(buf, "%u\n", dql->num_queued - dql->num_completed);
+}
+
+static struct netdev_queue_attribute bql_inflight_attribute =
+	__ATTR(inflight, S_IRUGO, bql_show_inflight, NULL);
+
+#define BQL_ATTR(NAME, FIELD)						\
+static ssize_t bql_show_ ## NAME(struct netdev_queue *queue,		\
+				 struct netdev_queue_attribute *attr,	\
+				 char *buf)				\
+{									\
+	return bql_show(buf, queue->dql.FIELD);				\
+}									\
+									\
+static ssize_t bql_set_ ## NAME(struct netdev_queue *queue,		\
+				struct netdev_queue_attribute *attr,	\
+				const char *buf, size_t len)		\
+{									\
+	return bql_set(buf, len, &queue->dql.FIELD);			\
+}									\
+									\
+static struct netdev_queue_attribute bql_ ## NAME ## _attribute =	\
+	__ATTR(NAME, S_IRUGO | S_IWUSR, bql_show_ ## NAME,		\
+	       bql_set_ ## NAME);
+
+BQL_ATTR(limit, limit)
+BQL_ATTR(limit_max, max_limit)
+BQL_ATTR(limit_min, min_limit)
+
+static struct attribute *dql_attrs[] = {
+	&bql_limit_attribute.attr,
+	&bql_limit_max_attribute.attr,
+	&bql_limit_min_attribute.attr,
+	&bql_hold_time_attribute.attr,
+	&bql_inflight_attribute.attr,
+	NULL
+};
+
+static struct attribute_group dql_group = {
+	.name  = "byte_queue_limits",
+	.attrs  = dql_attrs,
+};
+#endif /* CONFIG_BQL */
+
+#ifdef CONFIG_XPS
+static ssize_t show_xps_map(struct netdev_queue *queue,
+			    struct netdev_queue_attribute *attribute,
+			    char *buf)
+{
+	struct net_device *dev = queue->dev;
+	struct xps_dev_maps *dev_maps;
+	unsigned int index = get_netdev_queue_index(queue);
+	cpumask_var_t mask;
+	size_t len;
+	int cpu, i;
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	rcu_read_lock();
+	dev_maps = rcu_dereference(dev->xps_maps);
+	if (dev_maps) {
+		for_each_possible_cpu(cpu) {
+			struct xps_map *map =
+			    rcu_dereference(dev_maps->cpu_map[cpu]);
+
+			if (!map)
+				continue;
+			for (i = 0; i < map->len; i++) {
+				if (map->queues[i] == index) {
+					cpumask_set_cpu(cpu, mask);
+					break;
+				}
+			}
+		}
+	}
+	rcu_read_unlock();
+
+	len = cpumask_scnprintf(buf, PAGE_SIZE - 1, mask);
+	buf[len++] = '\n';
+	free_cpumask_var(mask);
+
+	return len;
+}
+
+static void xps_map_free_rcu(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct xps_map, rcu));
+}
+
+static void xps_dev_maps_free_rcu(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct xps_dev_maps, rcu));
+}
+
+static DEFINE_MUTEX(xps_map_mutex);
+
+/*
+ * Rebuild the per-CPU maps with this queue added for the CPUs in the
+ * new mask and removed for all others.  Writers are serialized by
+ * xps_map_mutex; the transmit path only ever sees complete maps.
+ */
+static ssize_t store_xps_map(struct netdev_queue *queue,
+			     struct netdev_queue_attribute *attribute,
+			     const char *buf, size_t len)
+{
+	struct net_device *dev = queue->dev;
+	unsigned int index = get_netdev_queue_index(queue);
+	struct xps_dev_maps *dev_maps, *new_dev_maps;
+	struct xps_map *map, *new_map;
+	cpumask_var_t mask;
+	int cpu, i, pos, err, nonempty = 0;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	err = bitmap_parse(buf, len, cpumask_bits(mask), nr_cpumask_bits);
+	if (err)
+		goto out_mask;
+
+	err = -ENOMEM;
+	new_dev_maps = kzalloc(max_t(unsigned int, XPS_DEV_MAPS_SIZE,
+				     L1_CACHE_BYTES), GFP_KERNEL);
+	if (!new_dev_maps)
+		goto out_mask;
+
+	mutex_lock(&xps_map_mutex);
+
+	dev_maps = dev->xps_maps;
+
+	for_each_possible_cpu(cpu) {
+		map = dev_maps ? dev_maps->cpu_map[cpu] : NULL;
+		pos = 0;
+		if (map)
+			while (pos < map->len && map->queues[pos] != index)
+				pos++;
+
+		if (cpumask_test_cpu(cpu, mask)) {
+			if (map && pos < map->len) {
+				new_map = map;
+			} else {
+				unsigned int alloc_len = map ? map->len + 1 : 0;
+
+				alloc_len = max_t(unsigned int, alloc_len,
+						  XPS_MIN_MAP_ALLOC);
+				new_map = kzalloc_node(XPS_MAP_SIZE(alloc_len),
+						       GFP_KERNEL,
+						       cpu_to_node(cpu));
+				if (!new_map)
+					goto error;
+				new_map->alloc_len = alloc_len;
+				for (i = 0; map && i < map->len; i++)
+					new_map->queues[i] = map->queues[i];
+				new_map->len = i;
+				new_map->queues[new_map->len++] = index;
+			}
+		} else if (map && pos < map->len) {
+			new_map = NULL;
+			if (map->len > 1) {
+				new_map = kzalloc_node(XPS_MAP_SIZE(map->len),
+						       GFP_KERNEL,
+						       cpu_to_node(cpu));
+				if (!new_map)
+					goto error;
+				new_map->alloc_len = map->len;
+				for (i = 0; i < map->len; i++)
+					if (i != pos)
+						new_map->queues[new_map->len++] =
+						    map->queues[i];
+			}
+		} else
+			new_map = map;
+
+		new_dev_maps->cpu_map[cpu] = new_map;
+		if (new_map)
+			nonempty = 1;
+	}
+
+	/* Publish the new maps, then retire what they replaced. */
+	if (!nonempty) {
+		kfree(new_dev_maps);
+		new_dev_maps = NULL;
+	}
+	rcu_assign_pointer(dev->xps_maps, new_dev_maps);
+
+	if (dev_maps) {
+		for_each_possible_cpu(cpu) {
+			map = dev_maps->cpu_map[cpu];
+			if (map && (!new_dev_maps ||
+				    new_dev_maps->cpu_map[cpu] != map))
+				call_rcu(&map->rcu, xps_map_free_rcu);
+		}
+		call_rcu(&dev_maps->rcu, xps_dev_maps_free_rcu);
+	}
+
+	mutex_unlock(&xps_map_mutex);
+	free_cpumask_var(mask);
+	return len;
+
+error:
+	for_each_possible_cpu(cpu) {
+		new_map = new_dev_maps->cpu_map[cpu];
+		map = dev_maps ? dev_maps->cpu_map[cpu] : NULL;
+		if (new_map && new_map != map)
+			kfree(new_map);
+	}
+	mutex_unlock(&xps_map_mutex);
+	kfree(new_dev_maps);
+out_mask:
+	free_cpumask_var(mask);
+	return err;
+}
+
+static struct netdev_queue_attribute xps_cpus_attribute =
+	__ATTR(xps_cpus, S_IRUGO | S_IWUSR, show_xps_map, store_xps_map);
+#endif /* CONFIG_XPS */
+
+static struct attribute *netdev_queue_default_attrs[] = {
+#ifdef CONFIG_XPS
+	&xps_cpus_attribute.attr,
+#endif
+	NULL
+};
+
+static void netdev_queue_release(struct kobject *kobj)
+{
+	struct netdev_queue *queue = to_netdev_queue(kobj);
+
+	memset(kobj, 0, sizeof(*kobj));
+	dev_put(queue->dev);
+}
+
+static struct kobj_type netdev_queue_ktype = {
+	.sysfs_ops = &netdev_queue_sysfs_ops,
+	.release = netdev_queue_release,
+	.default_attrs = netdev_queue_default_attrs,
+};
+
+static int netdev_queue_add_kobject(struct net_device *net, int index)
+{
+	struct netdev_queue *queue = net->_tx + index;
+	struct kobject *kobj = &queue->kobj;
+	int error;
+
+	kobj->kset = net->queues_kset;
+	error = kobject_init_and_add(kobj, &netdev_queue_ktype, NULL,
+				     "tx-%u", index);
+	if (error) {
+		kobject_put(kobj);
+		return error;
+	}
+
+#ifdef CONFIG_BQL
+	error = sysfs_create_group(kobj, &dql_group);
+	if (error) {
+		kobject_put(kobj);
+		return error;
+	}
+#endif
+
+	kobject_uevent(kobj, KOBJ_ADD);
+	dev_hold(queue->dev);
+
+	return 0;
+}
+
+static void remove_queue_kobjects(struct net_device *net, int count)
+{
+	int i;
+
+	if (!net->queues_kset)
+		return;
+
+	for (i = 0; i < count; i++) {
+#ifdef CONFIG_BQL
+		sysfs_remove_group(&net->_tx[i].kobj, &dql_group);
+#endif
+		kobject_put(&net->_tx[i].kobj);
+	}
+	kset_unregister(net->queues_kset);
+	net->queues_kset = NULL;
+}
+
+static int register_queue_kobjects(struct net_device *net)
+{
+	int i, error;
+
+	net->queues_kset = kset_create_and_add("queues", NULL,
+					       &net->dev.kobj);
+	if (!net->queues_kset)
+		return -ENOMEM;
+
+	for (i = 0; i < net->real_num_tx_queues; i++) {
+		error = netdev_queue_add_kobject(net, i);
+		if (error) {
+			remove_queue_kobjects(net, i);
+			return error;
+		}
+	}
+
+	return 0;
+}
+#else
+static int register_queue_kobjects(struct net_device *net)
+{
+	return 0;
+}
+
+static void remove_queue_kobjects(struct net_device *net, int count)
+{
+}
+#endif /* CONFIG_SYSFS */
+
 /*
  *	netdev_release -- destroy and free a dead device.
  *	Called when last reference to device kobject is gone.
@@ -485,6 +918,7 @@ void netdev_unregister_kobject(struct net_device * net)
 	if (dev_net(net) != &init_net)
 		return;
 
+	remove_queue_kobjects(net, net->real_num_tx_queues);
 	device_del(dev);
 }
 
@@ -493,6 +927,7 @@ int netdev_register_kobject(struct net_device *net)
 {
 	struct device *dev = &(net->dev);
 	const struct attribute_group **groups = net->sysfs_groups;
+	int error;
 
 	dev->class = &net_class;
 	dev->platform_data = net;
@@ -512,7 +947,15 @@ int netdev_register_kobject(struct net_device *net)
 	if (dev_net(net) != &init_net)
 		return 0;
 
-	return device_add(dev);
+	error = device_add(dev);
+	if (error)
+		return error;
+
+	error = register_queue_kobjects(net);
+	if (error)
+		device_del(dev);
+
+	return error;
 }
 
 int netdev_class_create_file(struct class_attribute *class_attr)
@@ -57,6 +57,7 @@
 #include <linux/init.h>
 #include <linux/scatterlist.h>
 #include <linux/errqueue.h>
+#include <linux/cpu.h>
 
 #include <net/protocol.h>
 #include <net/dst.h>
@@ -73,6 +74,27 @@
 static struct kmem_cache *skbuff_head_cache __read_mostly;
 static struct kmem_cache *skbuff_fclone_cache __read_mostly;
 
+/*
+ * Per-CPU cache of clean receive sized skbs. Drivers hand completed
+ * transmit skbs back through dev_kfree_skb_recycle() and
+ * __netdev_alloc_skb() reuses them when refilling receive rings, so a
+ * forwarding path does not have to go through the allocators for every
+ * packet. The lists are only touched by their own CPU with interrupts
+ * disabled and need no locking.
+ */
+static DEFINE_PER_CPU(struct sk_buff_head, skb_recycle_list);
+int sysctl_skb_recycle_max __read_mostly = 128;
+
+/*
+ * Per-CPU page that receive buffers are carved from, see
+ * netdev_alloc_frag().
+ */
+struct netdev_alloc_cache {
+	struct page	*page;
+	unsigned int	offset;
+};
+static DEFINE_PER_CPU(struct netdev_alloc_cache, netdev_alloc_cache);
+
 static void sock_pipe_buf_release(struct pipe_inode_info *pipe,
 				  struct pipe_buffer *buf)
 {
@@ -252,6 +274,161 @@ nodata:
 }
 EXPORT_SYMBOL(__alloc_skb);
 
+/**
+ *	build_skb - build a network buffer around a page fragment
+ *	@data: data buffer provided by caller
+ *	@frag_size: size of the fragment, including the shared info
+ *
+ *	Allocate a new &sk_buff whose head is the page fragment @data, as
+ *	returned by netdev_alloc_frag(). The skb_shared_info is placed at
+ *	the end of the fragment and the head is released with put_page()
+ *	when the skb is freed. The return is the buffer. On a failure the
+ *	return is %NULL and @data is not freed.
+ */
+struct sk_buff *build_skb(void *data, unsigned int frag_size)
+{
+	struct skb_shared_info *shinfo;
+	struct sk_buff *skb;
+	unsigned int size;
+
+	skb = kmem_cache_alloc(skbuff_head_cache, GFP_ATOMIC);
+	if (!skb)
+		return NULL;
+
+	size = SKB_WITH_OVERHEAD(frag_size);
+
+	memset(skb, 0, offsetof(struct sk_buff, tail));
+	skb->truesize = size + sizeof(struct sk_buff);
+	skb->head_frag = 1;
+	atomic_set(&skb->users, 1);
+	skb->head = data;
+	skb->data = data;
+	skb_reset_tail_pointer(skb);
+	skb->end = skb->tail + size;
+	kmemcheck_annotate_bitfield(skb, flags1);
+	kmemcheck_annotate_bitfield(skb, flags2);
+#ifdef NET_SKBUFF_DATA_USES_OFFSET
+	skb->mac_header = ~0U;
+#endif
+
+	shinfo = skb_shinfo(skb);
+	atomic_set(&shinfo->dataref, 1);
+	shinfo->nr_frags  = 0;
+	shinfo->gso_size = 0;
+	shinfo->gso_segs = 0;
+	shinfo->gso_type = 0;
+	shinfo->ip6_frag_id = 0;
+	shinfo->tx_flags.flags = 0;
+	skb_frag_list_init(skb);
+	memset(&shinfo->hwtstamps, 0, sizeof(shinfo->hwtstamps));
+
+	return skb;
+}
+EXPORT_SYMBOL(build_skb);
+
+/**
+ *	netdev_alloc_frag - allocate a page fragment for a receive buffer
+ *	@fragsz: fragment size
+ *
+ *	Carve @fragsz bytes out of a per-CPU page. Every fragment holds a
+ *	reference on the page, which is freed once all fragments have been
+ *	released with put_page(). Returns the fragment's address, or %NULL
+ *	if no memory is available.
+ */
+void *netdev_alloc_frag(unsigned int fragsz)
+{
+	struct netdev_alloc_cache *nc;
+	void *data = NULL;
+	unsigned long flags;
+
+	if (unlikely(fragsz > PAGE_SIZE))
+		return NULL;
+
+	local_irq_save(flags);
+	nc = &__get_cpu_var(netdev_alloc_cache);
+	if (unlikely(!nc->page)) {
+refill:
+		nc->page = alloc_page(GFP_ATOMIC | __GFP_COLD);
+		nc->offset = 0;
+	}
+	if (likely(nc->page)) {
+		if (nc->offset + fragsz > PAGE_SIZE) {
+			put_page(nc->page);
+			goto refill;
+		}
+		data = page_address(nc->page) + nc->offset;
+		nc->offset += fragsz;
+		get_page(nc->page);
+	}
+	local_irq_restore(flags);
+	return data;
+}
+EXPORT_SYMBOL(netdev_alloc_frag);
+
+/*
+ * Receive buffers up to this size (not counting NET_SKB_PAD) are served
+ * from the recycle cache. It is the largest buffer which still fits a
+ * 2048 byte allocation together with the padding and the shared info,
+ * which covers a VLAN tagged ethernet frame plus driver alignment.
+ */
+#define SKB_RECYCLE_SIZE	(SKB_WITH_OVERHEAD(2048) - NET_SKB_PAD)
+
+static struct sk_buff *skb_recycle_get(void)
+{
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	skb = __skb_dequeue(&__get_cpu_var(skb_recycle_list));
+	local_irq_restore(flags);
+
+	return skb;
+}
+
+/**
+ *	dev_kfree_skb_recycle - free a transmitted skbuff or recycle it
+ *	@skb: buffer to free
+ *
+ *	Drivers call this instead of dev_kfree_skb_any() on transmit
+ *	completion. If the buffer is private, linear and of receive size
+ *	it is reset and kept in a per-CPU cache for __netdev_alloc_skb(),
+ *	otherwise it is freed normally.
+ */
+void dev_kfree_skb_recycle(struct sk_buff *skb)
+{
+	struct sk_buff_head *list;
+	unsigned long flags;
+
+	if (in_irq() || irqs_disabled() || skb_emergency(skb))
+		goto free;
+
+	/* Don't hoard buffers much larger than what receive asks for */
+	if (skb_end_pointer(skb) - skb->head > 2 * SKB_RECYCLE_SIZE)
+		goto free;
+
+	/* Racy, only avoids resetting an skb which can't be kept anyway */
+	if (skb_queue_len(&__raw_get_cpu_var(skb_recycle_list)) >=
+	    sysctl_skb_recycle_max)
+		goto free;
+
+	if (!skb_recycle_check(skb, SKB_RECYCLE_SIZE))
+		goto free;
+
+	local_irq_save(flags);
+	list = &__get_cpu_var(skb_recycle_list);
+	if (likely(skb_queue_len(list) < sysctl_skb_recycle_max)) {
+		__skb_queue_head(list, skb);
+		skb = NULL;
+	}
+	local_irq_restore(flags);
+
+	if (!skb)
+		return;
+free:
+	dev_kfree_skb_any(skb);
+}
+EXPORT_SYMBOL(dev_kfree_skb_recycle);
+
 /**
  *	__netdev_alloc_skb - allocate an skbuff for rx on a specific device
  *	@dev: network device to receive on
@@ -269,9 +446,41 @@ struct sk_buff *__netdev_alloc_skb(struct net_device *dev,
 		unsigned int length, gfp_t gfp_mask)
 {
 	int node = dev->dev.parent ? dev_to_node(dev->dev.parent) : -1;
+	unsigned int fragsz;
 	struct sk_buff *skb;
 
-	skb = __alloc_skb(length + NET_SKB_PAD, gfp_mask, SKB_ALLOC_RX, node);
+	/*
+	 * Only full sized receive buffers go through the recycle cache,
+	 * small header buffers of packet split rings are left alone.
+	 */
+	if (length <= SKB_RECYCLE_SIZE && length > SKB_RECYCLE_SIZE / 2) {
+		skb = skb_recycle_get();
+		if (skb) {
+			/* skb_recycle_check() already reserved NET_SKB_PAD */
+			skb->dev = dev;
+			return skb;
+		}
+		/* Allocate a full sized buffer so it can be recycled later */
+		length = SKB_RECYCLE_SIZE;
+	}
+
+	fragsz = SKB_DATA_ALIGN(length + NET_SKB_PAD) +
+		 SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+
+	if (fragsz <= PAGE_SIZE && !sk_memalloc_socks() &&
+	    !(gfp_mask & (__GFP_WAIT | GFP_DMA))) {
+		void *data = netdev_alloc_frag(fragsz);
+
+		skb = NULL;
+		if (likely(data)) {
+			skb = build_skb(data, fragsz);
+			if (unlikely(!skb))
+				put_page(virt_to_head_page(data));
+		}
+	} else {
+		skb = __alloc_skb(length + NET_SKB_PAD, gfp_mask,
+				  SKB_ALLOC_RX, node);
+	}
 	if (likely(skb)) {
 		skb_reserve(skb, NET_SKB_PAD);
 		skb->dev = dev;
@@ -408,7 +617,11 @@ static void skb_release_data(struct sk_buff *skb)
 		if (skb_has_frags(skb))
 			skb_drop_fraglist(skb);
 
-		kfree_reserve(skb->head, &net_skb_reserve, skb_emergency(skb));
+		if (skb->head_frag)
+			put_page(virt_to_head_page(skb->head));
+		else
+			kfree_reserve(skb->head, &net_skb_reserve,
+				      skb_emergency(skb));
 	}
 }
 
@@ -550,6 +763,7 @@ EXPORT_SYMBOL(consume_skb);
 int skb_recycle_check(struct sk_buff *skb, int skb_size)
 {
 	struct skb_shared_info *shinfo;
+	int head_frag;
 
 	if (skb_is_nonlinear(skb) || skb->fclone != SKB_FCLONE_UNAVAILABLE)
 		return 0;
@@ -573,7 +787,9 @@ int skb_recycle_check(struct sk_buff *skb, int skb_size)
 	skb_frag_list_init(skb);
 	memset(&shinfo->hwtstamps, 0, sizeof(shinfo->hwtstamps));
 
+	head_frag = skb->head_frag;
 	memset(skb, 0, offsetof(struct sk_buff, tail));
+	skb->head_frag = head_frag;
 	skb->data = skb->head + NET_SKB_PAD;
 	skb_reset_tail_pointer(skb);
 
@@ -598,6 +814,7 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	new->pkt_type		= old->pkt_type;
 	new->ip_summed		= old->ip_summed;
 	skb_copy_queue_mapping(new, old);
+	new->ooo_okay		= old->ooo_okay;
 	new->priority		= old->priority;
 #if defined(CONFIG_IP_VS) || defined(CONFIG_IP_VS_MODULE)
 	new->ipvs_property	= old->ipvs_property;
@@ -650,6 +867,7 @@ static struct sk_buff *__skb_clone(struct sk_buff *n, struct sk_buff *skb)
 	C(tail);
 	C(end);
 	C(head);
+	C(head_frag);
 	C(data);
 	C(truesize);
 	atomic_set(&n->users, 1);
@@ -940,6 +1158,7 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	skb->cloned   = 0;
 	skb->hdr_len  = 0;
 	skb->nohdr    = 0;
+	skb->head_frag = 0;
 	atomic_set(&skb_shinfo(skb)->dataref, 1);
 	return 0;
 
@@ -2850,8 +3069,33 @@ done:
 }
 EXPORT_SYMBOL_GPL(skb_gro_receive);
 
+static int skb_cpu_callback(struct notifier_block *nfb,
+			    unsigned long action, void *ocpu)
+{
+	int cpu = (unsigned long)ocpu;
+	struct netdev_alloc_cache *nc;
+
+	if (action != CPU_DEAD && action != CPU_DEAD_FROZEN)
+		return NOTIFY_OK;
+
+	__skb_queue_purge(&per_cpu(skb_recycle_list, cpu));
+
+	nc = &per_cpu(netdev_alloc_cache, cpu);
+	if (nc->page) {
+		put_page(nc->page);
+		nc->page = NULL;
+	}
+	return NOTIFY_OK;
+}
+
 void __init skb_init(void)
 {
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		__skb_queue_head_init(&per_cpu(skb_recycle_list, cpu));
+	hotcpu_notifier(skb_cpu_callback, 0);
+
 	skbuff_head_cache = kmem_cache_create("skbuff_head_cache",
 					      sizeof(struct sk_buff),
 					      0,
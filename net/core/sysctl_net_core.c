@@ -89,6 +89,14 @@ static struct ctl_table net_core_table[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_dointvec
 	},
+	{
+		.ctl_name	= CTL_UNNUMBERED,
+		.procname	= "skb_recycle_max",
+		.data		= &sysctl_skb_recycle_max,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec
+	},
 #endif /* CONFIG_NET */
 	{
 		.ctl_name	= NET_CORE_BUDGET,
@@ -600,6 +600,59 @@ int ip_defrag(struct sk_buff *skb, u32 user)
 	return -ENOMEM;
 }
 
+/*
+ * Reassemble an IPv4 packet seen outside the IP input path, e.g. by a
+ * packet socket.  The skb may be shared and its data may start at the
+ * link layer header.  Returns the skb unchanged if it is not a valid
+ * fragment, the reassembled datagram (data at the network header, mac
+ * header still valid) once complete, or NULL if it was queued or
+ * dropped.
+ */
+struct sk_buff *ip_check_defrag(struct sk_buff *skb, u32 user)
+{
+	struct iphdr iph;
+	int netoff;
+	u32 len;
+
+	if (skb->protocol != htons(ETH_P_IP))
+		return skb;
+
+	netoff = skb_network_offset(skb);
+	if (netoff < 0)
+		return skb;
+
+	if (skb_copy_bits(skb, netoff, &iph, sizeof(iph)) < 0)
+		return skb;
+
+	if (iph.ihl < 5 || iph.version != 4)
+		return skb;
+
+	len = ntohs(iph.tot_len);
+	if (skb->len < netoff + len || len < (iph.ihl * 4))
+		return skb;
+
+	if (!(iph.frag_off & htons(IP_MF | IP_OFFSET)))
+		return skb;
+
+	skb = skb_share_check(skb, GFP_ATOMIC);
+	if (!skb)
+		return NULL;
+
+	if (!pskb_may_pull(skb, netoff + iph.ihl * 4))
+		return skb;
+	if (pskb_trim_rcsum(skb, netoff + len))
+		return skb;
+
+	/* ip_defrag() expects data at the network header */
+	__skb_pull(skb, netoff);
+	memset(IPCB(skb), 0, sizeof(struct inet_skb_parm));
+	if (ip_defrag(skb, user))
+		return NULL;
+
+	return skb;
+}
+EXPORT_SYMBOL(ip_check_defrag);
+
 #ifdef CONFIG_SYSCTL
 static int
 proc_dointvec_fragment(struct ctl_table *table, int write,
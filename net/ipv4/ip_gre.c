@@ -119,8 +119,14 @@
 static struct rtnl_link_ops ipgre_link_ops __read_mostly;
 static int ipgre_tunnel_init(struct net_device *dev);
 static void ipgre_tunnel_setup(struct net_device *dev);
+static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb,
+				     struct net_device *dev);
 static int ipgre_tunnel_bind_dev(struct net_device *dev);
 
+/* The tunnel segments and checksums late, on the underlying device. */
+#define GRE_FEATURES	(NETIF_F_SG | NETIF_F_HIGHDMA | NETIF_F_HW_CSUM | \
+			 NETIF_F_GSO_SOFTWARE)
+
 /* Fallback tunnel: no source, no destination, no key, no options */
 
 #define HASH_SIZE  16
@@ -595,6 +601,7 @@ static int ipgre_rcv(struct sk_buff *skb)
 		skb->mac_header = skb->network_header;
 		__pskb_pull(skb, offset);
 		skb_postpull_rcsum(skb, skb_transport_header(skb), offset);
+		skb_shinfo(skb)->gso_type &= ~SKB_GSO_GRE;
 		skb->pkt_type = PACKET_HOST;
 #ifdef CONFIG_NET_IPGRE_BROADCAST
 		if (ipv4_is_multicast(iph->daddr)) {
@@ -659,6 +666,32 @@ drop_nolock:
 	return(0);
 }
 
+/*
+ * Fall back to segmenting a GSO frame before encapsulation, when the
+ * tunnel header cannot be replicated per segment (checksummed or
+ * sequenced GRE) or the encapsulated frame would not fit an IP packet.
+ */
+static netdev_tx_t ipgre_tunnel_xmit_segs(struct sk_buff *skb,
+					  struct net_device *dev)
+{
+	struct sk_buff *segs = skb_gso_segment(skb, 0);
+
+	dev_kfree_skb(skb);
+	if (IS_ERR(segs)) {
+		dev->stats.tx_errors++;
+		return NETDEV_TX_OK;
+	}
+
+	while (segs) {
+		struct sk_buff *next = segs->next;
+
+		segs->next = NULL;
+		ipgre_tunnel_xmit(segs, dev);
+		segs = next;
+	}
+	return NETDEV_TX_OK;
+}
+
 static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct ip_tunnel *tunnel = netdev_priv(dev);
@@ -686,6 +719,14 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 		tiph = &tunnel->parms.iph;
 	}
 
+	if (skb_is_gso(skb)) {
+		if ((tunnel->parms.o_flags & (GRE_CSUM|GRE_SEQ)) ||
+		    skb->len + gre_hlen > 0xFFFF)
+			return ipgre_tunnel_xmit_segs(skb, dev);
+	} else if (skb->ip_summed == CHECKSUM_PARTIAL &&
+		   skb_checksum_help(skb))
+		goto tx_error;
+
 	if ((dst = tiph->daddr) == 0) {
 		/* NBMA tunnel */
 
@@ -765,7 +806,7 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 	if (skb->protocol == htons(ETH_P_IP)) {
 		df |= (old_iph->frag_off&htons(IP_DF));
 
-		if ((old_iph->frag_off&htons(IP_DF)) &&
+		if ((old_iph->frag_off&htons(IP_DF)) && !skb_is_gso(skb) &&
 		    mtu < ntohs(old_iph->tot_len)) {
 			icmp_send(skb, ICMP_DEST_UNREACH, ICMP_FRAG_NEEDED, htonl(mtu));
 			ip_rt_put(rt);
@@ -785,7 +826,8 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 			}
 		}
 
-		if (mtu >= IPV6_MIN_MTU && mtu < skb->len - tunnel->hlen + gre_hlen) {
+		if (mtu >= IPV6_MIN_MTU && !skb_is_gso(skb) &&
+		    mtu < skb->len - tunnel->hlen + gre_hlen) {
 			icmpv6_send(skb, ICMPV6_PKT_TOOBIG, 0, mtu, dev);
 			ip_rt_put(rt);
 			goto tx_error;
@@ -805,8 +847,10 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 
 	max_headroom = LL_RESERVED_SPACE(tdev) + gre_hlen;
 
+	/* GSO frames get their gso_type updated: never share skb_shinfo */
 	if (skb_headroom(skb) < max_headroom || skb_shared(skb)||
-	    (skb_cloned(skb) && !skb_clone_writable(skb, 0))) {
+	    (skb_cloned(skb) &&
+	     (skb_is_gso(skb) || !skb_clone_writable(skb, 0)))) {
 		struct sk_buff *new_skb = skb_realloc_headroom(skb, max_headroom);
 		if (!new_skb) {
 			ip_rt_put(rt);
@@ -876,6 +920,9 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 		}
 	}
 
+	if (skb_is_gso(skb))
+		skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+
 	nf_reset(skb);
 
 	IPTUNNEL_XMIT();
@@ -1225,7 +1272,7 @@ static void ipgre_tunnel_setup(struct net_device *dev)
 	dev->flags		= IFF_NOARP;
 	dev->iflink		= 0;
 	dev->addr_len		= 4;
-	dev->features		|= NETIF_F_NETNS_LOCAL;
+	dev->features		|= NETIF_F_NETNS_LOCAL | GRE_FEATURES;
 	dev->priv_flags		&= ~IFF_XMIT_DST_RELEASE;
 }
 
@@ -1277,9 +1324,160 @@ static void ipgre_fb_tunnel_init(struct net_device *dev)
 }
 
 
+/*
+ * Offloads: a GSO frame sent through the tunnel is segmented only once it
+ * reaches the real device, and on receive GRO aggregates the inner flow
+ * before decapsulation.  Both are restricted to GRE without checksum or
+ * sequence numbers, where all segments share a header.
+ */
+static unsigned int ipgre_gro_hlen(__be16 flags)
+{
+	return flags & GRE_KEY ? 8 : 4;
+}
+
+static struct sk_buff *ipgre_gso_segment(struct sk_buff *skb, int features)
+{
+	unsigned int grehlen, mac_len = 0;
+	__be16 *greh;
+	__be16 protocol;
+
+	if (unlikely(!(skb_shinfo(skb)->gso_type & SKB_GSO_GRE) ||
+		     !pskb_may_pull(skb, 4)))
+		return ERR_PTR(-EINVAL);
+
+	greh = (__be16 *)skb->data;
+	if (greh[0] & ~GRE_KEY)
+		return ERR_PTR(-EINVAL);
+
+	grehlen = ipgre_gro_hlen(greh[0]);
+	protocol = greh[1];
+	if (protocol == htons(ETH_P_TEB)) {
+		if (!pskb_may_pull(skb, grehlen + ETH_HLEN))
+			return ERR_PTR(-EINVAL);
+		protocol = ((struct ethhdr *)(skb->data + grehlen))->h_proto;
+		mac_len = ETH_HLEN;
+	}
+
+	return skb_tunnel_gso_segment(skb, features, grehlen, mac_len,
+				      protocol, SKB_GSO_GRE);
+}
+
+static struct sk_buff **ipgre_gro_receive(struct sk_buff **head,
+					  struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	struct packet_type *ptype;
+	unsigned int hlen, off, grehlen;
+	__be16 *greh;
+	__be16 type;
+	__wsum csum;
+	int flush = 1;
+
+	if (NAPI_GRO_CB(skb)->encap_mark)
+		goto out;
+
+	off = skb_gro_offset(skb);
+	hlen = off + 4;
+	greh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	if (greh[0] & ~GRE_KEY)
+		goto out;
+
+	grehlen = ipgre_gro_hlen(greh[0]);
+	type = greh[1];
+	if (type == htons(ETH_P_TEB))
+		grehlen += ETH_HLEN;
+
+	hlen = off + grehlen;
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	if (type == htons(ETH_P_TEB))
+		type = ((struct ethhdr *)((u8 *)greh + grehlen - ETH_HLEN))->h_proto;
+
+	rcu_read_lock();
+	ptype = gro_find_receive_by_type(type);
+	if (!ptype)
+		goto out_unlock;
+
+	flush = 0;
+
+	for (p = *head; p; p = p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		/* Flags, key, protocol and any inner MAC header must match. */
+		if (memcmp(greh, p->data + off, grehlen))
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	/*
+	 * Without a hardware checksum the inner flow could never be merged;
+	 * sum the packet here instead of after decapsulation, so the stack
+	 * does not have to do it a second time.
+	 */
+	if (skb->ip_summed == CHECKSUM_NONE) {
+		skb->csum = skb_checksum(skb, off, skb_gro_len(skb), 0);
+		skb->ip_summed = CHECKSUM_COMPLETE;
+	}
+
+	NAPI_GRO_CB(skb)->encap_mark = 1;
+	skb_gro_pull(skb, grehlen);
+
+	csum = skb->csum;
+	skb_postpull_rcsum(skb, greh, grehlen);
+
+	pp = ptype->gro_receive(head, skb);
+
+	skb->csum = csum;
+
+out_unlock:
+	rcu_read_unlock();
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+static int ipgre_gro_complete(struct sk_buff *skb, int nhoff)
+{
+	__be16 *greh = (__be16 *)(skb->data + nhoff);
+	unsigned int grehlen = ipgre_gro_hlen(greh[0]);
+	struct packet_type *ptype;
+	__be16 type = greh[1];
+	int err = -ENOENT;
+
+	if (type == htons(ETH_P_TEB)) {
+		type = ((struct ethhdr *)(skb->data + nhoff + grehlen))->h_proto;
+		grehlen += ETH_HLEN;
+	}
+
+	skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+
+	rcu_read_lock();
+	ptype = gro_find_complete_by_type(type);
+	if (ptype)
+		err = ptype->gro_complete(skb, nhoff + grehlen);
+	rcu_read_unlock();
+
+	return err;
+}
+
 static const struct net_protocol ipgre_protocol = {
 	.handler	=	ipgre_rcv,
 	.err_handler	=	ipgre_err,
+	.gso_segment	=	ipgre_gso_segment,
+	.gro_receive	=	ipgre_gro_receive,
+	.gro_complete	=	ipgre_gro_complete,
 	.netns_ok	=	1,
 };
 
@@ -1468,7 +1666,7 @@ static void ipgre_tap_setup(struct net_device *dev)
 	dev->destructor 	= free_netdev;
 
 	dev->iflink		= 0;
-	dev->features		|= NETIF_F_NETNS_LOCAL;
+	dev->features		|= NETIF_F_NETNS_LOCAL | GRE_FEATURES;
 }
 
 static int ipgre_newlink(struct net_device *dev, struct nlattr *tb[],
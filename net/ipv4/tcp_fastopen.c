@@ -0,0 +1,133 @@
+/*
+ * TCP Fast Open (RFC7413): server cookies and the client cookie cache.
+ *
+ * A server cookie is a keyed hash of the client and server addresses, so
+ * checking one needs no per-client state.  As for syncookies the secret
+ * is drawn once at boot.
+ *
+ * Clients remember the cookie and the MSS last offered by each server in
+ * its inet_peer entry, so the cache ages out with the peer.  A SYN with
+ * data that seems to have been dropped (the SYN-ACK carries no cookie and
+ * acks only the retransmitted plain SYN) stops Fast Open to that host for
+ * TCP_FASTOPEN_LOSS_BACKOFF, for middleboxes that discard such SYNs.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/random.h>
+#include <linux/cryptohash.h>
+#include <linux/spinlock.h>
+#include <linux/tcp.h>
+#include <net/inetpeer.h>
+#include <net/tcp.h>
+
+int sysctl_tcp_fastopen __read_mostly;
+
+#define TCP_FASTOPEN_LOSS_BACKOFF	(60 * 60 * HZ)
+
+static __u32 tcp_fastopen_secret[16 - 2 + SHA_DIGEST_WORDS] __read_mostly;
+
+static DEFINE_PER_CPU(__u32 [16 + SHA_DIGEST_WORDS + SHA_WORKSPACE_WORDS],
+		      tcp_fastopen_scratch);
+
+static DEFINE_SPINLOCK(tcp_fastopen_lock);
+
+static int __init tcp_fastopen_init(void)
+{
+	get_random_bytes(tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	return 0;
+}
+late_initcall(tcp_fastopen_init);
+
+/* Called from softirq context only, hence the unlocked per-cpu scratch */
+void tcp_fastopen_cookie_gen(__be32 saddr, __be32 daddr,
+			     struct tcp_fastopen_cookie *foc)
+{
+	__u32 *tmp = __get_cpu_var(tcp_fastopen_scratch);
+
+	tmp[0] = (__force u32)saddr;
+	tmp[1] = (__force u32)daddr;
+	memcpy(tmp + 2, tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	sha_transform(tmp + 16, (__u8 *)tmp, tmp + 16 + SHA_DIGEST_WORDS);
+
+	BUILD_BUG_ON(TCP_FASTOPEN_COOKIE_SIZE > SHA_DIGEST_WORDS * 4);
+	memcpy(foc->val, tmp + 16, TCP_FASTOPEN_COOKIE_SIZE);
+	foc->len = TCP_FASTOPEN_COOKIE_SIZE;
+}
+
+/* Look up what we know about the server @sk connects to.  @cookie is left
+ * alone if there is no entry, and set to -1 (no Fast Open at all) while
+ * backing off from a SYN data loss.
+ */
+void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+			    struct tcp_fastopen_cookie *cookie)
+{
+	struct inet_peer *peer;
+
+	if (sk->sk_family != AF_INET)
+		return;
+
+	peer = inet_getpeer(inet_sk(sk)->daddr, 0);
+	if (!peer)
+		return;
+
+	spin_lock_bh(&tcp_fastopen_lock);
+	if (peer->tcp_fastopen_mss)
+		*mss = peer->tcp_fastopen_mss;
+	if (peer->tcp_fastopen_syn_loss &&
+	    time_before(jiffies, peer->tcp_fastopen_syn_loss +
+				 TCP_FASTOPEN_LOSS_BACKOFF)) {
+		cookie->len = -1;
+	} else if (peer->tcp_fastopen_cookie_len > 0) {
+		cookie->len = peer->tcp_fastopen_cookie_len;
+		memcpy(cookie->val, peer->tcp_fastopen_cookie, cookie->len);
+	}
+	spin_unlock_bh(&tcp_fastopen_lock);
+
+	inet_putpeer(peer);
+}
+
+void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+			    struct tcp_fastopen_cookie *cookie, int syn_lost)
+{
+	struct inet_peer *peer;
+
+	if (sk->sk_family != AF_INET)
+		return;
+
+	peer = inet_getpeer(inet_sk(sk)->daddr, 1);
+	if (!peer)
+		return;
+
+	spin_lock_bh(&tcp_fastopen_lock);
+	if (mss)
+		peer->tcp_fastopen_mss = mss;
+	if (cookie->len > 0) {
+		peer->tcp_fastopen_cookie_len = cookie->len;
+		memcpy(peer->tcp_fastopen_cookie, cookie->val, cookie->len);
+	}
+	peer->tcp_fastopen_syn_loss = syn_lost ? jiffies | 1 : 0;
+	spin_unlock_bh(&tcp_fastopen_lock);
+
+	inet_putpeer(peer);
+}
+
+/* The handshake of a passive Fast Open child completed or was aborted:
+ * drop the request sock kept for SYN-ACK retransmits and give the slot
+ * it took back to the listener.
+ */
+void tcp_free_fastopen_rsk(struct tcp_sock *tp)
+{
+	struct request_sock *req = tp->fastopen_rsk;
+	struct sock *lsk;
+
+	if (!req)
+		return;
+
+	lsk = tcp_rsk(req)->listener;
+	atomic_dec(&tcp_sk(lsk)->fastopen_qlen);
+	sock_put(lsk);
+
+	reqsk_free(req);
+	tp->fastopen_rsk = NULL;
+}
@@ -742,7 +742,8 @@ static void tcp_v4_reqsk_send_ack(struct sock *sk, struct sk_buff *skb,
  *	socket.
  */
 static int __tcp_v4_send_synack(struct sock *sk, struct request_sock *req,
-				struct dst_entry *dst)
+				struct dst_entry *dst,
+				struct tcp_fastopen_cookie *foc)
 {
 	const struct inet_request_sock *ireq = inet_rsk(req);
 	int err = -1;
@@ -752,7 +753,7 @@ static int __tcp_v4_send_synack(struct sock *sk, struct request_sock *req,
 	if (!dst && (dst = inet_csk_route_req(sk, req)) == NULL)
 		return -1;
 
-	skb = tcp_make_synack(sk, dst, req);
+	skb = tcp_make_synack(sk, dst, req, foc);
 
 	if (skb) {
 		struct tcphdr *th = tcp_hdr(skb);
@@ -775,7 +776,7 @@ static int __tcp_v4_send_synack(struct sock *sk, struct request_sock *req,
 
 static int tcp_v4_send_synack(struct sock *sk, struct request_sock *req)
 {
-	return __tcp_v4_send_synack(sk, req, NULL);
+	return __tcp_v4_send_synack(sk, req, NULL, NULL);
 }
 
 /*
@@ -1208,10 +1209,152 @@ static struct timewait_sock_ops tcp_timewait_sock_ops = {
 	.twsk_destructor= tcp_twsk_destructor,
 };
 
+/*
+ * Decide whether the data carried by a SYN may be accepted right away.
+ * A SYN asking for a cookie, or carrying a stale one, gets a fresh cookie
+ * in @valid_foc to be echoed in the SYN-ACK.  Only listeners that opted
+ * in with TCP_FASTOPEN take part, and only while they have fewer pending
+ * Fast Open children than they allowed.
+ */
+static int tcp_v4_fastopen_check(struct sock *sk, struct sk_buff *skb,
+				 struct tcp_fastopen_cookie *foc,
+				 struct tcp_fastopen_cookie *valid_foc)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	int syn_data = TCP_SKB_CB(skb)->end_seq != TCP_SKB_CB(skb)->seq + 1;
+
+	if (!(sysctl_tcp_fastopen & TFO_SERVER_ENABLE) ||
+	    !tp->fastopen_max_qlen || tcp_hdr(skb)->fin ||
+	    (!syn_data && foc->len < 0))
+		return 0;
+
+	if (atomic_read(&tp->fastopen_qlen) >= tp->fastopen_max_qlen) {
+		NET_INC_STATS_BH(sock_net(sk),
+				 LINUX_MIB_TCPFASTOPENLISTENOVERFLOW);
+		return 0;
+	}
+
+	if (syn_data && (sysctl_tcp_fastopen & TFO_SERVER_COOKIE_NOT_REQD))
+		return 1;
+
+	if (foc->len < 0)
+		return 0;
+
+	tcp_fastopen_cookie_gen(ip_hdr(skb)->saddr, ip_hdr(skb)->daddr,
+				valid_foc);
+
+	if (foc->len == valid_foc->len &&
+	    !memcmp(foc->val, valid_foc->val, foc->len)) {
+		/* Cookie is good, no need to send it again */
+		valid_foc->len = -1;
+		return syn_data;
+	}
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENCOOKIEREQD);
+	return 0;
+}
+
+/*
+ * Accept the data of a Fast Open SYN: create the child socket right away,
+ * queue the data on it and hand it to accept() while still in SYN_RECV.
+ * The request sock stays attached to the child (tp->fastopen_rsk) so the
+ * SYN-ACK can be retransmitted until the final ACK arrives.
+ *
+ * @dst is always consumed.  Returns 0 on success, -1 if the caller should
+ * carry on with a regular three way handshake.
+ */
+static int tcp_v4_conn_req_fastopen(struct sock *sk, struct sk_buff *skb,
+				    struct request_sock *req,
+				    struct dst_entry *dst)
+{
+	const struct inet_request_sock *ireq = inet_rsk(req);
+	struct request_sock *carrier;
+	struct sk_buff *synack, *data;
+	struct tcp_sock *tp;
+	struct sock *child;
+	struct tcphdr *th;
+
+	if (!dst && (dst = inet_csk_route_req(sk, req)) == NULL)
+		return -1;
+
+	/* accept() takes the child from its own request sock */
+	carrier = inet_reqsk_alloc(&tcp_request_sock_ops);
+	if (!carrier)
+		goto release;
+
+	/* The SYN-ACK also acknowledges the data */
+	tcp_rsk(req)->rcv_nxt = TCP_SKB_CB(skb)->end_seq;
+	synack = tcp_make_synack(sk, dst, req, NULL);
+	if (!synack)
+		goto free_carrier;
+
+	th = tcp_hdr(synack);
+	th->check = tcp_v4_check(synack->len, ireq->loc_addr, ireq->rmt_addr,
+				 csum_partial(th, synack->len, synack->csum));
+
+	child = inet_csk(sk)->icsk_af_ops->syn_recv_sock(sk, skb, req, dst);
+	if (!child) {
+		kfree_skb(synack);
+		dst = NULL;
+		goto free_carrier;
+	}
+
+	ip_build_and_send_pkt(synack, child, ireq->loc_addr, ireq->rmt_addr,
+			      inet_sk(child)->opt);
+
+	/* Counted against the listener until the handshake is over */
+	atomic_inc(&tcp_sk(sk)->fastopen_qlen);
+	sock_hold(sk);
+	tcp_rsk(req)->listener = sk;
+
+	tp = tcp_sk(child);
+	tp->fastopen_rsk = req;
+	/* The window of a SYN is never scaled */
+	tp->snd_wnd = ntohs(tcp_hdr(skb)->window);
+	tp->max_window = tp->snd_wnd;
+
+	inet_csk_reset_xmit_timer(child, ICSK_TIME_RETRANS,
+				  TCP_TIMEOUT_INIT, TCP_RTO_MAX);
+
+	inet_csk(child)->icsk_af_ops->rebuild_header(child);
+	tcp_init_metrics(child);
+	tcp_init_congestion_control(child);
+	tcp_mtup_init(child);
+	tcp_init_buffer_space(child);
+
+	/* Queue the data of the SYN, without the headers */
+	data = skb_clone(skb, GFP_ATOMIC);
+	if (data) {
+		skb_dst_drop(data);
+		__skb_pull(data, tcp_hdrlen(skb));
+		skb_set_owner_r(data, child);
+		__skb_queue_tail(&child->sk_receive_queue, data);
+		tp->syn_data_acked = 1;
+	}
+	tp->rcv_nxt = tp->rcv_wup = TCP_SKB_CB(skb)->end_seq;
+
+	inet_csk_reqsk_queue_add(sk, carrier, child);
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVE);
+	sk->sk_data_ready(sk, 0);
+
+	bh_unlock_sock(child);
+	sock_put(child);
+	return 0;
+
+free_carrier:
+	__reqsk_free(carrier);
+	tcp_rsk(req)->rcv_nxt = tcp_rsk(req)->rcv_isn + 1;
+release:
+	dst_release(dst);
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+	return -1;
+}
+
 int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 {
 	struct inet_request_sock *ireq;
 	struct tcp_options_received tmp_opt;
+	struct tcp_fastopen_cookie foc = { .len = -1 };
+	struct tcp_fastopen_cookie valid_foc = { .len = -1 };
 	struct request_sock *req;
 	__be32 saddr = ip_hdr(skb)->saddr;
 	__be32 daddr = ip_hdr(skb)->daddr;
@@ -1260,7 +1403,7 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	tmp_opt.mss_clamp = 536;
 	tmp_opt.user_mss  = tcp_sk(sk)->rx_opt.user_mss;
 
-	tcp_parse_options(skb, &tmp_opt, 0);
+	tcp_parse_options(skb, &tmp_opt, 0, want_cookie ? NULL : &foc);
 
 	if (want_cookie && !tmp_opt.saw_tstamp)
 		tcp_clear_options(&tmp_opt);
@@ -1333,7 +1476,13 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	}
 	tcp_rsk(req)->snt_isn = isn;
 
-	if (__tcp_v4_send_synack(sk, req, dst) || want_cookie)
+	if (!want_cookie && tcp_v4_fastopen_check(sk, skb, &foc, &valid_foc)) {
+		if (!tcp_v4_conn_req_fastopen(sk, skb, req, dst))
+			return 0;
+		dst = NULL;
+	}
+
+	if (__tcp_v4_send_synack(sk, req, dst, &valid_foc) || want_cookie)
 		goto drop_and_free;
 
 	inet_csk_reqsk_queue_hash_add(sk, req, TCP_TIMEOUT_INIT);
@@ -1813,6 +1962,7 @@ static int tcp_v4_init_sock(struct sock *sk)
 	tp->mss_cache = 536;
 
 	tp->reordering = sysctl_tcp_reordering;
+	tcp_enable_early_retrans(tp);
 	icsk->icsk_ca_ops = &tcp_init_congestion_ops;
 
 	sk->sk_state = TCP_CLOSE;
@@ -1850,6 +2000,10 @@ void tcp_v4_destroy_sock(struct sock *sk)
 	/* Cleans up our, hopefully empty, out_of_order_queue. */
 	__skb_queue_purge(&tp->out_of_order_queue);
 
+	/* A passive Fast Open child torn down before its handshake completed */
+	tcp_free_fastopen_rsk(tp);
+	tcp_free_fastopen_req(tp);
+
 #ifdef CONFIG_TCP_MD5SIG
 	/* Clean up the MD5 key list, if any */
 	if (tp->md5sig_info) {
@@ -2253,7 +2407,8 @@ static void get_tcp4_sock(struct sock *sk, struct seq_file *f, int i, int *len)
 	__u16 destp = ntohs(inet->dport);
 	__u16 srcp = ntohs(inet->sport);
 
-	if (icsk->icsk_pending == ICSK_TIME_RETRANS) {
+	if (icsk->icsk_pending == ICSK_TIME_RETRANS ||
+	    icsk->icsk_pending == ICSK_TIME_EARLY_RETRANS) {
 		timer_active	= 1;
 		timer_expires	= icsk->icsk_timeout;
 	} else if (icsk->icsk_pending == ICSK_TIME_PROBE0) {
@@ -2402,14 +2557,13 @@ struct sk_buff **tcp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
 }
 EXPORT_SYMBOL(tcp4_gro_receive);
 
-int tcp4_gro_complete(struct sk_buff *skb)
+int tcp4_gro_complete(struct sk_buff *skb, int thoff)
 {
 	struct iphdr *iph = ip_hdr(skb);
 	struct tcphdr *th = tcp_hdr(skb);
 
-	th->check = ~tcp_v4_check(skb->len - skb_transport_offset(skb),
-				  iph->saddr, iph->daddr, 0);
-	skb_shinfo(skb)->gso_type = SKB_GSO_TCPV4;
+	th->check = ~tcp_v4_check(skb->len - thoff, iph->saddr, iph->daddr, 0);
+	skb_shinfo(skb)->gso_type |= SKB_GSO_TCPV4;
 
 	return tcp_gro_complete(skb);
 }
@@ -2430,6 +2584,7 @@ struct proto tcp_prot = {
 	.getsockopt		= tcp_getsockopt,
 	.recvmsg		= tcp_recvmsg,
 	.backlog_rcv		= tcp_v4_do_rcv,
+	.release_cb		= tcp_release_cb,
 	.hash			= inet_hash,
 	.unhash			= inet_unhash,
 	.get_port		= inet_csk_get_port,
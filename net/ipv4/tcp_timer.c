@@ -38,6 +38,9 @@ void tcp_init_xmit_timers(struct sock *sk)
 {
 	inet_csk_init_xmit_timers(sk, &tcp_write_timer, &tcp_delack_timer,
 				  &tcp_keepalive_timer);
+	hrtimer_init(&tcp_sk(sk)->pacing_timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_ABS_PINNED);
+	tcp_sk(sk)->pacing_timer.function = tcp_pace_kick;
 }
 
 EXPORT_SYMBOL(tcp_init_xmit_timers);
@@ -278,6 +281,29 @@ static void tcp_probe_timer(struct sock *sk)
 	}
 }
 
+/*
+ *	Timer for a passive Fast Open socket: the SYN-ACK is retransmitted
+ *	from the child until the final ACK of the handshake arrives.
+ */
+static void tcp_fastopen_synack_timer(struct sock *sk)
+{
+	struct inet_connection_sock *icsk = inet_csk(sk);
+	struct request_sock *req = tcp_sk(sk)->fastopen_rsk;
+	int max_retries = icsk->icsk_syn_retries ? : sysctl_tcp_synack_retries;
+
+	/* One more retry than a regular request sock: the SYN already
+	 * carried data, so the handshake is worth more to complete.
+	 */
+	if (req->retrans >= max_retries + 1) {
+		tcp_write_err(sk);
+		return;
+	}
+	req->rsk_ops->rtx_syn_ack(sk, req);
+	req->retrans++;
+	inet_csk_reset_xmit_timer(sk, ICSK_TIME_RETRANS,
+				  TCP_TIMEOUT_INIT << req->retrans, TCP_RTO_MAX);
+}
+
 /*
  *	The TCP retransmit timer.
  */
@@ -287,6 +313,11 @@ void tcp_retransmit_timer(struct sock *sk)
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct inet_connection_sock *icsk = inet_csk(sk);
 
+	if (tp->fastopen_rsk) {
+		tcp_fastopen_synack_timer(sk);
+		return;
+	}
+
 	if (!tp->packets_out)
 		goto out;
 
@@ -419,6 +450,9 @@ static void tcp_write_timer(unsigned long data)
 	icsk->icsk_pending = 0;
 
 	switch (event) {
+	case ICSK_TIME_EARLY_RETRANS:
+		tcp_resume_early_retransmit(sk);
+		break;
 	case ICSK_TIME_RETRANS:
 		tcp_retransmit_timer(sk);
 		break;
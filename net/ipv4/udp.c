@@ -1865,6 +1865,129 @@ int udp4_ufo_send_check(struct sk_buff *skb)
 	return 0;
 }
 
+static LIST_HEAD(udp_offload_list);
+static DEFINE_SPINLOCK(udp_offload_lock);
+
+/* Called under rcu_read_lock() or udp_offload_lock. */
+static struct udp_offload *udp_find_offload(__be16 port)
+{
+	struct udp_offload *uo;
+
+	list_for_each_entry_rcu(uo, &udp_offload_list, list)
+		if (uo->port == port)
+			return uo;
+	return NULL;
+}
+
+/**
+ *	udp_add_offload - register a UDP encapsulation for GRO/GSO
+ *	@uo: offload description, with @port in network byte order
+ *
+ *	Returns -EEXIST if another encapsulation already owns the port.
+ */
+int udp_add_offload(struct udp_offload *uo)
+{
+	int err = 0;
+
+	spin_lock(&udp_offload_lock);
+	if (udp_find_offload(uo->port))
+		err = -EEXIST;
+	else
+		list_add_rcu(&uo->list, &udp_offload_list);
+	spin_unlock(&udp_offload_lock);
+
+	return err;
+}
+EXPORT_SYMBOL(udp_add_offload);
+
+/**
+ *	udp_del_offload - unregister a UDP encapsulation
+ *	@uo: offload previously passed to udp_add_offload()
+ *
+ *	Waits for in-flight GRO and GSO users, @uo may be freed afterwards.
+ */
+void udp_del_offload(struct udp_offload *uo)
+{
+	spin_lock(&udp_offload_lock);
+	list_del_rcu(&uo->list);
+	spin_unlock(&udp_offload_lock);
+
+	synchronize_net();
+}
+EXPORT_SYMBOL(udp_del_offload);
+
+static struct sk_buff *udp4_tunnel_segment(struct sk_buff *skb, int features)
+{
+	struct sk_buff *segs, *seg;
+	struct udp_offload *uo;
+	struct udphdr *uh;
+	unsigned int tnl_hlen = 0, mac_len = 0;
+	__be16 protocol = 0;
+	int udp_csum;
+
+	if (unlikely(!pskb_may_pull(skb, sizeof(*uh))))
+		return ERR_PTR(-EINVAL);
+
+	uh = udp_hdr(skb);
+	udp_csum = uh->check != 0;
+
+	rcu_read_lock();
+	uo = udp_find_offload(uh->dest);
+	if (uo) {
+		tnl_hlen = sizeof(*uh) + uo->hdrlen;
+		protocol = uo->inner_proto;
+	}
+	rcu_read_unlock();
+
+	if (!uo)
+		return ERR_PTR(-EPROTONOSUPPORT);
+
+	if (protocol == htons(ETH_P_TEB)) {
+		if (!pskb_may_pull(skb, tnl_hlen + ETH_HLEN))
+			return ERR_PTR(-EINVAL);
+		protocol = ((struct ethhdr *)(skb->data + tnl_hlen))->h_proto;
+		mac_len = ETH_HLEN;
+	}
+
+	segs = skb_tunnel_gso_segment(skb, features, tnl_hlen, mac_len,
+				      protocol, SKB_GSO_UDP_TUNNEL);
+	if (!segs || IS_ERR(segs))
+		return segs;
+
+	for (seg = segs; seg; seg = seg->next) {
+		int offset = skb_transport_offset(seg);
+		const struct iphdr *iph = ip_hdr(seg);
+		__wsum csum;
+
+		uh = udp_hdr(seg);
+		uh->len = htons(seg->len - offset);
+		if (!udp_csum)
+			continue;
+
+		/* The outer checksum covers the inner one: resolve it first. */
+		if (seg->ip_summed == CHECKSUM_PARTIAL &&
+		    skb_checksum_help(seg)) {
+			while (segs) {
+				seg = segs;
+				segs = segs->next;
+				kfree_skb(seg);
+			}
+			return ERR_PTR(-EINVAL);
+		}
+
+		uh->check = 0;
+		csum = skb_checksum(seg, offset, seg->len - offset, 0);
+		uh->check = csum_tcpudp_magic(iph->saddr, iph->daddr,
+					      seg->len - offset, IPPROTO_UDP,
+					      csum);
+		if (uh->check == 0)
+			uh->check = CSUM_MANGLED_0;
+		seg->ip_summed = CHECKSUM_NONE;
+	}
+
+	return segs;
+}
+
 struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, int features)
 {
 	struct sk_buff *segs = ERR_PTR(-EINVAL);
@@ -1872,6 +1995,9 @@ struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, int features)
 	int offset;
 	__wsum csum;
 
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_TUNNEL)
+		return udp4_tunnel_segment(skb, features);
+
 	mss = skb_shinfo(skb)->gso_size;
 	if (unlikely(skb->len <= mss))
 		goto out;
@@ -1907,3 +2033,101 @@ out:
 	return segs;
 }
 
+struct sk_buff **udp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	struct udp_offload *uo;
+	struct udphdr *uh;
+	const struct iphdr *iph;
+	unsigned int hlen, off;
+	__wsum csum;
+	int flush = 1;
+
+	if (NAPI_GRO_CB(skb)->encap_mark || list_empty(&udp_offload_list))
+		goto out;
+
+	off = skb_gro_offset(skb);
+	hlen = off + sizeof(*uh);
+	uh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		uh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!uh))
+			goto out;
+	}
+
+	if (ntohs(uh->len) != skb_gro_len(skb))
+		goto out;
+
+	rcu_read_lock();
+	uo = udp_find_offload(uh->dest);
+	if (!uo || !uo->gro_receive)
+		goto out_unlock;
+
+	/*
+	 * The inner flow can only be merged once its checksum is known to
+	 * be good.  Unless the device already verified a non-zero outer
+	 * checksum, which covers the inner packet, sum it here; the stack
+	 * would otherwise do so after decapsulation.
+	 */
+	if (skb->ip_summed == CHECKSUM_NONE ||
+	    (skb->ip_summed == CHECKSUM_UNNECESSARY && !uh->check)) {
+		skb->csum = skb_checksum(skb, off, skb_gro_len(skb), 0);
+		skb->ip_summed = CHECKSUM_COMPLETE;
+	}
+
+	if (skb->ip_summed == CHECKSUM_COMPLETE && uh->check) {
+		iph = skb_gro_network_header(skb);
+		if (csum_tcpudp_magic(iph->saddr, iph->daddr, skb_gro_len(skb),
+				      IPPROTO_UDP, skb->csum))
+			goto out_unlock;
+	}
+
+	flush = 0;
+
+	for (p = *head; p; p = p->next) {
+		struct udphdr *uh2;
+
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		uh2 = (struct udphdr *)(p->data + off);
+		if (*(u32 *)&uh->source != *(u32 *)&uh2->source)
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	NAPI_GRO_CB(skb)->encap_mark = 1;
+	skb_gro_pull(skb, sizeof(*uh));
+
+	csum = skb->csum;
+	skb_postpull_rcsum(skb, uh, sizeof(*uh));
+
+	pp = uo->gro_receive(head, skb);
+
+	skb->csum = csum;
+
+out_unlock:
+	rcu_read_unlock();
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+int udp4_gro_complete(struct sk_buff *skb, int nhoff)
+{
+	struct udphdr *uh = (struct udphdr *)(skb->data + nhoff);
+	struct udp_offload *uo;
+	int err = -ENOSYS;
+
+	uh->len = htons(skb->len - nhoff);
+	skb_shinfo(skb)->gso_type |= SKB_GSO_UDP_TUNNEL;
+
+	rcu_read_lock();
+	uo = udp_find_offload(uh->dest);
+	if (uo && uo->gro_complete)
+		err = uo->gro_complete(skb, nhoff + sizeof(*uh));
+	rcu_read_unlock();
+
+	return err;
+}
@@ -168,6 +168,7 @@ struct dst_entry *__inet6_csk_dst_check(struct sock *sk, u32 cookie)
 	if (dst) {
 		struct rt6_info *rt = (struct rt6_info *)dst;
 		if (rt->rt6i_flow_cache_genid != atomic_read(&flow_cache_genid)) {
+			sk_tx_queue_clear(sk);
 			sk->sk_dst_cache = NULL;
 			dst_release(dst);
 			dst = NULL;
@@ -79,6 +79,8 @@
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/mutex.h>
+#include <linux/ethtool.h>
+#include <linux/rtnetlink.h>
 
 #ifdef CONFIG_INET
 #include <net/inet_common.h>
@@ -156,9 +158,56 @@ struct packet_mreq_max {
 };
 
 #ifdef CONFIG_PACKET_MMAP
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring);
 
+/*
+ * TPACKET_V3 block queue: the ring is a list of blocks, each packed with
+ * variable sized frames.  The kernel owns the block at kactive_blk_num
+ * and hands it to user space (TP_STATUS_USER) once it is full or has
+ * been open for retire_blk_tov msecs.  If user space has not returned
+ * the next block yet the queue is frozen and packets are dropped until
+ * it does.
+ */
+struct tpacket_kbdq_core {
+	char		**pkbdq;
+	unsigned int	feature_req_word;
+	unsigned int	hdrlen;
+	unsigned char	reset_pending_on_curr_blk;
+	unsigned char	delete_blk_timer;
+	unsigned short	kactive_blk_num;
+	unsigned short	blk_sizeof_priv;
+
+	/* last_kactive_blk_num:
+	 * trick to see if user-space has caught up
+	 * in order to avoid refreshing timer when every single pkt arrives.
+	 */
+	unsigned short	last_kactive_blk_num;
+
+	char		*pkblk_start;
+	char		*pkblk_end;
+	int		kblk_size;
+	unsigned int	max_frame_len;
+	unsigned int	knum_blocks;
+	uint64_t	knxt_seq_num;
+	char		*prev;
+	char		*nxt_offset;
+	struct sk_buff	*skb;
+
+	/* frames being copied outside the queue lock */
+	atomic_t	blk_fill_in_prog;
+
+	/* Default is set to 8ms */
+#define DEFAULT_PRB_RETIRE_TOV	(8)
+
+	unsigned short	retire_blk_tov;
+	unsigned short	version;
+	unsigned long	tov_in_jiffies;
+
+	/* timer to retire an outstanding block */
+	struct timer_list retire_blk_timer;
+};
+
 struct packet_ring_buffer {
 	char			**pg_vec;
 	unsigned int		head;
@@ -170,6 +219,7 @@ struct packet_ring_buffer {
 	unsigned int		pg_vec_pages;
 	unsigned int		pg_vec_len;
 
+	struct tpacket_kbdq_core	prb_bdqc;
 	atomic_t		pending;
 };
 
@@ -179,10 +229,11 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg);
 
 static void packet_flush_mclist(struct sock *sk);
 
+struct packet_fanout;
 struct packet_sock {
 	/* struct sock has to be the first member of packet_sock */
 	struct sock		sk;
-	struct tpacket_stats	stats;
+	union tpacket_stats_u	stats;
 #ifdef CONFIG_PACKET_MMAP
 	struct packet_ring_buffer	rx_ring;
 	struct packet_ring_buffer	tx_ring;
@@ -196,6 +247,7 @@ struct packet_sock {
 				origdev:1;
 	int			ifindex;	/* bound device		*/
 	__be16			num;
+	struct packet_fanout	*fanout;	/* fanout group or NULL	*/
 	struct packet_mclist	*mclist;
 #ifdef CONFIG_PACKET_MMAP
 	atomic_t		mapped;
@@ -206,6 +258,30 @@ struct packet_sock {
 #endif
 };
 
+/*
+ * A fanout group: one protocol hook shared by up to PACKET_FANOUT_MAX
+ * sockets bound to the same device and protocol.  Each packet is handed
+ * to exactly one member.  Members are added and removed under f->lock;
+ * the receive path reads arr[] locklessly.
+ */
+#define PACKET_FANOUT_MAX	256
+
+struct packet_fanout {
+#ifdef CONFIG_NET_NS
+	struct net		*net;
+#endif
+	unsigned int		num_members;
+	u16			id;
+	u8			type;
+	u8			defrag;
+	atomic_t		rr_cur;
+	struct list_head	list;
+	struct sock		*arr[PACKET_FANOUT_MAX];
+	spinlock_t		lock;
+	atomic_t		sk_ref;
+	struct packet_type	prot_hook ____cacheline_aligned_in_smp;
+};
+
 struct packet_skb_cb {
 	unsigned int origlen;
 	union {
@@ -319,6 +395,429 @@ static inline struct packet_sock *pkt_sk(struct sock *sk)
 	return (struct packet_sock *)sk;
 }
 
+#ifdef CONFIG_PACKET_MMAP
+
+#define V3_ALIGNMENT	(8)
+
+#define BLK_HDR_LEN	(ALIGN(sizeof(struct tpacket_block_desc), V3_ALIGNMENT))
+
+#define BLK_PLUS_PRIV(sz_of_priv) \
+	(BLK_HDR_LEN + ALIGN((sz_of_priv), V3_ALIGNMENT))
+
+#define BLOCK_STATUS(x)		((x)->hdr.bh1.block_status)
+#define BLOCK_NUM_PKTS(x)	((x)->hdr.bh1.num_pkts)
+#define BLOCK_O2FP(x)		((x)->hdr.bh1.offset_to_first_pkt)
+#define BLOCK_LEN(x)		((x)->hdr.bh1.blk_len)
+#define BLOCK_SNUM(x)		((x)->hdr.bh1.seq_num)
+#define BLOCK_O2PRIV(x)		((x)->offset_to_priv)
+
+#define GET_PBDQC_FROM_RB(x)	((struct tpacket_kbdq_core *)(&(x)->prb_bdqc))
+#define GET_PBLOCK_DESC(x, bid)	\
+	((struct tpacket_block_desc *)((x)->pkbdq[(bid)]))
+#define GET_CURR_PBLOCK_DESC_FROM_CORE(x)	\
+	((struct tpacket_block_desc *)((x)->pkbdq[(x)->kactive_blk_num]))
+#define GET_NEXT_PRB_BLK_NUM(x) \
+	(((x)->kactive_blk_num < ((x)->knum_blocks-1)) ? \
+	((x)->kactive_blk_num+1) : 0)
+
+#define TOTAL_PKT_LEN_INCL_ALIGN(length) (ALIGN((length), V3_ALIGNMENT))
+
+static void prb_retire_rx_blk_timer_expired(unsigned long data);
+
+static void prb_shutdown_retire_blk_timer(struct packet_sock *po,
+					  struct sk_buff_head *rb_queue)
+{
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(&po->rx_ring);
+
+	spin_lock_bh(&rb_queue->lock);
+	pkc->delete_blk_timer = 1;
+	spin_unlock_bh(&rb_queue->lock);
+
+	del_timer_sync(&pkc->retire_blk_timer);
+}
+
+/*
+ * Default block timeout: roughly the time the link needs to fill one
+ * block at line rate.  Slow or unknown links get DEFAULT_PRB_RETIRE_TOV.
+ */
+static int prb_calc_retire_blk_tmo(struct packet_sock *po,
+				   unsigned int blk_size_in_bytes)
+{
+	struct net_device *dev;
+	struct ethtool_cmd ecmd = { .cmd = ETHTOOL_GSET };
+	int err = -EOPNOTSUPP;
+
+	rtnl_lock();
+	dev = __dev_get_by_index(sock_net(&po->sk), po->ifindex);
+	if (dev && dev->ethtool_ops && dev->ethtool_ops->get_settings)
+		err = dev->ethtool_ops->get_settings(dev, &ecmd);
+	rtnl_unlock();
+
+	if (err || ecmd.speed < SPEED_1000)
+		return DEFAULT_PRB_RETIRE_TOV;
+
+	/* bits per block / bits per msec */
+	return (blk_size_in_bytes * 8) / (ecmd.speed * 1000) + 1;
+}
+
+static void init_prb_bdqc(struct packet_sock *po,
+			  struct packet_ring_buffer *rb,
+			  char **pg_vec, struct tpacket_req3 *req3,
+			  unsigned int retire_blk_tov);
+
+static void prb_open_block(struct tpacket_kbdq_core *pkc,
+			   struct tpacket_block_desc *pbd)
+{
+	struct timespec ts;
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+
+	smp_rmb();
+
+	BLOCK_SNUM(pbd) = pkc->knxt_seq_num++;
+	BLOCK_NUM_PKTS(pbd) = 0;
+	BLOCK_LEN(pbd) = BLK_PLUS_PRIV(pkc->blk_sizeof_priv);
+	getnstimeofday(&ts);
+	h1->ts_first_pkt.ts_sec = ts.tv_sec;
+	h1->ts_first_pkt.ts_nsec = ts.tv_nsec;
+
+	pkc->pkblk_start = (char *)pbd;
+	pkc->nxt_offset = pkc->pkblk_start + BLK_PLUS_PRIV(pkc->blk_sizeof_priv);
+	BLOCK_O2FP(pbd) = (__u32)BLK_PLUS_PRIV(pkc->blk_sizeof_priv);
+	BLOCK_O2PRIV(pbd) = BLK_HDR_LEN;
+	pbd->version = pkc->version;
+	pkc->prev = pkc->nxt_offset;
+	pkc->pkblk_end = pkc->pkblk_start + pkc->kblk_size;
+
+	/* opening a block thaws the queue */
+	pkc->reset_pending_on_curr_blk = 0;
+
+	mod_timer(&pkc->retire_blk_timer, jiffies + pkc->tov_in_jiffies);
+	pkc->last_kactive_blk_num = pkc->kactive_blk_num;
+
+	smp_wmb();
+}
+
+static void init_prb_bdqc(struct packet_sock *po,
+			  struct packet_ring_buffer *rb,
+			  char **pg_vec, struct tpacket_req3 *req3,
+			  unsigned int retire_blk_tov)
+{
+	struct tpacket_kbdq_core *p1 = GET_PBDQC_FROM_RB(rb);
+
+	memset(p1, 0x0, sizeof(*p1));
+
+	p1->knxt_seq_num = 1;
+	p1->pkbdq = pg_vec;
+	p1->pkblk_start	= pg_vec[0];
+	p1->kblk_size = req3->tp_block_size;
+	p1->knum_blocks	= req3->tp_block_nr;
+	p1->hdrlen = po->tp_hdrlen;
+	p1->version = po->tp_version;
+	p1->last_kactive_blk_num = 0;
+	po->stats.stats3.tp_freeze_q_cnt = 0;
+	p1->retire_blk_tov = retire_blk_tov;
+	p1->tov_in_jiffies = msecs_to_jiffies(p1->retire_blk_tov);
+	p1->blk_sizeof_priv = req3->tp_sizeof_priv;
+	p1->max_frame_len = p1->kblk_size - BLK_PLUS_PRIV(p1->blk_sizeof_priv);
+	p1->feature_req_word = req3->tp_feature_req_word;
+
+	setup_timer(&p1->retire_blk_timer, prb_retire_rx_blk_timer_expired,
+		    (unsigned long)po);
+
+	prb_open_block(p1, (struct tpacket_block_desc *)pg_vec[0]);
+}
+
+static void prb_flush_block(struct tpacket_kbdq_core *pkc,
+			    struct tpacket_block_desc *pbd, __u32 status)
+{
+	struct page *p_start, *p_end;
+
+	/* Flush everything but the header page, which holds the status */
+	p_start = virt_to_page((u8 *)pbd + PAGE_SIZE);
+	p_end = virt_to_page(pkc->pkblk_end - 1);
+	while (p_start <= p_end) {
+		flush_dcache_page(p_start);
+		p_start++;
+	}
+	smp_wmb();
+
+	BLOCK_STATUS(pbd) = status;
+	flush_dcache_page(virt_to_page(pbd));
+	smp_wmb();
+}
+
+/*
+ * Side effect:
+ *
+ * 1) flush the block
+ * 2) Increment active_blk_num
+ *
+ * Note:We DONT refresh the timer on purpose.
+ *	Because almost always the next block will be opened.
+ */
+static void prb_close_block(struct tpacket_kbdq_core *pkc,
+			    struct tpacket_block_desc *pbd,
+			    struct packet_sock *po, unsigned int stat)
+{
+	__u32 status = TP_STATUS_USER | stat;
+	struct tpacket3_hdr *last_pkt;
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+
+	if (po->stats.stats3.tp_drops)
+		status |= TP_STATUS_LOSING;
+
+	if (BLOCK_NUM_PKTS(pbd)) {
+		last_pkt = (struct tpacket3_hdr *)pkc->prev;
+		last_pkt->tp_next_offset = 0;
+		h1->ts_last_pkt.ts_sec = last_pkt->tp_sec;
+		h1->ts_last_pkt.ts_nsec	= last_pkt->tp_nsec;
+	} else {
+		/* Ok, we tmo'd - so get the current time */
+		struct timespec ts;
+
+		getnstimeofday(&ts);
+		h1->ts_last_pkt.ts_sec = ts.tv_sec;
+		h1->ts_last_pkt.ts_nsec	= ts.tv_nsec;
+	}
+
+	smp_wmb();
+
+	/* Flush the block */
+	prb_flush_block(pkc, pbd, status);
+
+	pkc->kactive_blk_num = GET_NEXT_PRB_BLK_NUM(pkc);
+
+	/* one wakeup per block */
+	po->sk.sk_data_ready(&po->sk, 0);
+}
+
+static inline int prb_queue_frozen(struct tpacket_kbdq_core *pkc)
+{
+	return pkc->reset_pending_on_curr_blk;
+}
+
+static inline int prb_curr_blk_in_use(struct tpacket_kbdq_core *pkc,
+				      struct tpacket_block_desc *pbd)
+{
+	return TP_STATUS_USER & BLOCK_STATUS(pbd);
+}
+
+/*
+ * Retire the current block and try to open the next one.  If user
+ * space still owns it the queue is frozen and NULL returned.
+ */
+static void *prb_dispatch_next_block(struct tpacket_kbdq_core *pkc,
+				     struct packet_sock *po)
+{
+	struct tpacket_block_desc *pbd;
+
+	smp_rmb();
+
+	pbd = GET_CURR_PBLOCK_DESC_FROM_CORE(pkc);
+
+	if (prb_curr_blk_in_use(pkc, pbd)) {
+		pkc->reset_pending_on_curr_blk = 1;
+		po->stats.stats3.tp_freeze_q_cnt++;
+		return NULL;
+	}
+
+	prb_open_block(pkc, pbd);
+	return (void *)pkc->nxt_offset;
+}
+
+static void prb_retire_current_block(struct tpacket_kbdq_core *pkc,
+				     struct packet_sock *po, unsigned int status)
+{
+	struct tpacket_block_desc *pbd = GET_CURR_PBLOCK_DESC_FROM_CORE(pkc);
+
+	/*
+	 * Frames of this block may still be being copied on other CPUs
+	 * (tpacket_rcv() drops the queue lock for the copy); wait for
+	 * them before handing the block over.  The timer has already
+	 * waited.
+	 */
+	if (!(status & TP_STATUS_BLK_TMO)) {
+		while (atomic_read(&pkc->blk_fill_in_prog))
+			cpu_relax();
+	}
+	prb_close_block(pkc, pbd, po, status);
+}
+
+/*
+ * Block timer: retire a partially filled block that has been open for
+ * retire_blk_tov, so that a slow trickle of packets still reaches user
+ * space, and reopen a frozen queue once user space has caught up.
+ */
+static void prb_retire_rx_blk_timer_expired(unsigned long data)
+{
+	struct packet_sock *po = (struct packet_sock *)data;
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(&po->rx_ring);
+	unsigned int frozen;
+	struct tpacket_block_desc *pbd;
+
+	spin_lock(&po->sk.sk_receive_queue.lock);
+
+	frozen = prb_queue_frozen(pkc);
+	pbd = GET_CURR_PBLOCK_DESC_FROM_CORE(pkc);
+
+	if (unlikely(pkc->delete_blk_timer))
+		goto out;
+
+	/*
+	 * tpacket_rcv() reserves room under the queue lock and then copies
+	 * without it; wait for copies into this block to finish.
+	 */
+	if (BLOCK_NUM_PKTS(pbd)) {
+		while (atomic_read(&pkc->blk_fill_in_prog))
+			cpu_relax();
+	}
+
+	if (pkc->last_kactive_blk_num == pkc->kactive_blk_num) {
+		if (!frozen) {
+			if (!BLOCK_NUM_PKTS(pbd))
+				goto refresh_timer;
+			prb_retire_current_block(pkc, po, TP_STATUS_BLK_TMO);
+			if (!prb_dispatch_next_block(pkc, po))
+				goto refresh_timer;
+			else
+				goto out;
+		} else {
+			/* user space is still holding the next block */
+			if (prb_curr_blk_in_use(pkc, pbd))
+				goto refresh_timer;
+
+			/* it caught up while the link was idle */
+			prb_open_block(pkc, pbd);
+			goto out;
+		}
+	}
+
+refresh_timer:
+	mod_timer(&pkc->retire_blk_timer, jiffies + pkc->tov_in_jiffies);
+	pkc->last_kactive_blk_num = pkc->kactive_blk_num;
+
+out:
+	spin_unlock(&po->sk.sk_receive_queue.lock);
+}
+
+static void prb_fill_curr_block(char *curr, struct tpacket_kbdq_core *pkc,
+				struct tpacket_block_desc *pbd,
+				unsigned int len)
+{
+	struct tpacket3_hdr *ppd = (struct tpacket3_hdr *)curr;
+
+	ppd->tp_next_offset = TOTAL_PKT_LEN_INCL_ALIGN(len);
+	pkc->prev = curr;
+	pkc->nxt_offset += TOTAL_PKT_LEN_INCL_ALIGN(len);
+	BLOCK_LEN(pbd) += TOTAL_PKT_LEN_INCL_ALIGN(len);
+	BLOCK_NUM_PKTS(pbd) += 1;
+	atomic_inc(&pkc->blk_fill_in_prog);
+
+	if (pkc->feature_req_word & TP_FT_REQ_FILL_RXHASH)
+		ppd->hv1.tp_rxhash = skb_flow_hash(pkc->skb);
+	else
+		ppd->hv1.tp_rxhash = 0;
+	ppd->hv1.tp_vlan_tci = pkc->skb->vlan_tci;
+}
+
+/* Assumes caller has the sk->rx_queue.lock */
+static void *__packet_lookup_frame_in_block(struct packet_sock *po,
+					    struct sk_buff *skb,
+					    unsigned int len)
+{
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(&po->rx_ring);
+	struct tpacket_block_desc *pbd = GET_CURR_PBLOCK_DESC_FROM_CORE(pkc);
+	char *curr, *end;
+
+	/* Queue is frozen when user space is lagging behind */
+	if (prb_queue_frozen(pkc)) {
+		/* still can't record this packet */
+		if (prb_curr_blk_in_use(pkc, pbd))
+			return NULL;
+		/* the block was released by user space, reopen it */
+		prb_open_block(pkc, pbd);
+	}
+
+	smp_mb();
+	curr = pkc->nxt_offset;
+	pkc->skb = skb;
+	end = (char *)pbd + pkc->kblk_size;
+
+	/* first try the current block */
+	if (curr + TOTAL_PKT_LEN_INCL_ALIGN(len) < end) {
+		prb_fill_curr_block(curr, pkc, pbd, len);
+		return (void *)curr;
+	}
+
+	/* Ok, close the current block */
+	prb_retire_current_block(pkc, po, 0);
+
+	/* Now, try to dispatch the next block */
+	curr = (char *)prb_dispatch_next_block(pkc, po);
+	if (curr) {
+		pbd = GET_CURR_PBLOCK_DESC_FROM_CORE(pkc);
+		prb_fill_curr_block(curr, pkc, pbd, len);
+		return (void *)curr;
+	}
+
+	/* user space hasn't caught up: the queue is frozen, drop */
+	return NULL;
+}
+
+static void *packet_current_rx_frame(struct packet_sock *po,
+				     struct sk_buff *skb,
+				     int status, unsigned int len)
+{
+	switch (po->tp_version) {
+	case TPACKET_V1:
+	case TPACKET_V2:
+		return packet_current_frame(po, &po->rx_ring, status);
+	case TPACKET_V3:
+		return __packet_lookup_frame_in_block(po, skb, len);
+	default:
+		WARN(1, "TPACKET version not supported\n");
+		BUG();
+		return NULL;
+	}
+}
+
+static void *prb_lookup_block(struct packet_sock *po,
+			      struct packet_ring_buffer *rb,
+			      unsigned int idx, int status)
+{
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(rb);
+	struct tpacket_block_desc *pbd = GET_PBLOCK_DESC(pkc, idx);
+
+	if (status != BLOCK_STATUS(pbd))
+		return NULL;
+	return pbd;
+}
+
+static void *packet_previous_rx_frame(struct packet_sock *po,
+				      struct packet_ring_buffer *rb,
+				      int status)
+{
+	struct tpacket_kbdq_core *pkc;
+	unsigned int prev;
+
+	if (po->tp_version <= TPACKET_V2)
+		return packet_previous_frame(po, rb, status);
+
+	pkc = GET_PBDQC_FROM_RB(rb);
+	prev = pkc->kactive_blk_num ? pkc->kactive_blk_num - 1 :
+				      pkc->knum_blocks - 1;
+	return prb_lookup_block(po, rb, prev, status);
+}
+
+static inline void prb_clear_blk_fill_status(struct packet_ring_buffer *rb)
+{
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(rb);
+
+	atomic_dec(&pkc->blk_fill_in_prog);
+}
+
+#endif /* CONFIG_PACKET_MMAP */
+
 static void packet_sock_destruct(struct sock *sk)
 {
 	WARN_ON(atomic_read(&sk->sk_rmem_alloc));
@@ -332,6 +831,245 @@ static void packet_sock_destruct(struct sock *sk)
 	sk_refcnt_debug_dec(sk);
 }
 
+static DEFINE_MUTEX(fanout_mutex);
+static LIST_HEAD(fanout_list);
+
+static struct sock *fanout_demux_hash(struct packet_fanout *f,
+				      struct sk_buff *skb, unsigned int num)
+{
+	u32 idx, hash = skb_flow_hash(skb);
+
+	idx = ((u64)hash * num) >> 32;
+
+	return f->arr[idx];
+}
+
+static struct sock *fanout_demux_lb(struct packet_fanout *f,
+				    struct sk_buff *skb, unsigned int num)
+{
+	int cur, old;
+
+	cur = atomic_read(&f->rr_cur);
+	while ((old = atomic_cmpxchg(&f->rr_cur, cur,
+				     (cur + 1 >= num ? 0 : cur + 1))) != cur)
+		cur = old;
+	/* a member may have left since rr_cur was last wrapped */
+	return f->arr[cur < num ? cur : 0];
+}
+
+static struct sock *fanout_demux_cpu(struct packet_fanout *f,
+				     struct sk_buff *skb, unsigned int num)
+{
+	unsigned int cpu = smp_processor_id();
+
+	return f->arr[cpu % num];
+}
+
+static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
+			     struct packet_type *pt, struct net_device *orig_dev)
+{
+	struct packet_fanout *f = pt->af_packet_priv;
+	unsigned int num = f->num_members;
+	struct packet_sock *po;
+	struct sock *sk;
+
+	if (dev_net(dev) != read_pnet(&f->net) || !num) {
+		kfree_skb(skb);
+		return 0;
+	}
+
+	/* pairs with the smp_wmb() in __fanout_link() */
+	smp_rmb();
+
+	switch (f->type) {
+	case PACKET_FANOUT_HASH:
+	default:
+#ifdef CONFIG_INET
+		if (f->defrag) {
+			skb = ip_check_defrag(skb, IP_DEFRAG_AF_PACKET);
+			if (!skb)
+				return 0;
+		}
+#endif
+		sk = fanout_demux_hash(f, skb, num);
+		break;
+	case PACKET_FANOUT_LB:
+		sk = fanout_demux_lb(f, skb, num);
+		break;
+	case PACKET_FANOUT_CPU:
+		sk = fanout_demux_cpu(f, skb, num);
+		break;
+	}
+
+	po = pkt_sk(sk);
+
+	return po->prot_hook.func(skb, dev, &po->prot_hook, orig_dev);
+}
+
+static void __fanout_link(struct sock *sk, struct packet_sock *po)
+{
+	struct packet_fanout *f = po->fanout;
+
+	spin_lock(&f->lock);
+	f->arr[f->num_members] = sk;
+	smp_wmb();
+	f->num_members++;
+	spin_unlock(&f->lock);
+}
+
+static void __fanout_unlink(struct sock *sk, struct packet_sock *po)
+{
+	struct packet_fanout *f = po->fanout;
+	int i;
+
+	spin_lock(&f->lock);
+	for (i = 0; i < f->num_members; i++) {
+		if (f->arr[i] == sk)
+			break;
+	}
+	BUG_ON(i >= f->num_members);
+	f->arr[i] = f->arr[f->num_members - 1];
+	f->num_members--;
+	spin_unlock(&f->lock);
+}
+
+/*
+ * Attach/detach the socket's receive hook, or its slot in the fanout
+ * group if it has joined one.  Called with po->bind_lock held, or
+ * before the socket is visible to anyone else.
+ */
+static void register_prot_hook(struct sock *sk)
+{
+	struct packet_sock *po = pkt_sk(sk);
+
+	if (!po->running) {
+		if (po->fanout)
+			__fanout_link(sk, po);
+		else
+			dev_add_pack(&po->prot_hook);
+		sock_hold(sk);
+		po->running = 1;
+	}
+}
+
+static void unregister_prot_hook(struct sock *sk)
+{
+	struct packet_sock *po = pkt_sk(sk);
+
+	if (po->running) {
+		po->running = 0;
+		if (po->fanout)
+			__fanout_unlink(sk, po);
+		else
+			__dev_remove_pack(&po->prot_hook);
+		__sock_put(sk);
+	}
+}
+
+static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
+{
+	struct packet_sock *po = pkt_sk(sk);
+	struct packet_fanout *f, *match;
+	u8 type = type_flags & 0xff;
+	u8 defrag = (type_flags & PACKET_FANOUT_FLAG_DEFRAG) ? 1 : 0;
+	int err;
+
+	switch (type) {
+	case PACKET_FANOUT_HASH:
+	case PACKET_FANOUT_LB:
+	case PACKET_FANOUT_CPU:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (!po->running)
+		return -EINVAL;
+
+	if (po->fanout)
+		return -EALREADY;
+
+	mutex_lock(&fanout_mutex);
+	match = NULL;
+	list_for_each_entry(f, &fanout_list, list) {
+		if (f->id == id &&
+		    read_pnet(&f->net) == sock_net(sk)) {
+			match = f;
+			break;
+		}
+	}
+	err = -EINVAL;
+	if (match && match->defrag != defrag)
+		goto out;
+	if (!match) {
+		err = -ENOMEM;
+		match = kzalloc(sizeof(*match), GFP_KERNEL);
+		if (!match)
+			goto out;
+		write_pnet(&match->net, sock_net(sk));
+		match->id = id;
+		match->type = type;
+		match->defrag = defrag;
+		atomic_set(&match->rr_cur, 0);
+		INIT_LIST_HEAD(&match->list);
+		spin_lock_init(&match->lock);
+		atomic_set(&match->sk_ref, 0);
+		match->prot_hook.type = po->prot_hook.type;
+		match->prot_hook.dev = po->prot_hook.dev;
+		match->prot_hook.func = packet_rcv_fanout;
+		match->prot_hook.af_packet_priv = match;
+		dev_add_pack(&match->prot_hook);
+		list_add(&match->list, &fanout_list);
+	}
+	err = -EINVAL;
+
+	spin_lock(&po->bind_lock);
+	if (po->running && !po->fanout &&
+	    match->type == type &&
+	    match->prot_hook.type == po->prot_hook.type &&
+	    match->prot_hook.dev == po->prot_hook.dev) {
+		err = -ENOSPC;
+		if (atomic_read(&match->sk_ref) < PACKET_FANOUT_MAX) {
+			__dev_remove_pack(&po->prot_hook);
+			po->fanout = match;
+			atomic_inc(&match->sk_ref);
+			__fanout_link(sk, po);
+			err = 0;
+		}
+	}
+	spin_unlock(&po->bind_lock);
+
+	if (err && !atomic_read(&match->sk_ref)) {
+		list_del(&match->list);
+		dev_remove_pack(&match->prot_hook);
+		kfree(match);
+	}
+out:
+	mutex_unlock(&fanout_mutex);
+	return err;
+}
+
+/* Called once the socket is no longer running. */
+static void fanout_release(struct sock *sk)
+{
+	struct packet_sock *po = pkt_sk(sk);
+	struct packet_fanout *f;
+
+	f = po->fanout;
+	if (!f)
+		return;
+
+	po->fanout = NULL;
+
+	mutex_lock(&fanout_mutex);
+	if (atomic_dec_and_test(&f->sk_ref)) {
+		list_del(&f->list);
+		dev_remove_pack(&f->prot_hook);
+		kfree(f);
+	}
+	mutex_unlock(&fanout_mutex);
+}
+
 
 static const struct proto_ops packet_ops;
 
@@ -625,7 +1363,7 @@ static int packet_rcv(struct sk_buff *skb, struct net_device *dev,
 	nf_reset(skb);
 
 	spin_lock(&sk->sk_receive_queue.lock);
-	po->stats.tp_packets++;
+	po->stats.stats1.tp_packets++;
 	__skb_queue_tail(&sk->sk_receive_queue, skb);
 	spin_unlock(&sk->sk_receive_queue.lock);
 	sk->sk_data_ready(sk, skb->len);
@@ -633,7 +1371,7 @@ static int packet_rcv(struct sk_buff *skb, struct net_device *dev,
 
 drop_n_acct:
 	spin_lock(&sk->sk_receive_queue.lock);
-	po->stats.tp_drops++;
+	po->stats.stats1.tp_drops++;
 	spin_unlock(&sk->sk_receive_queue.lock);
 
 drop_n_restore:
@@ -656,6 +1394,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	union {
 		struct tpacket_hdr *h1;
 		struct tpacket2_hdr *h2;
+		struct tpacket3_hdr *h3;
 		void *raw;
 	} h;
 	u8 *skb_head = skb->data;
@@ -707,35 +1446,46 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		macoff = netoff - maclen;
 	}
 
-	if (macoff + snaplen > po->rx_ring.frame_size) {
-		if (po->copy_thresh &&
-		    atomic_read(&sk->sk_rmem_alloc) + skb->truesize <
-		    (unsigned)sk->sk_rcvbuf) {
-			if (skb_shared(skb)) {
-				copy_skb = skb_clone(skb, GFP_ATOMIC);
-			} else {
-				copy_skb = skb_get(skb);
-				skb_head = skb->data;
+	if (po->tp_version <= TPACKET_V2) {
+		if (macoff + snaplen > po->rx_ring.frame_size) {
+			if (po->copy_thresh &&
+			    atomic_read(&sk->sk_rmem_alloc) + skb->truesize <
+			    (unsigned)sk->sk_rcvbuf) {
+				if (skb_shared(skb)) {
+					copy_skb = skb_clone(skb, GFP_ATOMIC);
+				} else {
+					copy_skb = skb_get(skb);
+					skb_head = skb->data;
+				}
+				if (copy_skb)
+					skb_set_owner_r(copy_skb, sk);
 			}
-			if (copy_skb)
-				skb_set_owner_r(copy_skb, sk);
+			snaplen = po->rx_ring.frame_size - macoff;
+			if ((int)snaplen < 0)
+				snaplen = 0;
 		}
-		snaplen = po->rx_ring.frame_size - macoff;
+	} else if (unlikely(macoff + snaplen >
+			    GET_PBDQC_FROM_RB(&po->rx_ring)->max_frame_len)) {
+		/* V3 frames never span blocks, and there is no copy_thresh */
+		snaplen = GET_PBDQC_FROM_RB(&po->rx_ring)->max_frame_len -
+			  macoff;
 		if ((int)snaplen < 0)
 			snaplen = 0;
 	}
 
 	spin_lock(&sk->sk_receive_queue.lock);
-	h.raw = packet_current_frame(po, &po->rx_ring, TP_STATUS_KERNEL);
+	h.raw = packet_current_rx_frame(po, skb, TP_STATUS_KERNEL,
+					(macoff + snaplen));
 	if (!h.raw)
 		goto ring_is_full;
-	packet_increment_head(&po->rx_ring);
-	po->stats.tp_packets++;
+	if (po->tp_version <= TPACKET_V2)
+		packet_increment_head(&po->rx_ring);
+	po->stats.stats1.tp_packets++;
 	if (copy_skb) {
 		status |= TP_STATUS_COPY;
 		__skb_queue_tail(&sk->sk_receive_queue, copy_skb);
 	}
-	if (!po->stats.tp_drops)
+	if (!po->stats.stats1.tp_drops)
 		status &= ~TP_STATUS_LOSING;
 	spin_unlock(&sk->sk_receive_queue.lock);
 
@@ -769,6 +1519,23 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		h.h2->tp_vlan_tci = skb->vlan_tci;
 		hdrlen = sizeof(*h.h2);
 		break;
+	case TPACKET_V3:
+		/* tp_next_offset and hv1 were filled in when the room in
+		 * the block was reserved.
+		 */
+		h.h3->tp_status = status;
+		h.h3->tp_len = skb->len;
+		h.h3->tp_snaplen = snaplen;
+		h.h3->tp_mac = macoff;
+		h.h3->tp_net = netoff;
+		if (skb->tstamp.tv64)
+			ts = ktime_to_timespec(skb->tstamp);
+		else
+			getnstimeofday(&ts);
+		h.h3->tp_sec = ts.tv_sec;
+		h.h3->tp_nsec = ts.tv_nsec;
+		hdrlen = sizeof(*h.h3);
+		break;
 	default:
 		BUG();
 	}
@@ -784,22 +1551,24 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	else
 		sll->sll_ifindex = dev->ifindex;
 
-	__packet_set_status(po, h.raw, status);
 	smp_mb();
-	{
+	if (po->tp_version <= TPACKET_V2) {
 		struct page *p_start, *p_end;
 		u8 *h_end = h.raw + macoff + snaplen - 1;
 
+		__packet_set_status(po, h.raw, status);
 		p_start = virt_to_page(h.raw);
 		p_end = virt_to_page(h_end);
 		while (p_start <= p_end) {
 			flush_dcache_page(p_start);
 			p_start++;
 		}
+		sk->sk_data_ready(sk, 0);
+	} else {
+		/* the block is flushed and user space woken when it closes */
+		prb_clear_blk_fill_status(&po->rx_ring);
 	}
 
-	sk->sk_data_ready(sk, 0);
-
 drop_n_restore:
 	if (skb_head != skb->data && skb_shared(skb)) {
 		skb->data = skb_head;
@@ -810,7 +1579,7 @@ drop:
 	return 0;
 
 ring_is_full:
-	po->stats.tp_drops++;
+	po->stats.stats1.tp_drops++;
 	spin_unlock(&sk->sk_receive_queue.lock);
 
 	sk->sk_data_ready(sk, 0);
@@ -1177,7 +1946,7 @@ static int packet_release(struct socket *sock)
 	struct packet_sock *po;
 	struct net *net;
 #ifdef CONFIG_PACKET_MMAP
-	struct tpacket_req req;
+	union tpacket_req_u req_u;
 #endif
 
 	if (!sk)
@@ -1195,26 +1964,24 @@ static int packet_release(struct socket *sock)
 	 *	Unhook packet receive handler.
 	 */
 
-	if (po->running) {
-		/*
-		 *	Remove the protocol hook
-		 */
-		dev_remove_pack(&po->prot_hook);
-		po->running = 0;
-		po->num = 0;
-		__sock_put(sk);
-	}
+	spin_lock(&po->bind_lock);
+	unregister_prot_hook(sk);
+	po->num = 0;
+	spin_unlock(&po->bind_lock);
+
+	synchronize_net();
+	fanout_release(sk);
 
 	packet_flush_mclist(sk);
 
 #ifdef CONFIG_PACKET_MMAP
-	memset(&req, 0, sizeof(req));
+	memset(&req_u, 0, sizeof(req_u));
 
 	if (po->rx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 0);
+		packet_set_ring(sk, &req_u, 1, 0);
 
 	if (po->tx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 1);
+		packet_set_ring(sk, &req_u, 1, 1);
 #endif
 
 	/*
@@ -1240,6 +2007,8 @@ static int packet_release(struct socket *sock)
 static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protocol)
 {
 	struct packet_sock *po = pkt_sk(sk);
+	int err = 0;
+
 	/*
 	 *	Detach an existing hook if present.
 	 */
@@ -1247,12 +2016,18 @@ static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protoc
 	lock_sock(sk);
 
 	spin_lock(&po->bind_lock);
+
+	/* a fanout member cannot move to another device or protocol */
+	if (po->fanout) {
+		err = -EINVAL;
+		goto out_unlock;
+	}
+
 	if (po->running) {
-		__sock_put(sk);
-		po->running = 0;
+		unregister_prot_hook(sk);
 		po->num = 0;
 		spin_unlock(&po->bind_lock);
-		dev_remove_pack(&po->prot_hook);
+		synchronize_net();
 		spin_lock(&po->bind_lock);
 	}
 
@@ -1266,9 +2041,7 @@ static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protoc
 		goto out_unlock;
 
 	if (!dev || (dev->flags & IFF_UP)) {
-		dev_add_pack(&po->prot_hook);
-		sock_hold(sk);
-		po->running = 1;
+		register_prot_hook(sk);
 	} else {
 		sk->sk_err = ENETDOWN;
 		if (!sock_flag(sk, SOCK_DEAD))
@@ -1278,7 +2051,7 @@ static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protoc
 out_unlock:
 	spin_unlock(&po->bind_lock);
 	release_sock(sk);
-	return 0;
+	return err;
 }
 
 /*
@@ -1398,9 +2171,7 @@ static int packet_create(struct net *net, struct socket *sock, int protocol)
 
 	if (proto) {
 		po->prot_hook.type = proto;
-		dev_add_pack(&po->prot_hook);
-		sock_hold(sk);
-		po->running = 1;
+		register_prot_hook(sk);
 	}
 
 	write_lock_bh(&net->packet.sklist_lock);
@@ -1742,13 +2513,25 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 	case PACKET_RX_RING:
 	case PACKET_TX_RING:
 	{
-		struct tpacket_req req;
+		union tpacket_req_u req_u;
+		int len;
 
-		if (optlen < sizeof(req))
+		switch (po->tp_version) {
+		case TPACKET_V1:
+		case TPACKET_V2:
+			len = sizeof(req_u.req);
+			break;
+		case TPACKET_V3:
+		default:
+			len = sizeof(req_u.req3);
+			break;
+		}
+		if (optlen < len)
 			return -EINVAL;
-		if (copy_from_user(&req, optval, sizeof(req)))
+		if (copy_from_user(&req_u.req, optval, len))
 			return -EFAULT;
-		return packet_set_ring(sk, &req, 0, optname == PACKET_TX_RING);
+		return packet_set_ring(sk, &req_u, 0,
+				       optname == PACKET_TX_RING);
 	}
 	case PACKET_COPY_THRESH:
 	{
@@ -1775,6 +2558,7 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		switch (val) {
 		case TPACKET_V1:
 		case TPACKET_V2:
+		case TPACKET_V3:
 			po->tp_version = val;
 			return 0;
 		default:
@@ -1832,6 +2616,17 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		po->origdev = !!val;
 		return 0;
 	}
+	case PACKET_FANOUT:
+	{
+		int val;
+
+		if (optlen != sizeof(val))
+			return -EINVAL;
+		if (copy_from_user(&val, optval, sizeof(val)))
+			return -EFAULT;
+
+		return fanout_add(sk, val & 0xffff, val >> 16);
+	}
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -1845,7 +2640,7 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 	struct sock *sk = sock->sk;
 	struct packet_sock *po = pkt_sk(sk);
 	void *data;
-	struct tpacket_stats st;
+	union tpacket_stats_u st;
 
 	if (level != SOL_PACKET)
 		return -ENOPROTOOPT;
@@ -1858,15 +2653,24 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 
 	switch (optname) {
 	case PACKET_STATISTICS:
-		if (len > sizeof(struct tpacket_stats))
-			len = sizeof(struct tpacket_stats);
 		spin_lock_bh(&sk->sk_receive_queue.lock);
 		st = po->stats;
 		memset(&po->stats, 0, sizeof(st));
 		spin_unlock_bh(&sk->sk_receive_queue.lock);
-		st.tp_packets += st.tp_drops;
+#ifdef CONFIG_PACKET_MMAP
+		if (po->tp_version == TPACKET_V3) {
+			if (len > sizeof(struct tpacket_stats_v3))
+				len = sizeof(struct tpacket_stats_v3);
+			st.stats3.tp_packets += st.stats3.tp_drops;
+			data = &st.stats3;
+			break;
+		}
+#endif
+		if (len > sizeof(struct tpacket_stats))
+			len = sizeof(struct tpacket_stats);
+		st.stats1.tp_packets += st.stats1.tp_drops;
 
-		data = &st;
+		data = &st.stats1;
 		break;
 	case PACKET_AUXDATA:
 		if (len > sizeof(int))
@@ -1901,6 +2705,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 		case TPACKET_V2:
 			val = sizeof(struct tpacket2_hdr);
 			break;
+		case TPACKET_V3:
+			val = sizeof(struct tpacket3_hdr);
+			break;
 		default:
 			return -EINVAL;
 		}
@@ -1919,6 +2726,17 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 		data = &val;
 		break;
 #endif
+	case PACKET_FANOUT:
+		if (len > sizeof(int))
+			len = sizeof(int);
+		val = (po->fanout ?
+		       ((u32)po->fanout->id |
+			((u32)po->fanout->type << 16) |
+			(po->fanout->defrag ?
+			 ((u32)PACKET_FANOUT_FLAG_DEFRAG << 16) : 0)) :
+		       0);
+		data = &val;
+		break;
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -1952,9 +2770,7 @@ static int packet_notifier(struct notifier_block *this, unsigned long msg, void
 			if (dev->ifindex == po->ifindex) {
 				spin_lock(&po->bind_lock);
 				if (po->running) {
-					__dev_remove_pack(&po->prot_hook);
-					__sock_put(sk);
-					po->running = 0;
+					unregister_prot_hook(sk);
 					sk->sk_err = ENETDOWN;
 					if (!sock_flag(sk, SOCK_DEAD))
 						sk->sk_error_report(sk);
@@ -1968,12 +2784,8 @@ static int packet_notifier(struct notifier_block *this, unsigned long msg, void
 			break;
 		case NETDEV_UP:
 			spin_lock(&po->bind_lock);
-			if (dev->ifindex == po->ifindex && po->num &&
-			    !po->running) {
-				dev_add_pack(&po->prot_hook);
-				sock_hold(sk);
-				po->running = 1;
-			}
+			if (dev->ifindex == po->ifindex && po->num)
+				register_prot_hook(sk);
 			spin_unlock(&po->bind_lock);
 			break;
 		}
@@ -2052,7 +2864,8 @@ static unsigned int packet_poll(struct file *file, struct socket *sock,
 
 	spin_lock_bh(&sk->sk_receive_queue.lock);
 	if (po->rx_ring.pg_vec) {
-		if (!packet_previous_frame(po, &po->rx_ring, TP_STATUS_KERNEL))
+		if (!packet_previous_rx_frame(po, &po->rx_ring,
+					      TP_STATUS_KERNEL))
 			mask |= POLLIN | POLLRDNORM;
 	}
 	spin_unlock_bh(&sk->sk_receive_queue.lock);
@@ -2138,7 +2951,7 @@ out_free_pgvec:
 	goto out;
 }
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring)
 {
 	char **pg_vec = NULL;
@@ -2146,12 +2959,18 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	int was_running, order = 0;
 	struct packet_ring_buffer *rb;
 	struct sk_buff_head *rb_queue;
+	struct tpacket_req *req = &req_u->req;
+	unsigned int retire_blk_tov = 0;
 	__be16 num;
 	int err;
 
 	rb = tx_ring ? &po->tx_ring : &po->rx_ring;
 	rb_queue = tx_ring ? &sk->sk_write_queue : &sk->sk_receive_queue;
 
+	/* Block-based rings are receive only */
+	if (!closing && tx_ring && po->tp_version > TPACKET_V2)
+		return -EINVAL;
+
 	err = -EBUSY;
 	if (!closing) {
 		if (atomic_read(&po->mapped))
@@ -2173,6 +2992,9 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 		case TPACKET_V2:
 			po->tp_hdrlen = TPACKET2_HDRLEN;
 			break;
+		case TPACKET_V3:
+			po->tp_hdrlen = TPACKET3_HDRLEN;
+			break;
 		}
 
 		err = -EINVAL;
@@ -2180,6 +3002,18 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 			goto out;
 		if (unlikely(req->tp_block_size & (PAGE_SIZE - 1)))
 			goto out;
+		if (po->tp_version == TPACKET_V3) {
+			struct tpacket_req3 *req3 = &req_u->req3;
+
+			/* the private area must leave room for a frame */
+			if (unlikely(req3->tp_sizeof_priv >= USHORT_MAX ||
+				     BLK_PLUS_PRIV(req3->tp_sizeof_priv) +
+				     po->tp_hdrlen + po->tp_reserve >
+				     req3->tp_block_size))
+				goto out;
+			if (unlikely(req3->tp_block_nr > USHORT_MAX))
+				goto out;
+		}
 		if (unlikely(req->tp_frame_size < po->tp_hdrlen +
 					po->tp_reserve))
 			goto out;
@@ -2198,6 +3032,13 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 		pg_vec = alloc_pg_vec(req, order);
 		if (unlikely(!pg_vec))
 			goto out;
+
+		if (po->tp_version == TPACKET_V3 && !tx_ring) {
+			retire_blk_tov = req_u->req3.tp_retire_blk_tov;
+			if (!retire_blk_tov)
+				retire_blk_tov = prb_calc_retire_blk_tmo(po,
+							req->tp_block_size);
+		}
 	}
 	/* Done */
 	else {
@@ -2213,10 +3054,8 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	was_running = po->running;
 	num = po->num;
 	if (was_running) {
-		__dev_remove_pack(&po->prot_hook);
+		unregister_prot_hook(sk);
 		po->num = 0;
-		po->running = 0;
-		__sock_put(sk);
 	}
 	spin_unlock(&po->bind_lock);
 
@@ -2226,6 +3065,12 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	mutex_lock(&po->pg_vec_lock);
 	if (closing || atomic_read(&po->mapped) == 0) {
 		err = 0;
+		/* The old ring's block timer must not outlive it */
+		if (!tx_ring && rb->pg_vec && po->tp_version == TPACKET_V3)
+			prb_shutdown_retire_blk_timer(po, rb_queue);
+		if (pg_vec && retire_blk_tov)
+			init_prb_bdqc(po, rb, pg_vec, &req_u->req3,
+				      retire_blk_tov);
 #define XC(a, b) ({ __typeof__ ((a)) __t; __t = (a); (a) = (b); __t; })
 		spin_lock_bh(&rb_queue->lock);
 		pg_vec = XC(rb->pg_vec, pg_vec);
@@ -2250,10 +3095,8 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 
 	spin_lock(&po->bind_lock);
 	if (was_running && !po->running) {
-		sock_hold(sk);
-		po->running = 1;
 		po->num = num;
-		dev_add_pack(&po->prot_hook);
+		register_prot_hook(sk);
 	}
 	spin_unlock(&po->bind_lock);
 
@@ -683,6 +683,9 @@ static int qdisc_graft(struct net_device *dev, struct Qdisc *parent,
 			num_q = 0;
 		}
 
+		if (new && !ingress && num_q == 1)
+			new->flags |= TCQ_F_ONETXQUEUE;
+
 		for (i = 0; i < num_q; i++) {
 			struct netdev_queue *dev_queue = &dev->rx_queue;
 
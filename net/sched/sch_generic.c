@@ -47,26 +47,92 @@ static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
 	return 0;
 }
 
-static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
+/* Put back the unsent tail of a batch, ahead of anything requeued before */
+static inline void dev_requeue_batch(struct sk_buff_head *more, struct Qdisc *q)
 {
+	q->q.qlen += skb_queue_len(more);
+	skb_queue_splice_init(more, &q->requeue);
+	__netif_schedule(q);
+}
+
+static inline struct sk_buff *__dequeue_one(struct Qdisc *q)
+{
+	struct sk_buff *skb = __skb_dequeue(&q->requeue);
+
+	if (skb) {
+		q->q.qlen--;
+		return skb;
+	}
+	return q->dequeue(q);
+}
+
+/* Bytes the driver queue can take now; 0 unless it uses BQL */
+static inline int qdisc_avail_bulklimit(const struct netdev_queue *txq)
+{
+#ifdef CONFIG_BQL
+	return dql_avail(&txq->dql);
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Pull more packets for the same TX queue while the driver has byte
+ * queue room, so that sch_direct_xmit() can send them under one TX lock
+ * and the driver can ring its doorbell once.  Only the last packet of a
+ * batch may need software GSO, as a segmented skb cannot be requeued on
+ * a list.
+ */
+static void try_bulk_dequeue_skb(struct Qdisc *q, struct sk_buff *skb,
+				 struct netdev_queue *txq,
+				 struct sk_buff_head *more)
+{
+	struct net_device *dev = qdisc_dev(q);
+	int bytelimit = qdisc_avail_bulklimit(txq) - skb->len;
+
+	if (netif_needs_gso(dev, skb))
+		return;
+
+	while (bytelimit > 0) {
+		struct sk_buff *nskb = __dequeue_one(q);
+
+		if (!nskb)
+			break;
+		bytelimit -= nskb->len;
+		__skb_queue_tail(more, nskb);
+		if (netif_needs_gso(dev, nskb))
+			break;
+	}
+}
+
+static inline struct sk_buff *dequeue_skb(struct Qdisc *q,
+					  struct netdev_queue **ptxq,
+					  struct sk_buff_head *more)
+{
+	struct net_device *dev = qdisc_dev(q);
 	struct sk_buff *skb = q->gso_skb;
+	struct netdev_queue *txq;
 
 	if (unlikely(skb)) {
-		struct net_device *dev = qdisc_dev(q);
-		struct netdev_queue *txq;
-
 		/* check the reason of requeuing without tx lock first */
 		txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
-		if (!netif_tx_queue_stopped(txq) &&
-		    !netif_tx_queue_frozen(txq)) {
+		if (!netif_xmit_frozen_or_stopped(txq)) {
 			q->gso_skb = NULL;
 			q->q.qlen--;
 		} else
-			skb = NULL;
+			return NULL;
 	} else {
-		skb = q->dequeue(q);
+		skb = __dequeue_one(q);
+		if (!skb)
+			return NULL;
+		txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
 	}
 
+	if ((q->flags & TCQ_F_ONETXQUEUE) && !skb->next &&
+	    !netif_xmit_frozen_or_stopped(txq))
+		try_bulk_dequeue_skb(q, skb, txq, more);
+
+	*ptxq = txq;
 	return skb;
 }
 
@@ -101,7 +167,9 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 }
 
 /*
- * Transmit one skb, and handle the return status as required. Holding the
+ * Transmit one skb, followed by the batch in @more if any, and handle the
+ * return status as required. Every packet but the last of a batch is
+ * handed to the driver with skb->xmit_more set. Holding the
  * __QDISC_STATE_RUNNING bit guarantees that only one CPU can execute this
  * function.
  *
@@ -111,7 +179,7 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
  */
 int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 		    struct net_device *dev, struct netdev_queue *txq,
-		    spinlock_t *root_lock)
+		    spinlock_t *root_lock, struct sk_buff_head *more)
 {
 	int ret = NETDEV_TX_BUSY;
 
@@ -119,13 +187,22 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 	spin_unlock(root_lock);
 
 	HARD_TX_LOCK(dev, txq, smp_processor_id());
-	if (!netif_tx_queue_stopped(txq) &&
-	    !netif_tx_queue_frozen(txq))
-		ret = dev_hard_start_xmit(skb, dev, txq);
+	while (!netif_xmit_frozen_or_stopped(txq)) {
+		bool batch = more && !skb_queue_empty(more);
+
+		ret = dev_hard_start_xmit(skb, dev, txq, batch);
+		if (ret != NETDEV_TX_OK || !batch)
+			break;
+		skb = __skb_dequeue(more);
+		ret = NETDEV_TX_BUSY;
+	}
 	HARD_TX_UNLOCK(dev, txq);
 
 	spin_lock(root_lock);
 
+	if (unlikely(more && !skb_queue_empty(more)))
+		dev_requeue_batch(more, q);
+
 	switch (ret) {
 	case NETDEV_TX_OK:
 		/* Driver sent out skb successfully */
@@ -147,8 +224,7 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 		break;
 	}
 
-	if (ret && (netif_tx_queue_stopped(txq) ||
-		    netif_tx_queue_frozen(txq)))
+	if (ret && netif_xmit_frozen_or_stopped(txq))
 		ret = 0;
 
 	return ret;
@@ -176,20 +252,19 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 static inline int qdisc_restart(struct Qdisc *q)
 {
 	struct netdev_queue *txq;
-	struct net_device *dev;
+	struct sk_buff_head more;
 	spinlock_t *root_lock;
 	struct sk_buff *skb;
 
-	/* Dequeue packet */
-	skb = dequeue_skb(q);
+	/* Dequeue packet, and more for the same queue if the driver has room */
+	__skb_queue_head_init(&more);
+	skb = dequeue_skb(q, &txq, &more);
 	if (unlikely(!skb))
 		return 0;
 
 	root_lock = qdisc_lock(q);
-	dev = qdisc_dev(q);
-	txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
 
-	return sch_direct_xmit(skb, q, dev, txq, root_lock);
+	return sch_direct_xmit(skb, q, qdisc_dev(q), txq, root_lock, &more);
 }
 
 void __qdisc_run(struct Qdisc *q)
@@ -247,7 +322,7 @@ static void dev_watchdog(unsigned long arg)
 				 * old device drivers set dev->trans_start
 				 */
 				trans_start = txq->trans_start ? : dev->trans_start;
-				if (netif_tx_queue_stopped(txq) &&
+				if (netif_xmit_stopped(txq) &&
 				    time_after(jiffies, (trans_start +
 							 dev->watchdog_timeo))) {
 					some_queue_timedout = 1;
@@ -526,6 +601,8 @@ struct Qdisc_ops pfifo_fast_ops __read_mostly = {
 	.owner		=	THIS_MODULE,
 };
 
+static struct lock_class_key qdisc_tx_busylock;
+
 struct Qdisc *qdisc_alloc(struct netdev_queue *dev_queue,
 			  struct Qdisc_ops *ops)
 {
@@ -546,6 +623,9 @@ struct Qdisc *qdisc_alloc(struct netdev_queue *dev_queue,
 
 	INIT_LIST_HEAD(&sch->list);
 	skb_queue_head_init(&sch->q);
+	__skb_queue_head_init(&sch->requeue);
+	spin_lock_init(&sch->busylock);
+	lockdep_set_class(&sch->busylock, &qdisc_tx_busylock);
 	sch->ops = ops;
 	sch->enqueue = ops->enqueue;
 	sch->dequeue = ops->dequeue;
@@ -593,6 +673,10 @@ void qdisc_reset(struct Qdisc *qdisc)
 		qdisc->gso_skb = NULL;
 		qdisc->q.qlen = 0;
 	}
+	if (!skb_queue_empty(&qdisc->requeue)) {
+		__skb_queue_purge(&qdisc->requeue);
+		qdisc->q.qlen = 0;
+	}
 }
 EXPORT_SYMBOL(qdisc_reset);
 
@@ -619,6 +703,7 @@ void qdisc_destroy(struct Qdisc *qdisc)
 	dev_put(qdisc_dev(qdisc));
 
 	kfree_skb(qdisc->gso_skb);
+	__skb_queue_purge(&qdisc->requeue);
 	kfree((char *) qdisc - qdisc->padded);
 }
 EXPORT_SYMBOL(qdisc_destroy);
@@ -662,8 +747,10 @@ static void attach_one_default_qdisc(struct net_device *dev,
 			return;
 		}
 
-		/* Can by-pass the queue discipline for default qdisc */
-		qdisc->flags |= TCQ_F_CAN_BYPASS;
+		/* Can by-pass the queue discipline for default qdisc;
+		 * only reached for single queue devices.
+		 */
+		qdisc->flags |= TCQ_F_CAN_BYPASS | TCQ_F_ONETXQUEUE;
 	} else {
 		qdisc =  &noqueue_qdisc;
 	}
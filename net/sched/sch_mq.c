@@ -60,7 +60,7 @@ static int mq_init(struct Qdisc *sch, struct nlattr *opt)
 						    TC_H_MIN(ntx + 1)));
 		if (qdisc == NULL)
 			goto err;
-		qdisc->flags |= TCQ_F_CAN_BYPASS;
+		qdisc->flags |= TCQ_F_CAN_BYPASS | TCQ_F_ONETXQUEUE;
 		priv->qdiscs[ntx] = qdisc;
 	}
 
@@ -148,6 +148,8 @@ static int mq_graft(struct Qdisc *sch, unsigned long cl, struct Qdisc *new,
 	if (dev->flags & IFF_UP)
 		dev_deactivate(dev);
 
+	if (new)
+		new->flags |= TCQ_F_ONETXQUEUE;
 	*old = dev_graft_qdisc(dev_queue, new);
 
 	if (dev->flags & IFF_UP)
@@ -0,0 +1,274 @@
+/*
+ * aio-ring-bench: measure AIO completion latency and throughput for the
+ * three ways of reaping events described in
+ * Documentation/filesystems/aio-ring.txt:
+ *
+ *   getevents	io_getevents(2) for every batch of completions
+ *   ring	read events straight from the mapped ring, no syscall
+ *   poll	submit with IOCB_FLAG_POLL, then reap from the ring
+ *
+ * Usage: aio-ring-bench [-m mode] [-n ios] [-d depth] [-b bs] [-w] file
+ *
+ * Reads (or with -w, writes) random bs-aligned blocks of file with
+ * O_DIRECT, keeping depth requests in flight, and prints IOPS and the
+ * submit-to-reap latency distribution.  Point it at a null_blk device
+ * or a fast SSD; the differences are lost on anything slower.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+#include <linux/fs.h>
+
+#ifndef IOCB_FLAG_POLL
+#define IOCB_FLAG_POLL		(1 << 1)
+#endif
+#ifndef AIO_RING_F_USER_REAP
+#define AIO_RING_F_USER_REAP	(1 << 1)
+#endif
+
+#define AIO_RING_MAGIC		0xa10a10a1
+
+struct aio_ring {
+	unsigned	id;
+	unsigned	nr;
+	unsigned	head;
+	unsigned	tail;
+
+	unsigned	magic;
+	unsigned	compat_features;
+	unsigned	incompat_features;
+	unsigned	header_length;
+
+	struct io_event	io_events[0];
+};
+
+#define barrier()	__asm__ __volatile__("" : : : "memory")
+#define mb()		__sync_synchronize()
+#if defined(__i386__) || defined(__x86_64__)
+#define rmb()		barrier()
+#else
+#define rmb()		mb()
+#endif
+
+enum { MODE_GETEVENTS, MODE_RING, MODE_POLL };
+static const char *mode_names[] = { "getevents", "ring", "poll" };
+
+static int io_setup(unsigned nr, aio_context_t *ctx)
+{
+	return syscall(__NR_io_setup, nr, ctx);
+}
+
+static int io_submit(aio_context_t ctx, long nr, struct iocb **iocbs)
+{
+	return syscall(__NR_io_submit, ctx, nr, iocbs);
+}
+
+static int io_getevents(aio_context_t ctx, long min_nr, long nr,
+			struct io_event *events, struct timespec *timeout)
+{
+	return syscall(__NR_io_getevents, ctx, min_nr, nr, events, timeout);
+}
+
+static int io_destroy(aio_context_t ctx)
+{
+	return syscall(__NR_io_destroy, ctx);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Pull up to nr events off the ring, without entering the kernel. */
+static int ring_reap(struct aio_ring *ring, struct io_event *events, int nr)
+{
+	unsigned head = ring->head;
+	unsigned tail = *(volatile unsigned *)&ring->tail;
+	int i = 0;
+
+	rmb();
+	while (head != tail && i < nr) {
+		events[i++] = ring->io_events[head];
+		head = (head + 1) % ring->nr;
+	}
+	mb();
+	ring->head = head;
+	return i;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-m getevents|ring|poll] [-n ios] "
+		"[-d depth] [-b bs] [-w] file\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int mode = MODE_GETEVENTS, write = 0, fd, opt, i;
+	unsigned depth = 32, bs = 4096;
+	unsigned long ios = 100000, submitted = 0, reaped = 0;
+	struct iocb *iocbs, **free_iocbs;
+	struct io_event *events;
+	uint64_t *submit_ns, *lat, start, elapsed;
+	unsigned nr_free;
+	unsigned long long size, blocks;
+	aio_context_t ctx = 0;
+	struct aio_ring *ring;
+	struct stat st;
+	char *bufs;
+
+	while ((opt = getopt(argc, argv, "m:n:d:b:w")) != -1) {
+		switch (opt) {
+		case 'm':
+			for (mode = 0; mode < 3; mode++)
+				if (!strcmp(optarg, mode_names[mode]))
+					break;
+			if (mode == 3)
+				usage(argv[0]);
+			break;
+		case 'n':
+			ios = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			depth = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bs = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			write = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || !depth || !ios || !bs || bs % 512)
+		usage(argv[0]);
+
+	fd = open(argv[optind], (write ? O_RDWR : O_RDONLY) | O_DIRECT);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+	size = st.st_size;
+	if (S_ISBLK(st.st_mode) && ioctl(fd, BLKGETSIZE64, &size) < 0) {
+		perror("BLKGETSIZE64");
+		return 1;
+	}
+	blocks = size / bs;
+	if (!blocks) {
+		fprintf(stderr, "%s: smaller than one block\n", argv[optind]);
+		return 1;
+	}
+
+	if (io_setup(depth, &ctx) < 0) {
+		perror("io_setup");
+		return 1;
+	}
+	ring = (struct aio_ring *)ctx;
+	if (mode != MODE_GETEVENTS &&
+	    (ring->magic != AIO_RING_MAGIC || ring->incompat_features ||
+	     !(ring->compat_features & AIO_RING_F_USER_REAP))) {
+		fprintf(stderr, "kernel does not support reaping from the ring\n");
+		return 1;
+	}
+
+	iocbs = calloc(depth, sizeof(*iocbs));
+	free_iocbs = calloc(depth, sizeof(*free_iocbs));
+	events = calloc(depth, sizeof(*events));
+	submit_ns = calloc(depth, sizeof(*submit_ns));
+	lat = calloc(ios, sizeof(*lat));
+	if (!iocbs || !free_iocbs || !events || !submit_ns || !lat ||
+	    posix_memalign((void **)&bufs, 4096, (size_t)depth * bs)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	memset(bufs, 0xa5, (size_t)depth * bs);
+	for (i = 0; i < depth; i++)
+		free_iocbs[i] = &iocbs[i];
+	nr_free = depth;
+	srand48(getpid());
+
+	start = now_ns();
+	while (reaped < ios) {
+		/* keep the queue full */
+		while (nr_free && submitted < ios) {
+			struct iocb *iocb = free_iocbs[--nr_free];
+			unsigned idx = iocb - iocbs;
+
+			memset(iocb, 0, sizeof(*iocb));
+			iocb->aio_data = idx;
+			iocb->aio_fildes = fd;
+			iocb->aio_lio_opcode = write ? IOCB_CMD_PWRITE :
+						       IOCB_CMD_PREAD;
+			iocb->aio_buf = (unsigned long)(bufs + (size_t)idx * bs);
+			iocb->aio_nbytes = bs;
+			iocb->aio_offset = (lrand48() % blocks) * bs;
+			if (mode == MODE_POLL)
+				iocb->aio_flags = IOCB_FLAG_POLL;
+			submit_ns[idx] = now_ns();
+			if (io_submit(ctx, 1, &iocb) != 1) {
+				perror("io_submit");
+				return 1;
+			}
+			submitted++;
+		}
+
+		if (mode == MODE_GETEVENTS)
+			i = io_getevents(ctx, 1, depth, events, NULL);
+		else
+			i = ring_reap(ring, events, depth);
+		if (i < 0) {
+			perror("io_getevents");
+			return 1;
+		}
+
+		while (i--) {
+			unsigned idx = events[i].data;
+
+			if (events[i].res != bs) {
+				fprintf(stderr, "I/O error: %lld\n",
+					(long long)events[i].res);
+				return 1;
+			}
+			lat[reaped++] = now_ns() - submit_ns[idx];
+			free_iocbs[nr_free++] = &iocbs[idx];
+		}
+	}
+	elapsed = now_ns() - start;
+
+	qsort(lat, ios, sizeof(*lat), cmp_u64);
+	printf("%s: %lu %s of %u bytes, depth %u\n", mode_names[mode], ios,
+	       write ? "writes" : "reads", bs, depth);
+	printf("  %.0f IOPS, latency usec: p50 %.1f  p99 %.1f  max %.1f\n",
+	       ios * 1e9 / elapsed, lat[ios / 2] / 1e3,
+	       lat[ios - ios / 100 - 1] / 1e3, lat[ios - 1] / 1e3);
+
+	io_destroy(ctx);
+	close(fd);
+	return 0;
+}